@@ -30,6 +30,10 @@ local_DEFINES += \
 	-DXWFEATURE_WALKDICT \
 	-DXWFEATURE_WALKDICT_FILTER \
 	-DXWFEATURE_DICTSANITY \
+	-DXWFEATURE_FLATDICT \
+	-DXWFEATURE_DICTMMAP \
+	-DXWFEATURE_DICTREGISTRY \
+	-DXWFEATURE_DICTINDEXFILE \
 	-DFEATURE_TRAY_EDIT \
 	-DXWFEATURE_BONUSALL \
 	-DMAX_ROWS=32 \
@@ -61,6 +65,8 @@ common_SRC_FILES +=        \
 	$(COMMON_PATH)/tray.c       \
 	$(COMMON_PATH)/dictnry.c    \
 	$(COMMON_PATH)/dictiter.c   \
+	$(COMMON_PATH)/dictreg.c    \
+	$(COMMON_PATH)/gaddag.c     \
 	$(COMMON_PATH)/mscore.c     \
 	$(COMMON_PATH)/vtabmgr.c    \
 	$(COMMON_PATH)/strutils.c   \
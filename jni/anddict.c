@@ -31,6 +31,12 @@
 #include "xptypes.h"
 #include "dictnry.h"
 #include "dictnryp.h"
+#ifdef XWFEATURE_GADDAG
+# include "gaddag.h"
+#endif
+#ifdef XWFEATURE_DICTREGISTRY
+# include "dictreg.h"
+#endif
 #include "strutils.h"
 #include "andutils.h"
 #include "utilwrapper.h"
@@ -487,10 +493,18 @@ static void
 and_dictionary_destroy( DictionaryCtxt* dict )
 {
     AndDictionaryCtxt* ctxt = (AndDictionaryCtxt*)dict;
-    XP_U16 nSpecials = andCountSpecials( ctxt );
+    XP_U16 nSpecials;
     XP_U16 ii;
     JNIEnv* env = ctxt->env;
 
+#ifdef XWFEATURE_DICTREGISTRY
+    dictreg_detach( dict );
+#endif
+#ifdef XWFEATURE_DICTMMAP
+    dict_unmap( dict );         /* whatever's shared isn't ours to free */
+#endif
+    nSpecials = andCountSpecials( ctxt );
+
     if ( !!ctxt->super.chars ) {
         for ( ii = 0; ii < nSpecials; ++ii ) {
             XP_UCHAR* text = ctxt->super.chars[ii];
@@ -519,8 +533,18 @@ and_dictionary_destroy( DictionaryCtxt* dict )
     XP_FREEP( ctxt->super.mpool, &ctxt->super.countsAndValues );
     XP_FREEP( ctxt->super.mpool, &ctxt->super.name );
     XP_FREEP( ctxt->super.mpool, &ctxt->super.langName );
+#ifdef XWFEATURE_FLATDICT
+    dict_freeFlat( dict );
+#endif
+#ifdef XWFEATURE_GADDAG
+    if ( !!ctxt->super.gaddag ) {
+        gaddag_destroy( ctxt->super.gaddag );
+    }
+#endif
 
-    if ( NULL == ctxt->byteArray ) { /* mmap case */
+    if ( NULL == ctxt->bytes ) {
+        /* dict_loadMapped() case: nothing to release */
+    } else if ( NULL == ctxt->byteArray ) { /* mmap case */
 #ifdef DEBUG
         int err = 
 #endif
@@ -592,6 +616,46 @@ makeDicts( MPFORMAL JNIEnv *env, JNIUtilCtxt* jniutil,
     }
 }
 
+#ifdef XWFEATURE_DICTMMAP
+/* The rest of what makeDict() does for a dict from dict_loadMapped() */
+static XP_Bool
+andFinishMapped( AndDictionaryCtxt* anddict, XP_U32 numEdges, 
+                 jboolean check )
+{
+    XP_Bool success = !check || checkSanity( &anddict->super, numEdges );
+    if ( success && NULL == anddict->super.md5Sum ) {
+        JNIEnv* env = anddict->env;
+        jstring jsum = and_util_getMD5SumFor( anddict->jniutil, 
+                                              anddict->super.name, NULL, 0 );
+        if ( NULL == jsum ) {
+            XP_U32 nBytes;
+            const XP_U8* bytes = dict_getMappedSumBytes( &anddict->super, 
+                                                         &nBytes );
+            jsum = and_util_getMD5SumFor( anddict->jniutil, 
+                                          anddict->super.name, bytes, nBytes );
+        }
+        anddict->super.md5Sum = getStringCopy( MPPARM(anddict->super.mpool)
+                                               env, jsum );
+        deleteLocalRef( env, jsum );
+    }
+    if ( success ) {
+#ifdef XWFEATURE_DICTREGISTRY
+        dictreg_attach( &anddict->super, numEdges );
+#else
+# ifdef XWFEATURE_FLATDICT
+        (void)dict_makeFlat( &anddict->super, numEdges );
+# endif
+# ifdef XWFEATURE_GADDAG
+        anddict->super.gaddag = gaddag_make( MPPARM(anddict->super.mpool) 
+                                             &anddict->super,
+                                             GADDAG_MAX_BYTES );
+# endif
+#endif
+    }
+    return success;
+} /* andFinishMapped */
+#endif
+
 DictionaryCtxt* 
 makeDict( MPFORMAL JNIEnv *env, JNIUtilCtxt* jniutil, jstring jname, 
           jbyteArray jbytes, jstring jpath, jstring jlangname, jboolean check )
@@ -599,6 +663,7 @@ makeDict( MPFORMAL JNIEnv *env, JNIUtilCtxt* jniutil, jstring jname,
     jbyte* bytes = NULL;
     jbyteArray byteArray = NULL;
     off_t bytesSize = 0;
+    AndDictionaryCtxt* anddict = NULL;
 
     if ( NULL == jpath ) {
         bytesSize = (*env)->GetArrayLength( env, jbytes );
@@ -606,7 +671,19 @@ makeDict( MPFORMAL JNIEnv *env, JNIUtilCtxt* jniutil, jstring jname,
         bytes = (*env)->GetByteArrayElements( env, byteArray, NULL );
     } else {
         const char* path = (*env)->GetStringUTFChars( env, jpath, NULL );
-
+#ifdef XWFEATURE_DICTMMAP
+        XP_U32 numEdges;
+        anddict = (AndDictionaryCtxt*)
+            and_dictionary_make_empty( MPPARM(mpool) env, jniutil );
+        anddict->super.destructor = and_dictionary_destroy;
+        anddict->super.name = getStringCopy( MPPARM(mpool) env, jname );
+        anddict->super.langName = getStringCopy( MPPARM(mpool) env, jlangname );
+        if ( !dict_loadMapped( &anddict->super, path, &numEdges )
+             || !andFinishMapped( anddict, numEdges, check ) ) {
+            and_dictionary_destroy( (DictionaryCtxt*)anddict );
+            anddict = NULL;
+        }
+#else
         struct stat statbuf;
         if ( 0 == stat( path, &statbuf ) && 0 < statbuf.st_size ) {
             int fd = open( path, O_RDONLY );
@@ -620,10 +697,10 @@ makeDict( MPFORMAL JNIEnv *env, JNIUtilCtxt* jniutil, jstring jname,
                 }
             }
         }
+#endif
         (*env)->ReleaseStringUTFChars( env, jpath, path );
     }
 
-    AndDictionaryCtxt* anddict = NULL;
     if ( NULL != bytes ) {
         anddict = (AndDictionaryCtxt*)
             and_dictionary_make_empty( MPPARM(mpool) env, jniutil );
@@ -645,6 +722,24 @@ makeDict( MPFORMAL JNIEnv *env, JNIUtilCtxt* jniutil, jstring jname,
             and_dictionary_destroy( (DictionaryCtxt*)anddict );
             anddict = NULL;
         }
+#ifdef XWFEATURE_DICTREGISTRY
+        if ( !!anddict ) {
+            dictreg_attach( &anddict->super, numEdges );
+        }
+#else
+# ifdef XWFEATURE_FLATDICT
+        if ( !!anddict ) {
+            (void)dict_makeFlat( &anddict->super, numEdges );
+        }
+# endif
+# ifdef XWFEATURE_GADDAG
+        if ( !!anddict ) {
+            anddict->super.gaddag = gaddag_make( MPPARM(mpool) 
+                                                 &anddict->super,
+                                                 GADDAG_MAX_BYTES );
+        }
+# endif
+#endif
     }
     
     return (DictionaryCtxt*)anddict;
@@ -61,6 +61,8 @@ typedef XP_U32 XP_Time;
 # define XP_FREE(pool, p)              free(p)
 void and_freep( void** ptrp );
 # define XP_FREEP(pool, p)             and_freep((void**)p)
+# define XP_PLATMALLOC(nbytes) malloc(nbytes)
+# define XP_PLATFREE(p)        free(p)
 #endif
 
 #define XP_MEMSET(src, val, nbytes)     memset( (src), (val), (nbytes) )
@@ -1405,6 +1405,9 @@ typedef struct _DictIterData {
     DictIter iter;
     IndexData idata;
     XP_U16 depth;
+#ifdef XWFEATURE_DICTINDEXFILE
+    XP_UCHAR* path;             /* of the dict, if it has one */
+#endif
 #ifdef MEM_DEBUG
     MemPoolCtx* mpool;
 #endif
@@ -1429,6 +1432,11 @@ Java_com_oliversride_wordryo_jni_XwJNI_dict_1iter_1init
         data->jniutil = jniutil;
         data->dict = dict;
         data->depth = 2;
+#ifdef XWFEATURE_DICTINDEXFILE
+        if ( NULL != jpath ) {
+            data->path = getStringCopy( MPPARM(mpool) env, jpath );
+        }
+#endif
 #ifdef MEM_DEBUG
         data->mpool = mpool;
 #endif
@@ -1447,6 +1455,9 @@ static void
 freeIndices( DictIterData* data )
 {
     IndexData* idata = &data->idata;
+#ifdef XWFEATURE_DICTINDEXFILE
+    dict_unloadIndexFile( idata );
+#endif
     if ( !!idata->prefixes ) {
         XP_FREE( data->mpool, idata->prefixes );
         idata->prefixes = NULL;
@@ -1458,7 +1469,7 @@ freeIndices( DictIterData* data )
 }
 
 static void
-makeIndex( DictIterData* data )
+buildIndex( DictIterData* data )
 {
     XP_U16 nFaces = dict_numTileFaces( data->dict );
     XP_U16 ii;
@@ -1467,8 +1478,6 @@ makeIndex( DictIterData* data )
         count *= nFaces;
     }
 
-    freeIndices( data );
-
     IndexData* idata = &data->idata;
     idata->prefixes = XP_MALLOC( data->mpool, count * data->depth 
                                  * sizeof(*idata->prefixes) );
@@ -1483,9 +1492,28 @@ makeIndex( DictIterData* data )
                                       sizeof(*idata->prefixes) );
         idata->indices = XP_REALLOC( data->mpool, idata->indices,
                                      idata->count * sizeof(*idata->indices) );
+#ifdef XWFEATURE_DICTINDEXFILE
+        if ( !!data->path ) {
+            dict_saveIndexFile( &data->iter, data->path, data->depth, idata );
+        }
+#endif
     } else {
         freeIndices( data );
     }
+} /* buildIndex */
+
+static void
+makeIndex( DictIterData* data )
+{
+    XP_Bool loaded = XP_FALSE;
+    freeIndices( data );
+#ifdef XWFEATURE_DICTINDEXFILE
+    loaded = !!data->path && dict_loadIndexFile( &data->iter, data->path, 
+                                                 data->depth, &data->idata );
+#endif
+    if ( !loaded ) {
+        buildIndex( data );
+    }
 } /* makeIndex */
 
 JNIEXPORT void JNICALL
@@ -1512,6 +1540,9 @@ Java_com_oliversride_wordryo_jni_XwJNI_dict_1iter_1destroy
         dict_destroy( data->dict );
         destroyJNIUtil( &data->jniutil );
         freeIndices( data );
+#ifdef XWFEATURE_DICTINDEXFILE
+        XP_FREEP( mpool, &data->path );
+#endif
         vtmgr_destroy( MPPARM(mpool) data->vtMgr );
         XP_FREE( mpool, data );
 #ifdef MEM_DEBUG
@@ -1614,7 +1645,8 @@ Java_com_oliversride_wordryo_jni_XwJNI_dict_1iter_1getStartsWith
     DictIterData* data = (DictIterData*)closure;
     if ( NULL != data ) {
         const char* prefix = (*env)->GetStringUTFChars( env, jprefix, NULL );
-        if ( 0 <= dict_findStartsWith( &data->iter, prefix ) ) {
+        if ( 0 <= dict_findStartsWith( &data->iter, prefix, data->depth,
+                                       &data->idata ) ) {
             result = dict_getPosition( &data->iter );
         }
         (*env)->ReleaseStringUTFChars( env, jprefix, prefix );
@@ -37,6 +37,8 @@ COMMONSRC = \
 	$(COMMONDIR)/nwgamest.c \
 	$(COMMONDIR)/dictnry.c \
 	$(COMMONDIR)/dictiter.c \
+	$(COMMONDIR)/gaddag.c \
+	$(COMMONDIR)/dictreg.c \
 	$(COMMONDIR)/engine.c \
 	$(COMMONDIR)/memstream.c \
 	$(COMMONDIR)/comms.c \
@@ -67,6 +69,8 @@ COMMON3 = \
 	$(COMMONOBJDIR)/nwgamest.o \
 	$(COMMONOBJDIR)/dictnry.o \
 	$(COMMONOBJDIR)/dictiter.o \
+	$(COMMONOBJDIR)/gaddag.o \
+	$(COMMONOBJDIR)/dictreg.o \
 	$(COMMONOBJDIR)/engine.o \
 
 COMMON4 = \
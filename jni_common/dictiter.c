@@ -24,6 +24,15 @@
 # include <stdio.h>
 # include <stdlib.h>
 #endif
+#ifdef XWFEATURE_DICTINDEXFILE
+# include <stddef.h>
+# include <limits.h>
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
 
 #include "comtypes.h"
 #include "dictnryp.h"
@@ -31,6 +40,7 @@
 #include "strutils.h"
 #include "dictnry.h"
 #include "dictiter.h"
+#include "dictreg.h"
 #include "game.h"
 
 #ifdef CPLUS
@@ -303,14 +313,31 @@ XP_U32
 dict_countWords( const DictIter* iter, LengthsArray* lens )
 {
     DictIter counter;
+    XP_U32 count;
+    XP_Bool ok;
+#ifdef XWFEATURE_DICTREGISTRY
+    /* Unfiltered counts are the same for every dict with this sum */
+    LengthsArray allLens;
+    XP_Bool unfiltered = XP_TRUE;
+# ifdef XWFEATURE_WALKDICT_FILTER
+    unfiltered = 0 == iter->min && MAX_COLS_DICT <= iter->max;
+# endif
+    if ( unfiltered ) {
+        if ( dictreg_getLengths( iter->dict, lens, &count ) ) {
+            goto done;
+        }
+        if ( NULL == lens ) {
+            lens = &allLens;
+        }
+    }
+#endif
+
     dict_initIterFrom( &counter, iter );
 
     if ( NULL != lens ) {
         XP_MEMSET( lens, 0, sizeof(*lens) );
     }
 
-    XP_U32 count;
-    XP_Bool ok;
     for ( count = 0, ok = firstWord( &counter ); 
           ok; ok = nextWord( &counter) ) {
         ++count;
@@ -319,6 +346,13 @@ dict_countWords( const DictIter* iter, LengthsArray* lens )
             ++lens->lens[counter.nEdges];
         }
     }
+
+#ifdef XWFEATURE_DICTREGISTRY
+    if ( unfiltered ) {
+        dictreg_putLengths( iter->dict, lens, count );
+    }
+ done:
+#endif
     return count;
 }
 
@@ -502,7 +536,11 @@ dict_makeIndex( const DictIter* iter, XP_U16 depth, IndexData* data )
 static void
 initWord( DictIter* iter )
 {
-    iter->nWords = dict_countWords( iter, NULL );
+    /* The count can't change for an iter's lifetime, and may have come from
+       an index file */
+    if ( 0 == iter->nWords ) {
+        iter->nWords = dict_countWords( iter, NULL );
+    }
 }
 
 XP_Bool
@@ -637,13 +675,50 @@ dict_getNthWord( DictIter* iter, DictPosition position, XP_U16 depth,
     return success;
 } /* dict_getNthWord */
 
+/* Index of the entry for the prefix iter's word starts with, or -1 */
+static XP_S16
+findPrefix( const DictIter* iter, XP_U16 depth, const IndexData* data )
+{
+    XP_S16 result = -1;
+    if ( !!data && !!data->prefixes && depth <= iter->nEdges ) {
+        Tile tiles[depth];
+        XP_S16 low = 0;
+        XP_S16 high = data->count - 1;
+        XP_U16 ii;
+        for ( ii = 0; ii < depth; ++ii ) {
+            tiles[ii] = EDGETILE( iter->dict, iter->edges[ii] );
+        }
+        while ( low <= high ) {
+            XP_S16 index = low + ((high - low) / 2);
+            int cmp = XP_MEMCMP( &data->prefixes[depth*index], tiles, depth );
+            if ( 0 == cmp ) {
+                result = index;
+                break;
+            } else if ( cmp < 0 ) {
+                low = index + 1;
+            } else {
+                high = index - 1;
+            }
+        }
+    }
+    return result;
+}
+
 static DictPosition 
-figurePosition( DictIter* iter )
+figurePosition( DictIter* iter, XP_U16 depth, const IndexData* data )
 {
     DictPosition result = 0;
     DictIter iterZero;
+    XP_S16 index = findPrefix( iter, depth, data );
     dict_initIterFrom( &iterZero, iter );
-    if ( !firstWord( &iterZero ) ) {
+    if ( 0 <= index ) {
+        /* start with the first word sharing our prefix */
+        if ( !findWordStartsWith( &iterZero, &data->prefixes[depth*index], 
+                                  depth ) ) {
+            XP_ASSERT( 0 );
+        }
+        result = data->indices[index];
+    } else if ( !firstWord( &iterZero ) ) {
         XP_ASSERT( 0 );
     }
 
@@ -658,7 +733,8 @@ figurePosition( DictIter* iter )
 }
 
 XP_S16
-dict_findStartsWith( DictIter* iter, const XP_UCHAR* prefix )
+dict_findStartsWith( DictIter* iter, const XP_UCHAR* prefix, XP_U16 depth,
+                     const IndexData* data )
 {
     ASSERT_INITED( iter );
     array_edge* edge = dict_getTopEdge( iter->dict );
@@ -671,7 +747,7 @@ dict_findStartsWith( DictIter* iter, const XP_UCHAR* prefix )
         }
     } else {
         if ( ACCEPT_ITER( iter, iter->nEdges ) || nextWord( iter ) ) {
-            DictPosition result = figurePosition( iter );
+            DictPosition result = figurePosition( iter, depth, data );
             iter->position = result;
         } else {
             offset = -1;
@@ -694,6 +770,171 @@ dict_getPosition( const DictIter* iter )
     return iter->position;
 }
 
+#ifdef XWFEATURE_DICTINDEXFILE
+/* An index file is this header, then count DictPositions, then count * depth
+ * Tiles.  It's a cache private to the device that made it, so everything's
+ * in native byte order; headerSize catches a change of compiler or ABI.
+ */
+#define INDEX_FILE_MAGIC "XWIX"
+#define INDEX_FILE_VERSION 1
+#define INDEX_FILE_SUFFIX ".xwi"
+
+typedef struct _IndexFileHeader {
+    XP_U8 magic[4];
+    XP_U16 version;
+    XP_U16 headerSize;
+    XP_UCHAR md5Sum[36];        /* of the dict indexed */
+    XP_U16 min;
+    XP_U16 max;
+    XP_U16 depth;
+    XP_U16 count;
+    XP_U32 nWords;              /* between min and max */
+    XP_U32 nAllWords;
+    LengthsArray lens;          /* of all words */
+} IndexFileHeader;
+
+/* False if the path won't fit, in which case there's no index: better that
+   than a truncated path naming some other file */
+static XP_Bool
+indexFilePath( const char* dictPath, const char* suffix, char* buf,
+               size_t buflen )
+{
+    int len = XP_SNPRINTF( buf, buflen, "%s" INDEX_FILE_SUFFIX "%s",
+                           dictPath, suffix );
+    return 0 <= len && (size_t)len < buflen;
+}
+
+static void
+fillIndexHeader( const DictIter* iter, XP_U16 depth, IndexFileHeader* hdr )
+{
+    XP_MEMSET( hdr, 0, sizeof(*hdr) );
+    XP_MEMCPY( hdr->magic, INDEX_FILE_MAGIC, sizeof(hdr->magic) );
+    hdr->version = INDEX_FILE_VERSION;
+    hdr->headerSize = sizeof(*hdr);
+    XP_STRNCPY( hdr->md5Sum, dict_getMd5Sum( iter->dict ), 
+                sizeof(hdr->md5Sum) - 1 );
+#ifdef XWFEATURE_WALKDICT_FILTER
+    hdr->min = iter->min;
+    hdr->max = iter->max;
+#endif
+    hdr->depth = depth;
+}
+
+XP_Bool
+dict_loadIndexFile( DictIter* iter, const char* dictPath, XP_U16 depth,
+                    IndexData* data )
+{
+    XP_Bool success = XP_FALSE;
+    char path[PATH_MAX];
+    struct stat statbuf;
+    int fd;
+
+    ASSERT_INITED( iter );
+    XP_ASSERT( !data->mapping );
+    if ( NULL == dict_getMd5Sum( iter->dict ) ) {
+        goto done;
+    }
+    if ( !indexFilePath( dictPath, "", path, sizeof(path) ) ) {
+        goto done;
+    }
+    fd = open( path, O_RDONLY );
+    if ( fd < 0 ) {
+        goto done;
+    }
+    if ( 0 == fstat( fd, &statbuf ) && sizeof(IndexFileHeader) 
+         <= statbuf.st_size ) {
+        void* ptr = mmap( NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, 
+                          fd, 0 );
+        if ( MAP_FAILED != ptr ) {
+            const IndexFileHeader* hdr = (const IndexFileHeader*)ptr;
+            IndexFileHeader expect;
+            fillIndexHeader( iter, depth, &expect );
+            if ( 0 == XP_MEMCMP( hdr, &expect, 
+                                 offsetof(IndexFileHeader, count) )
+                 && statbuf.st_size == sizeof(*hdr) 
+                 + (hdr->count * (sizeof(data->indices[0]) 
+                                  + (depth * sizeof(data->prefixes[0])))) ) {
+                const XP_U8* bytes = (const XP_U8*)ptr + sizeof(*hdr);
+                data->mapping = ptr;
+                data->mappingSize = statbuf.st_size;
+                data->count = hdr->count;
+                data->indices = (DictPosition*)bytes;
+                data->prefixes = (Tile*)(bytes + (hdr->count 
+                                                  * sizeof(data->indices[0])));
+                iter->nWords = hdr->nWords;
+#ifdef XWFEATURE_DICTREGISTRY
+                dictreg_putLengths( iter->dict, &hdr->lens, hdr->nAllWords );
+#endif
+                success = XP_TRUE;
+            } else {
+                XP_LOGF( "%s: %s is stale", __func__, path );
+                (void)munmap( ptr, statbuf.st_size );
+            }
+        }
+    }
+    close( fd );
+ done:
+    return success;
+} /* dict_loadIndexFile */
+
+void
+dict_saveIndexFile( DictIter* iter, const char* dictPath, XP_U16 depth,
+                    const IndexData* data )
+{
+    char path[PATH_MAX];
+    char tmpPath[PATH_MAX];
+    IndexFileHeader hdr;
+    DictIter all;
+    int fd;
+
+    ASSERT_INITED( iter );
+    if ( NULL == dict_getMd5Sum( iter->dict ) ) {
+        goto done;
+    }
+    if ( !indexFilePath( dictPath, "", path, sizeof(path) )
+         || !indexFilePath( dictPath, ".tmp", tmpPath, sizeof(tmpPath) ) ) {
+        XP_LOGF( "%s: path too long; not saving index", __func__ );
+        goto done;
+    }
+
+    fillIndexHeader( iter, depth, &hdr );
+    hdr.count = data->count;
+    initWord( iter );           /* caller's about to need it anyway */
+    hdr.nWords = iter->nWords;
+    dict_initIter( &all, iter->dict, 0, MAX_COLS_DICT );
+    hdr.nAllWords = dict_countWords( &all, &hdr.lens );
+
+    /* Write elsewhere and rename so a reader never sees half a file */
+    fd = open( tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( fd >= 0 ) {
+        size_t nIndices = data->count * sizeof(data->indices[0]);
+        size_t nPrefixes = data->count * depth * sizeof(data->prefixes[0]);
+        XP_Bool written = sizeof(hdr) == write( fd, &hdr, sizeof(hdr) )
+            && nIndices == write( fd, data->indices, nIndices )
+            && nPrefixes == write( fd, data->prefixes, nPrefixes );
+        close( fd );
+        if ( !written || 0 != rename( tmpPath, path ) ) {
+            XP_LOGF( "%s: unable to write %s", __func__, path );
+            (void)unlink( tmpPath );
+        }
+    }
+ done:
+    return;
+} /* dict_saveIndexFile */
+
+void
+dict_unloadIndexFile( IndexData* data )
+{
+    if ( !!data->mapping ) {
+        (void)munmap( data->mapping, data->mappingSize );
+        data->mapping = NULL;
+        data->indices = NULL;
+        data->prefixes = NULL;
+        data->count = 0;
+    }
+}
+#endif /* XWFEATURE_DICTINDEXFILE */
+
 #ifdef CPLUS
 }
 #endif
@@ -57,6 +57,10 @@ typedef struct _IndexData {
     DictPosition* indices;
     Tile* prefixes;
     XP_U16 count;    /* in-out: must indicate others are large enough */
+#ifdef XWFEATURE_DICTINDEXFILE
+    void* mapping;   /* non-NULL if indices and prefixes are from a file */
+    XP_U32 mappingSize;
+#endif
 } IndexData;
 
 typedef struct _LengthsArray {
@@ -74,8 +78,24 @@ XP_Bool dict_getPrevWord( DictIter* iter );
 XP_Bool dict_getNthWord( DictIter* iter, DictPosition position, XP_U16 depth, 
                          const IndexData* data );
 void dict_wordToString( const DictIter* iter, XP_UCHAR* buf, XP_U16 buflen );
-XP_S16 dict_findStartsWith( DictIter* iter, const XP_UCHAR* prefix );
+XP_S16 dict_findStartsWith( DictIter* iter, const XP_UCHAR* prefix, 
+                            XP_U16 depth, const IndexData* data );
 DictPosition dict_getPosition( const DictIter* iter );
+
+#ifdef XWFEATURE_DICTINDEXFILE
+/* Index files live beside the dict they index, and hold what
+ * dict_makeIndex() produces plus the word counts that otherwise take a walk
+ * of the whole dict.  Load maps one in, filling in data and iter's word
+ * count, if there is one and it matches iter's dict (by md5 sum), its min
+ * and max, and depth.  Otherwise build the index and save it.  Free a loaded
+ * one with dict_unloadIndexFile().
+ */
+XP_Bool dict_loadIndexFile( DictIter* iter, const char* dictPath, 
+                            XP_U16 depth, IndexData* data );
+void dict_saveIndexFile( DictIter* iter, const char* dictPath, XP_U16 depth,
+                         const IndexData* data );
+void dict_unloadIndexFile( IndexData* data );
+#endif
 #ifdef CPLUS
 }
 #endif
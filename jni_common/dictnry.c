@@ -22,6 +22,14 @@
 # include <stdio.h>
 # include <stdlib.h>
 #endif
+#ifdef XWFEATURE_DICTMMAP
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <pthread.h>
+#endif
 
 #include "comtypes.h"
 #include "dictnryp.h"
@@ -733,6 +741,636 @@ dict_super_init( DictionaryCtxt* dict )
     dict->func_dict_getShortName = dict_getName;
 } /* dict_super_init */
 
+#ifdef XWFEATURE_FLATDICT
+/* Keep the masks on their own cache lines: a node's masks are contiguous, so
+   most lookups touch a single line. */
+#define FLAT_ALIGN 64
+
+# ifndef __GNUC__
+XP_U16
+dict_popcount( XP_U32 mask )
+{
+    XP_U16 count;
+    for ( count = 0; 0 != mask; ++count ) {
+        mask &= mask - 1;
+    }
+    return count;
+}
+# endif
+
+static array_edge*
+dict_flat_edge_with_tile( const DictionaryCtxt* dict, array_edge* from, 
+                          Tile tile ) 
+{
+    return dict_flatEdgeWithTile( dict, from, tile );
+}
+
+void*
+dict_makeFlatMasks( MPFORMAL const DictionaryCtxt* dict, XP_U32 numEdges, 
+                    XP_U32** masksp )
+{
+    void* storage = NULL;
+
+    if ( NULL != dict->base && 0 < numEdges
+         && dict_numTileFaces( dict ) <= 32
+         && dict->func_dict_edge_with_tile == dict_super_edge_with_tile ) {
+        storage = XP_MALLOC( mpool, (numEdges * sizeof(XP_U32)) + FLAT_ALIGN );
+        if ( !!storage ) {
+            XP_U32* masks = (XP_U32*)
+                (((unsigned long)storage + FLAT_ALIGN - 1) 
+                 & ~(unsigned long)(FLAT_ALIGN - 1));
+            array_edge* edge = dict->base + (numEdges * dict->nodeSize);
+            XP_U32 mask = 0;
+            XP_U32 ii;
+            XP_Bool success = XP_TRUE;
+
+            /* Walk backwards so each edge sees the siblings after it.
+               Counting bits to find an edge only works if siblings'
+               tiles are unique and ascending, so those after this one
+               must all be higher; if not, stick with the linear walk. */
+            for ( ii = numEdges; success && ii-- > 0; ) {
+                Tile tile;
+                edge -= dict->nodeSize;
+                tile = EDGETILE( dict, edge );
+                if ( IS_LAST_EDGE( dict, edge ) ) {
+                    mask = 0;
+                }
+                success = tile < 32
+                    && 0 == (mask & (((XP_U32)2 << tile) - 1));
+                mask |= (XP_U32)1 << (tile & 0x1F);
+                masks[ii] = mask;
+            }
+            if ( !success ) {
+                XP_LOGF( "%s: siblings out of order at edge %ld; not "
+                         "flattening", __func__, (long)ii );
+            }
+
+            if ( success ) {
+                *masksp = masks;
+            } else {
+                XP_FREEP( mpool, &storage );
+            }
+        }
+    }
+    return storage;
+} /* dict_makeFlatMasks */
+
+XP_Bool
+dict_makeFlat( DictionaryCtxt* dict, XP_U32 numEdges )
+{
+    XP_U32* masks;
+    XP_ASSERT( !dict->flatMasks );
+    dict->flatStorage = dict_makeFlatMasks( MPPARM(dict->mpool) dict, 
+                                            numEdges, &masks );
+    if ( !!dict->flatStorage ) {
+        dict_useFlat( dict, masks );
+    }
+    return !!dict->flatStorage;
+} /* dict_makeFlat */
+
+void
+dict_useFlat( DictionaryCtxt* dict, XP_U32* masks )
+{
+    dict->flatMasks = masks;
+    dict->func_dict_edge_with_tile = dict_flat_edge_with_tile;
+}
+
+void
+dict_freeFlat( DictionaryCtxt* dict )
+{
+    if ( !!dict->flatMasks ) {
+        dict->func_dict_edge_with_tile = dict_super_edge_with_tile;
+        dict->flatMasks = NULL;
+    }
+    if ( !!dict->flatStorage ) {
+        XP_FREEP( dict->mpool, &dict->flatStorage );
+    }
+}
+#endif
+
+#ifdef XWFEATURE_DICTMMAP
+/* A mapped .xwd and everything parsed from it that dicts can share.  Lives
+ * on s_mappings while any dict uses it.  Pointers marked "in place" point
+ * into bytes; the rest were allocated outside any dict's mempool, since the
+ * mapping can outlive the dict (and pool) that loaded it.
+ */
+typedef struct DictMapping {
+    struct DictMapping* next;
+    XP_U32 refCount;
+
+    /* which file: any change means a new mapping */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    const XP_U8* bytes;
+
+    XP_U32 nWords;
+    const XP_UCHAR* desc;       /* in place */
+    const XP_UCHAR* md5Sum;     /* in place */
+    const XP_U8* sumStart;      /* what a figured md5 sum covers */
+    XP_U8 nFaces;
+    XP_U8 nodeSize;
+    XP_Bool isUTF8;
+    XP_LangCode langCode;
+    XP_UCHAR* faces;
+    XP_UCHAR* facesEnd;
+    const XP_UCHAR** facePtrs;
+    const XP_U8* countsAndValues; /* in place */
+    XP_U16 nSpecials;
+    XP_UCHAR** chars;
+    XP_UCHAR** charEnds;
+    SpecialBitmaps* bitmaps;    /* all NULL */
+    array_edge* base;           /* in place */
+    array_edge* topEdge;
+    XP_U32 numEdges;
+} DictMapping;
+
+static DictMapping* s_mappings = NULL;
+static pthread_mutex_t s_mappingsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define MAP_CHECK(p,c,e)                                                \
+    if ( ((p)+(c)) > (e) ) {                                            \
+        XP_LOGF( "%s (line %d); out of bytes", __func__, __LINE__ );    \
+        goto error;                                                     \
+    }
+
+static XP_U16
+mapGetU16( const XP_U8** ptrp )
+{
+    const XP_U8* ptr = *ptrp;
+    *ptrp += 2;
+    return (ptr[0] << 8) | ptr[1];
+}
+
+static XP_U32
+mapGetU32( const XP_U8** ptrp )
+{
+    const XP_U8* ptr = *ptrp;
+    *ptrp += 4;
+    return ((XP_U32)ptr[0] << 24) | ((XP_U32)ptr[1] << 16) 
+        | ((XP_U32)ptr[2] << 8) | ptr[3];
+}
+
+/* Next code point from utf-8 or iso-8859-1 text, or -1 at end */
+static XP_S32
+nextCodePoint( const XP_U8** ptrp, const XP_U8* end, XP_Bool isUTF8 )
+{
+    const XP_U8* ptr = *ptrp;
+    XP_S32 result = -1;
+    if ( ptr < end ) {
+        result = *ptr++;
+        if ( isUTF8 && 0xC0 <= result ) {
+            XP_U16 nMore = result >= 0xF0 ? 3 : result >= 0xE0 ? 2 : 1;
+            result &= 0x3F >> nMore;
+            while ( nMore-- > 0 && ptr < end ) {
+                result = (result << 6) | (*ptr++ & 0x3F);
+            }
+        }
+    }
+    *ptrp = ptr;
+    return result;
+}
+
+static XP_UCHAR*
+putUTF8( XP_UCHAR* out, XP_S32 cp )
+{
+    if ( cp < 0x80 ) {
+        *out++ = (XP_UCHAR)cp;
+    } else if ( cp < 0x800 ) {
+        *out++ = (XP_UCHAR)(0xC0 | (cp >> 6));
+        *out++ = (XP_UCHAR)(0x80 | (cp & 0x3F));
+    } else if ( cp < 0x10000 ) {
+        *out++ = (XP_UCHAR)(0xE0 | (cp >> 12));
+        *out++ = (XP_UCHAR)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (XP_UCHAR)(0x80 | (cp & 0x3F));
+    } else {
+        *out++ = (XP_UCHAR)(0xF0 | (cp >> 18));
+        *out++ = (XP_UCHAR)(0x80 | ((cp >> 12) & 0x3F));
+        *out++ = (XP_UCHAR)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (XP_UCHAR)(0x80 | (cp & 0x3F));
+    }
+    return out;
+}
+
+/* What android's splitFaces() does in java: each face is a letter followed
+ * by any synonyms, each preceded by SYNONYM_DELIM.  Letters are stored
+ * null-terminated, one after another; specials (below 32) as the single
+ * byte.
+ */
+static XP_Bool
+mapSplitFaces( DictMapping* map, const XP_U8* ptr, XP_U16 nBytes )
+{
+    const XP_U8* end = ptr + nBytes;
+    XP_UCHAR* faces = (XP_UCHAR*)XP_PLATMALLOC( (3 * nBytes) + 1 );
+    const XP_UCHAR** facePtrs = (const XP_UCHAR**)
+        XP_PLATMALLOC( map->nFaces * sizeof(facePtrs[0]) );
+    XP_UCHAR* next = faces;
+    XP_U16 nFound = 0;
+    XP_Bool inFace = XP_FALSE;
+    XP_Bool lastWasDelim = XP_FALSE;
+    XP_S32 cp;
+
+    while ( 0 <= (cp = nextCodePoint( &ptr, end, map->isUTF8 )) ) {
+        if ( SYNONYM_DELIM == cp ) {
+            lastWasDelim = XP_TRUE;
+            continue;
+        }
+        if ( inFace && !lastWasDelim ) {
+            inFace = XP_FALSE;
+        }
+        if ( !inFace ) {
+            if ( nFound == map->nFaces ) {
+                ++nFound;       /* too many */
+                break;
+            }
+            facePtrs[nFound++] = next;
+            inFace = XP_TRUE;
+        }
+        lastWasDelim = XP_FALSE;
+        if ( IS_SPECIAL(cp) ) {
+            *next++ = (XP_UCHAR)cp;
+        } else {
+            next = putUTF8( next, cp );
+        }
+        *next++ = '\0';
+    }
+
+    map->faces = faces;
+    map->facesEnd = next;
+    map->facePtrs = facePtrs;
+    return nFound == map->nFaces;
+} /* mapSplitFaces */
+
+static XP_Bool
+mapSkipBitmap( const XP_U8** ptrp, const XP_U8* end )
+{
+    XP_Bool success = XP_TRUE;
+    const XP_U8* ptr = *ptrp;
+    XP_U8 nCols, nRows;
+    MAP_CHECK( ptr, 1, end );
+    nCols = *ptr++;
+    if ( nCols > 0 ) {
+        MAP_CHECK( ptr, 1, end );
+        nRows = *ptr++;
+        MAP_CHECK( ptr, ((nRows*nCols)+7) / 8, end );
+        ptr += ((nRows*nCols)+7) / 8;
+    }
+    goto done;
+ error:
+    success = XP_FALSE;
+ done:
+    *ptrp = ptr;
+    return success;
+}
+
+static XP_Bool
+mapLoadSpecials( DictMapping* map, const XP_U8** ptrp, const XP_U8* end )
+{
+    XP_Bool success = XP_TRUE;
+    const XP_U8* ptr = *ptrp;
+    XP_U16 ii;
+
+    for ( ii = 0; ii < map->nFaces; ++ii ) {
+        if ( IS_SPECIAL( map->facePtrs[ii][0] ) ) {
+            ++map->nSpecials;
+        }
+    }
+    map->chars = (XP_UCHAR**)
+        XP_PLATMALLOC( (map->nSpecials + 1) * sizeof(map->chars[0]) );
+    map->charEnds = (XP_UCHAR**)
+        XP_PLATMALLOC( (map->nSpecials + 1) * sizeof(map->charEnds[0]) );
+    map->bitmaps = (SpecialBitmaps*)
+        XP_PLATMALLOC( (map->nSpecials + 1) * sizeof(map->bitmaps[0]) );
+    XP_MEMSET( map->chars, 0, (map->nSpecials + 1) * sizeof(map->chars[0]) );
+    XP_MEMSET( map->bitmaps, 0, 
+               (map->nSpecials + 1) * sizeof(map->bitmaps[0]) );
+
+    for ( ii = 0; ii < map->nFaces; ++ii ) {
+        XP_U8 special = (XP_U8)map->facePtrs[ii][0];
+        if ( IS_SPECIAL( special ) ) {
+            XP_U8 txtlen;
+            XP_UCHAR* text;
+            if ( special >= map->nSpecials || !!map->chars[special] ) {
+                goto error;
+            }
+            MAP_CHECK( ptr, 1, end );
+            txtlen = *ptr++;
+            MAP_CHECK( ptr, txtlen, end );
+            text = (XP_UCHAR*)XP_PLATMALLOC( txtlen + 1 );
+            XP_MEMCPY( text, ptr, txtlen );
+            text[txtlen] = '\0';
+            ptr += txtlen;
+            map->chars[special] = text;
+            map->charEnds[special] = text + txtlen + 1;
+            /* as in the platform loaders, synonyms become separate strings */
+            for ( ; '\0' != *text; ++text ) {
+                if ( *text == SYNONYM_DELIM ) {
+                    *text = '\0';
+                }
+            }
+
+            if ( !mapSkipBitmap( &ptr, end ) || !mapSkipBitmap( &ptr, end ) ) {
+                goto error;
+            }
+        }
+    }
+    goto done;
+ error:
+    success = XP_FALSE;
+ done:
+    *ptrp = ptr;
+    return success;
+} /* mapLoadSpecials */
+
+/* Set *strp to the null-terminated string at *ptrp, in place */
+static XP_Bool
+mapGetString( const XP_U8** ptrp, XP_U16* headerLen, const XP_U8* end,
+              const XP_UCHAR** strp )
+{
+    XP_Bool success = XP_FALSE;
+    const XP_U8* ptr = *ptrp;
+    const XP_U8* limit = XP_MIN( ptr + *headerLen, end );
+    const XP_U8* nul;
+    for ( nul = ptr; nul < limit && '\0' != *nul; ++nul ) {
+    }
+    if ( nul < limit ) {
+        XP_U16 len = 1 + (nul - ptr);
+        *strp = (const XP_UCHAR*)ptr;
+        *ptrp += len;
+        *headerLen -= len;
+        success = XP_TRUE;
+    }
+    return success;
+}
+
+/* Mirrors the platforms' parseDict() */
+static XP_Bool
+parseMapping( DictMapping* map )
+{
+    XP_Bool success = XP_TRUE;
+    const XP_U8* ptr = map->bytes;
+    const XP_U8* end = ptr + map->size;
+    XP_U16 flags;
+    XP_U16 nFaceBytes = 0;
+    XP_U32 offset, rest;
+
+    MAP_CHECK( ptr, 2, end );
+    flags = mapGetU16( &ptr );
+    if ( 0 != (DICT_HEADER_MASK & flags) ) {
+        XP_U16 headerLen;
+        flags &= ~DICT_HEADER_MASK;
+        MAP_CHECK( ptr, 2, end );
+        headerLen = mapGetU16( &ptr );
+        if ( 4 <= headerLen ) { /* have word count? */
+            MAP_CHECK( ptr, 4, end );
+            map->nWords = mapGetU32( &ptr );
+            headerLen -= 4;
+        }
+        if ( 1 <= headerLen ) { /* have description? */
+            if ( !mapGetString( &ptr, &headerLen, end, &map->desc ) ) {
+                goto error;
+            }
+        }
+        if ( 1 <= headerLen ) { /* have md5sum? */
+            if ( !mapGetString( &ptr, &headerLen, end, &map->md5Sum ) ) {
+                goto error;
+            }
+        }
+        MAP_CHECK( ptr, headerLen, end );
+        ptr += headerLen;
+    }
+
+    flags &= ~DICT_SYNONYMS_MASK;
+    switch ( flags ) {
+    case 0x0002: map->nodeSize = 3; break;
+    case 0x0003: map->nodeSize = 4; break;
+    case 0x0004: map->nodeSize = 3; map->isUTF8 = XP_TRUE; break;
+    case 0x0005: map->nodeSize = 4; map->isUTF8 = XP_TRUE; break;
+    default: goto error;
+    }
+
+    if ( map->isUTF8 ) {
+        MAP_CHECK( ptr, 1, end );
+        nFaceBytes = *ptr++;
+    }
+    MAP_CHECK( ptr, 1, end );
+    map->nFaces = *ptr++;
+    if ( map->nFaces > 64 || map->nFaces == 0 ) {
+        goto error;
+    }
+    map->sumStart = ptr;
+
+    if ( map->isUTF8 ) {
+        MAP_CHECK( ptr, nFaceBytes, end );
+        if ( !mapSplitFaces( map, ptr, nFaceBytes ) ) {
+            goto error;
+        }
+        ptr += nFaceBytes;
+    } else {
+        /* Each face is two bytes, the second an iso-8859-n char */
+        XP_U8 tmp[64];
+        XP_U16 ii;
+        MAP_CHECK( ptr, 2 * map->nFaces, end );
+        for ( ii = 0; ii < map->nFaces; ++ii ) {
+            tmp[ii] = ptr[1];
+            ptr += 2;
+        }
+        if ( !mapSplitFaces( map, tmp, map->nFaces ) ) {
+            goto error;
+        }
+    }
+
+    MAP_CHECK( ptr, 2, end );
+    map->langCode = ptr[0] & 0x7F;
+    ptr += 2;                   /* skip xloc header */
+    MAP_CHECK( ptr, 2 * map->nFaces, end );
+    map->countsAndValues = ptr;
+    ptr += 2 * map->nFaces;
+
+    if ( !mapLoadSpecials( map, &ptr, end ) ) {
+        goto error;
+    }
+
+    rest = end - ptr;
+    if ( rest >= 4 ) {
+        offset = mapGetU32( &ptr );
+        rest -= 4;
+        map->numEdges = rest / map->nodeSize;
+        if ( 0 != rest % map->nodeSize 
+             || (0 < map->numEdges && offset >= map->numEdges) ) {
+            goto error;
+        }
+    }
+    if ( 0 < map->numEdges ) {
+        map->base = (array_edge*)ptr;
+        map->topEdge = map->base + (offset * map->nodeSize);
+    }
+    goto done;
+ error:
+    success = XP_FALSE;
+ done:
+    return success;
+} /* parseMapping */
+
+static void
+freeMapping( DictMapping* map )
+{
+    XP_U16 ii;
+    if ( !!map->bytes ) {
+        (void)munmap( (void*)map->bytes, map->size );
+    }
+    if ( !!map->chars ) {
+        for ( ii = 0; ii < map->nSpecials; ++ii ) {
+            if ( !!map->chars[ii] ) {
+                XP_PLATFREE( map->chars[ii] );
+            }
+        }
+        XP_PLATFREE( map->chars );
+    }
+    if ( !!map->charEnds ) {
+        XP_PLATFREE( map->charEnds );
+    }
+    if ( !!map->bitmaps ) {
+        XP_PLATFREE( map->bitmaps );
+    }
+    if ( !!map->faces ) {
+        XP_PLATFREE( map->faces );
+    }
+    if ( !!map->facePtrs ) {
+        XP_PLATFREE( (void*)map->facePtrs );
+    }
+    XP_PLATFREE( map );
+} /* freeMapping */
+
+/* Find or make the mapping for path.  Call with s_mappingsMutex held. */
+static DictMapping*
+getMapping( const char* path )
+{
+    DictMapping* map = NULL;
+    struct stat statbuf;
+
+    if ( 0 == stat( path, &statbuf ) && 0 < statbuf.st_size ) {
+        for ( map = s_mappings; !!map; map = map->next ) {
+            if ( map->dev == statbuf.st_dev && map->ino == statbuf.st_ino
+                 && map->size == statbuf.st_size 
+                 && map->mtime == statbuf.st_mtime ) {
+                ++map->refCount;
+                break;
+            }
+        }
+
+        if ( !map ) {
+            int fd = open( path, O_RDONLY );
+            if ( fd >= 0 ) {
+                void* ptr = mmap( NULL, statbuf.st_size, PROT_READ, 
+                                  MAP_PRIVATE, fd, 0 );
+                close( fd );
+                if ( MAP_FAILED != ptr ) {
+                    map = (DictMapping*)XP_PLATMALLOC( sizeof(*map) );
+                    XP_MEMSET( map, 0, sizeof(*map) );
+                    map->bytes = (const XP_U8*)ptr;
+                    map->dev = statbuf.st_dev;
+                    map->ino = statbuf.st_ino;
+                    map->size = statbuf.st_size;
+                    map->mtime = statbuf.st_mtime;
+                    if ( parseMapping( map ) ) {
+                        map->refCount = 1;
+                        map->next = s_mappings;
+                        s_mappings = map;
+                    } else {
+                        XP_LOGF( "%s: unable to parse %s", __func__, path );
+                        freeMapping( map );
+                        map = NULL;
+                    }
+                }
+            }
+        }
+    }
+    return map;
+} /* getMapping */
+
+XP_Bool
+dict_loadMapped( DictionaryCtxt* dict, const char* path, XP_U32* numEdges )
+{
+    DictMapping* map;
+
+    XP_ASSERT( !dict->mapping && !dict->faces && !dict->countsAndValues );
+    pthread_mutex_lock( &s_mappingsMutex );
+    map = getMapping( path );
+    pthread_mutex_unlock( &s_mappingsMutex );
+
+    if ( !!map ) {
+        dict->mapping = map;
+        dict->nWords = map->nWords;
+        dict->desc = (XP_UCHAR*)map->desc;
+        dict->md5Sum = (XP_UCHAR*)map->md5Sum;
+        dict->nodeSize = map->nodeSize;
+        dict->is_4_byte = map->nodeSize == 4;
+        dict->isUTF8 = map->isUTF8;
+        dict->nFaces = map->nFaces;
+        dict->langCode = map->langCode;
+        dict->faces = map->faces;
+        dict->facesEnd = map->facesEnd;
+        dict->facePtrs = map->facePtrs;
+        dict->countsAndValues = (XP_U8*)map->countsAndValues;
+        dict->chars = map->chars;
+        dict->charEnds = map->charEnds;
+        dict->bitmaps = map->bitmaps;
+        dict->base = map->base;
+        dict->topEdge = map->topEdge;
+#ifdef DEBUG
+        dict->numEdges = map->numEdges;
+#endif
+        setBlankTile( dict );
+        *numEdges = map->numEdges;
+    }
+    return !!map;
+} /* dict_loadMapped */
+
+const XP_U8*
+dict_getMappedSumBytes( const DictionaryCtxt* dict, XP_U32* nBytes )
+{
+    const DictMapping* map = dict->mapping;
+    XP_ASSERT( !!map );
+    *nBytes = (map->bytes + map->size) - map->sumStart;
+    return map->sumStart;
+}
+
+void
+dict_unmap( DictionaryCtxt* dict )
+{
+    DictMapping* map = dict->mapping;
+    if ( !!map ) {
+        if ( dict->desc == (XP_UCHAR*)map->desc ) {
+            dict->desc = NULL;
+        }
+        if ( dict->md5Sum == (XP_UCHAR*)map->md5Sum ) {
+            dict->md5Sum = NULL;
+        }
+        dict->faces = dict->facesEnd = NULL;
+        dict->facePtrs = NULL;
+        dict->countsAndValues = NULL;
+        dict->chars = dict->charEnds = NULL;
+        dict->bitmaps = NULL;
+        dict->base = dict->topEdge = NULL;
+        dict->nFaces = 0;
+        dict->mapping = NULL;
+
+        pthread_mutex_lock( &s_mappingsMutex );
+        if ( 0 == --map->refCount ) {
+            DictMapping** prev;
+            for ( prev = &s_mappings; *prev != map; prev = &(*prev)->next ) {
+                XP_ASSERT( !!*prev );
+            }
+            *prev = map->next;
+            freeMapping( map );
+        }
+        pthread_mutex_unlock( &s_mappingsMutex );
+    }
+} /* dict_unmap */
+#endif
+
 const XP_UCHAR* 
 dict_getLangName( const DictionaryCtxt* ctxt )
 {
@@ -95,6 +95,19 @@ struct DictionaryCtxt {
     XP_Bool isUTF8;
 #ifdef DEBUG
     XP_U32 numEdges;
+#endif
+#ifdef XWFEATURE_FLATDICT
+    XP_U32* flatMasks;          /* one per edge; see dict_makeFlat() */
+    void* flatStorage;          /* what was allocated, pre-alignment */
+#endif
+#ifdef XWFEATURE_GADDAG
+    struct Gaddag* gaddag;      /* built at load if there was room */
+#endif
+#ifdef XWFEATURE_DICTMMAP
+    struct DictMapping* mapping; /* non-NULL if dict_loadMapped() */
+#endif
+#ifdef XWFEATURE_DICTREGISTRY
+    struct DictRegEntry* regEntry; /* non-NULL if dictreg_attach() */
 #endif
     MPSLOT
 };
@@ -141,6 +154,73 @@ struct DictionaryCtxt {
     ((Tile)(((array_edge_old*)(edge))->bits & \
             ((d)->is_4_byte?LETTERMASK_NEW_4:LETTERMASK_NEW_3)))
 
+#ifdef XWFEATURE_FLATDICT
+/* Optional index built at load time alongside the DAWG, which remains the
+ * source of truth.  flatMasks[n] holds the set of tiles on edge n and on the
+ * siblings after it in the same node.  Siblings are sorted by tile, so the
+ * edge for a tile is found by counting the mask bits below it rather than by
+ * walking the node.  Only built for dicts with 32 or fewer faces.
+ */
+XP_Bool dict_makeFlat( DictionaryCtxt* dict, XP_U32 numEdges );
+void dict_freeFlat( DictionaryCtxt* dict );
+/* For masks shared between dicts: build them from mpool, returning what to
+   free later (NULL on failure), and have a dict use them without owning
+   them */
+void* dict_makeFlatMasks( MPFORMAL const DictionaryCtxt* dict, 
+                          XP_U32 numEdges, XP_U32** masksp );
+void dict_useFlat( DictionaryCtxt* dict, XP_U32* masks );
+
+# ifdef __GNUC__
+#  define DICT_POPCOUNT(m) __builtin_popcountl(m)
+# else
+#  define DICT_POPCOUNT(m) dict_popcount(m)
+XP_U16 dict_popcount( XP_U32 mask );
+# endif
+
+static inline array_edge*
+dict_flatEdgeWithTile( const DictionaryCtxt* dict, array_edge* from, 
+                       Tile tile )
+{
+    array_edge* result = NULL;
+    XP_U32 offset = from - dict->base;
+    XP_U32 mask = dict->flatMasks[dict->nodeSize == 3 ? 
+                                  offset / 3 : offset >> 2];
+    if ( tile < 32 ) {
+        XP_U32 bit = 1L << tile;
+        if ( 0 != (mask & bit) ) {
+            result = from + (DICT_POPCOUNT( mask & (bit - 1) ) 
+                             * dict->nodeSize);
+        }
+    }
+    return result;
+}
+
+/* Same as dict_super_follow(), but without the calls through func ptrs */
+static inline array_edge*
+dict_flatFollow( const DictionaryCtxt* dict, const array_edge* in )
+{
+    const array_edge_new* edge = (const array_edge_new*)in;
+    XP_U32 index = (edge->highByte << 8) | edge->lowByte;
+    if ( dict->is_4_byte ) {
+        index |= ((XP_U32)edge->moreBits) << 16;
+    } else if ( (edge->bits & EXTRABITMASK_NEW) != 0 ) {
+        index |= 0x00010000;
+    }
+    return 0 == index ? (array_edge*)NULL
+        : (array_edge*)&dict->base[index * dict->nodeSize];
+}
+
+/* Use these on hot paths; they skip the func ptrs when the index exists. */
+# define DICT_EDGE_WITH_TILE(d,e,t) \
+    (!!(d)->flatMasks? dict_flatEdgeWithTile((d),(e),(t)) \
+     : dict_edge_with_tile((d),(e),(t)))
+# define DICT_FOLLOW(d,e) \
+    (!!(d)->flatMasks? dict_flatFollow((d),(e)) : dict_follow((d),(e)))
+#else
+# define DICT_EDGE_WITH_TILE(d,e,t) dict_edge_with_tile((d),(e),(t))
+# define DICT_FOLLOW(d,e) dict_follow((d),(e))
+#endif
+
 XP_Bool dict_tilesAreSame( const DictionaryCtxt* dict1, 
                            const DictionaryCtxt* dict2 );
 
@@ -198,6 +278,25 @@ void dict_splitFaces( DictionaryCtxt* dict, const XP_U8* bytes,
 
 XP_Bool checkSanity( DictionaryCtxt* dict, XP_U32 numEdges );
 
+#ifdef XWFEATURE_DICTMMAP
+/* Load the .xwd at path into a dict the platform has made (and named).  The
+ * file is mapped read-only and parsed in place, without copying the DAWG,
+ * counts and values or header strings.  Every dict loaded from the same file
+ * shares one mapping and the faces and specials' texts split out of it; the
+ * last dict_unmap() frees them.  Specials' bitmaps aren't loaded.  *numEdges
+ * is for dict_makeFlat() and checkSanity().
+ */
+XP_Bool dict_loadMapped( DictionaryCtxt* dict, const char* path, 
+                         XP_U32* numEdges );
+/* What an md5 sum of the dict should cover (everything after the face
+   count) for callers that need to figure one the header lacks */
+const XP_U8* dict_getMappedSumBytes( const DictionaryCtxt* dict, 
+                                     XP_U32* nBytes );
+/* For destructors: give up dict's share of its mapping and clear the fields
+   that pointed into it, so they're not freed */
+void dict_unmap( DictionaryCtxt* dict );
+#endif
+
 #ifdef CPLUS
 }
 #endif
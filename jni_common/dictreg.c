@@ -0,0 +1,280 @@
+/* -*-mode: C; compile-command: "cd ../linux && make MEMDEBUG=TRUE"; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifdef XWFEATURE_DICTREGISTRY
+
+#include <pthread.h>
+
+#include "dictreg.h"
+#include "dictnryp.h"
+#include "gaddag.h"
+#include "strutils.h"
+
+#ifdef CPLUS
+extern "C" {
+#endif
+
+/* One per md5 sum.  Everything here is allocated from the entry's own pool
+ * rather than from that of the dict that built it, since that dict (and its
+ * game) may well go away first.  A pool of its own also lets it be built
+ * without holding s_mutex.
+ */
+typedef struct DictRegEntry {
+    MPSLOT
+    struct DictRegEntry* next;
+    XP_U32 refCount;
+    XP_UCHAR* md5Sum;
+    XP_U32 numEdges;            /* paranoia: must match too */
+    XP_U32 nBytes;
+#ifdef XWFEATURE_FLATDICT
+    void* flatStorage;
+    XP_U32* flatMasks;
+#endif
+#ifdef XWFEATURE_GADDAG
+    Gaddag* gaddag;
+#endif
+#ifdef XWFEATURE_WALKDICT
+    XP_Bool haveLengths;
+    XP_U32 nWords;
+    LengthsArray lens;
+#endif
+} DictRegEntry;
+
+static DictRegEntry* s_entries = NULL;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static XP_U32 s_hits = 0;
+static XP_U32 s_misses = 0;
+
+/* Build what's shared, using dict's edges.  This can take seconds, so it's
+   done without s_mutex; the entry isn't registered yet. */
+static DictRegEntry*
+makeEntry( DictionaryCtxt* dict, XP_U32 numEdges )
+{
+    DictRegEntry* entry;
+#ifdef MEM_DEBUG
+    MemPoolCtx* mpool = mpool_make();
+#endif
+    entry = (DictRegEntry*)XP_CALLOC( mpool, sizeof(*entry) );
+    MPASSIGN( entry->mpool, mpool );
+    entry->md5Sum = copyString( entry->mpool, dict_getMd5Sum( dict ) );
+    entry->numEdges = numEdges;
+    entry->refCount = 1;
+    entry->nBytes = sizeof(*entry);
+
+#ifdef XWFEATURE_FLATDICT
+    entry->flatStorage = dict_makeFlatMasks( MPPARM(entry->mpool) dict,
+                                             numEdges, &entry->flatMasks );
+    if ( !!entry->flatStorage ) {
+        /* so the GADDAG builds faster */
+        dict_useFlat( dict, entry->flatMasks );
+        entry->nBytes += numEdges * sizeof(entry->flatMasks[0]);
+    }
+#endif
+#ifdef XWFEATURE_GADDAG
+    entry->gaddag = gaddag_make( MPPARM(entry->mpool) dict,
+                                 GADDAG_MAX_BYTES );
+    if ( !!entry->gaddag ) {
+        entry->nBytes += entry->gaddag->nEdges * sizeof(GaddagEdge);
+    }
+#endif
+
+    return entry;
+} /* makeEntry */
+
+static void
+freeEntry( DictRegEntry* entry )
+{
+#ifdef MEM_DEBUG
+    MemPoolCtx* mpool = entry->mpool;
+#endif
+#ifdef XWFEATURE_GADDAG
+    if ( !!entry->gaddag ) {
+        gaddag_destroy( entry->gaddag );
+    }
+#endif
+#ifdef XWFEATURE_FLATDICT
+    XP_FREEP( mpool, &entry->flatStorage );
+#endif
+    XP_FREE( mpool, entry->md5Sum );
+    XP_FREE( mpool, entry );
+    mpool_destroy( mpool );
+}
+
+/* The registered entry for md5Sum, with a reference added for the caller,
+   or NULL.  Call with s_mutex held. */
+static DictRegEntry*
+claimEntry( const XP_UCHAR* md5Sum, XP_U32 numEdges )
+{
+    DictRegEntry* entry;
+    for ( entry = s_entries; !!entry; entry = entry->next ) {
+        if ( entry->numEdges == numEdges
+             && 0 == XP_STRCMP( entry->md5Sum, md5Sum ) ) {
+            ++entry->refCount;
+            break;
+        }
+    }
+    return entry;
+}
+
+void
+dictreg_attach( DictionaryCtxt* dict, XP_U32 numEdges )
+{
+    const XP_UCHAR* md5Sum = dict_getMd5Sum( dict );
+    XP_ASSERT( !dict->regEntry );
+
+    if ( NULL == md5Sum ) {
+        /* can't tell who we match; build our own */
+#ifdef XWFEATURE_FLATDICT
+        (void)dict_makeFlat( dict, numEdges );
+#endif
+#ifdef XWFEATURE_GADDAG
+        dict->gaddag = gaddag_make( MPPARM(dict->mpool) dict,
+                                    GADDAG_MAX_BYTES );
+#endif
+    } else {
+        DictRegEntry* built = NULL;
+        DictRegEntry* entry;
+        pthread_mutex_lock( &s_mutex );
+        entry = claimEntry( md5Sum, numEdges );
+        pthread_mutex_unlock( &s_mutex );
+
+        if ( !entry ) {
+            built = makeEntry( dict, numEdges );
+        }
+
+        pthread_mutex_lock( &s_mutex );
+        if ( !!built ) {
+            /* Somebody may have registered the same sum meanwhile */
+            entry = claimEntry( md5Sum, numEdges );
+        }
+        if ( !!entry ) {
+            ++s_hits;
+        } else {
+            built->next = s_entries;
+            s_entries = built;
+            entry = built;
+            built = NULL;
+            ++s_misses;
+        }
+        XP_LOGF( "%s: %s (%ld hits, %ld misses)", __func__, md5Sum,
+                 s_hits, s_misses );
+        pthread_mutex_unlock( &s_mutex );
+
+        if ( !!built ) {
+            freeEntry( built );     /* lost the race; use the winner's */
+        }
+
+        dict->regEntry = entry;
+#ifdef XWFEATURE_FLATDICT
+        if ( !!entry->flatMasks ) {
+            dict_useFlat( dict, entry->flatMasks );
+        }
+#endif
+#ifdef XWFEATURE_GADDAG
+        dict->gaddag = entry->gaddag;
+#endif
+    }
+} /* dictreg_attach */
+
+void
+dictreg_detach( DictionaryCtxt* dict )
+{
+    DictRegEntry* entry = dict->regEntry;
+    if ( !!entry ) {
+#ifdef XWFEATURE_FLATDICT
+        XP_ASSERT( !dict->flatStorage );
+        dict_freeFlat( dict );
+#endif
+#ifdef XWFEATURE_GADDAG
+        dict->gaddag = NULL;
+#endif
+        dict->regEntry = NULL;
+
+        pthread_mutex_lock( &s_mutex );
+        if ( 0 == --entry->refCount ) {
+            DictRegEntry** prev;
+            for ( prev = &s_entries; *prev != entry; prev = &(*prev)->next ) {
+                XP_ASSERT( !!*prev );
+            }
+            *prev = entry->next;
+            freeEntry( entry );
+        }
+        pthread_mutex_unlock( &s_mutex );
+    }
+} /* dictreg_detach */
+
+#ifdef XWFEATURE_WALKDICT
+XP_Bool
+dictreg_getLengths( const DictionaryCtxt* dict, LengthsArray* lens,
+                    XP_U32* nWords )
+{
+    XP_Bool found = XP_FALSE;
+    DictRegEntry* entry = dict->regEntry;
+    if ( !!entry ) {
+        pthread_mutex_lock( &s_mutex );
+        found = entry->haveLengths;
+        if ( found ) {
+            if ( NULL != lens ) {
+                XP_MEMCPY( lens, &entry->lens, sizeof(*lens) );
+            }
+            *nWords = entry->nWords;
+        }
+        pthread_mutex_unlock( &s_mutex );
+    }
+    return found;
+}
+
+void
+dictreg_putLengths( const DictionaryCtxt* dict, const LengthsArray* lens,
+                    XP_U32 nWords )
+{
+    DictRegEntry* entry = dict->regEntry;
+    if ( !!entry ) {
+        pthread_mutex_lock( &s_mutex );
+        if ( !entry->haveLengths ) {
+            XP_MEMCPY( &entry->lens, lens, sizeof(entry->lens) );
+            entry->nWords = nWords;
+            entry->haveLengths = XP_TRUE;
+        }
+        pthread_mutex_unlock( &s_mutex );
+    }
+}
+#endif
+
+void
+dictreg_getStats( DictRegStats* stats )
+{
+    DictRegEntry* entry;
+    XP_MEMSET( stats, 0, sizeof(*stats) );
+
+    pthread_mutex_lock( &s_mutex );
+    stats->hits = s_hits;
+    stats->misses = s_misses;
+    for ( entry = s_entries; !!entry; entry = entry->next ) {
+        ++stats->nEntries;
+        stats->residentBytes += entry->nBytes;
+    }
+    pthread_mutex_unlock( &s_mutex );
+}
+
+#ifdef CPLUS
+}
+#endif
+
+#endif /* XWFEATURE_DICTREGISTRY */
@@ -0,0 +1,74 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _DICTREG_H_
+#define _DICTREG_H_
+
+#ifdef XWFEATURE_DICTREGISTRY
+
+#include "comtypes.h"
+#include "dictnry.h"
+#include "dictiter.h"
+
+#ifdef CPLUS
+extern "C" {
+#endif
+
+/* Every game loads its own DictionaryCtxt, but what's built from a dict's
+ * edges at load time is the same for every dict with the same md5 sum.  The
+ * registry keeps one copy of each such structure per md5 sum, process-wide,
+ * for as long as some dict is attached: the flat index and GADDAG are built
+ * by the first dict attached, and the counts of words by length the first
+ * time anybody asks for them.  What's shared is never changed once built.
+ */
+
+typedef struct DictRegStats {
+    XP_U32 hits;                /* attaches that found their sum registered */
+    XP_U32 misses;              /* attaches that had to build */
+    XP_U16 nEntries;            /* sums registered now */
+    XP_U32 residentBytes;       /* held by all entries' shared structures */
+} DictRegStats;
+
+/* Call once a dict is loaded, in place of building its flat index and
+   GADDAG.  A dict without an md5 sum can't be shared and gets its own.
+   Building holds no lock, so two dicts attaching a new sum at once may
+   both build; the second copy is dropped. */
+void dictreg_attach( DictionaryCtxt* dict, XP_U32 numEdges );
+
+/* For destructors: clear the fields pointing at shared structures, so
+   they're not freed, and drop the dict's reference */
+void dictreg_detach( DictionaryCtxt* dict );
+
+#ifdef XWFEATURE_WALKDICT
+/* Counts by length of every word in dict, figured once per sum.  Returns
+   XP_FALSE if they're not known yet; dictreg_putLengths() to supply them. */
+XP_Bool dictreg_getLengths( const DictionaryCtxt* dict, LengthsArray* lens,
+                            XP_U32* nWords );
+void dictreg_putLengths( const DictionaryCtxt* dict, const LengthsArray* lens,
+                         XP_U32 nWords );
+#endif
+
+void dictreg_getStats( DictRegStats* stats );
+
+#ifdef CPLUS
+}
+#endif
+
+#endif /* XWFEATURE_DICTREGISTRY */
+#endif /* _DICTREG_H_ */
@@ -22,6 +22,13 @@
 #include "engine.h"
 #include "dictnry.h"
 #include "util.h"
+#ifdef XWFEATURE_GADDAG
+# include "gaddag.h"
+#endif
+
+#ifdef XWFEATURE_ENGINE_THREADS
+# include <pthread.h>
+#endif
 
 #ifdef CPLUS
 extern "C" {
@@ -48,14 +55,33 @@ typedef struct PossibleMove {
                                  blanks */
 } PossibleMove;
 
+/* Most moves engine_setMaxSavedMoves() will let a human iterate through */
+#ifndef MAX_SAVED_ENGINE_MOVES
+# define MAX_SAVED_ENGINE_MOVES 4096
+#endif
+
+/* While searching, the moves saved so far are a heap with the one that'd be
+ * dropped next -- the lowest, or the highest if usePrev -- at the root, so
+ * deciding whether a new move makes the cut is one comparison and keeping it
+ * is O(log nMovesToSave).  The heap's entries point into foundMoves[] so only
+ * they get shuffled.  key packs the score with the first bytes of moveInfo
+ * so it orders the same as CMPMOVES, which is needed only when keys tie.
+ */
+typedef struct MoveHeapEntry {
+    XP_U32 key;
+    XP_U16 slot;                /* index into foundMoves */
+} MoveHeapEntry;
+
 /* MoveIterationData is a cache of moves so that next and prev searches don't
- * always trigger an actual search.  Instead we save up to
- * NUM_SAVED_ENGINE_MOVES moves that sort together; then iteration is just
- * returning the next or previous in the cache.  The cache, savedMoves[], is
- * sorted in increasing order, with any unused entries at the low end (since
- * they sort as if score == 0).  nInMoveCache is the actual number of entries.
- * curCacheIndex is the index of the move most recently returned, or outside
- * the range if nothing's been returned yet from the current cache.
+ * always trigger an actual search.  Instead we save up to nMovesToSave moves
+ * that sort together; then iteration is just returning the next or previous
+ * in the cache.  Once the search is done chooseMove() copies the heap into
+ * the cache, savedMoves[], in increasing order, with any unused entries at
+ * the low end (since they sort as if score == 0).  Keeping the two apart
+ * means an interrupted search leaves the cache it started from intact.
+ * nInMoveCache is the actual number of entries.  curCacheIndex is the index
+ * of the move most recently returned, or outside the range if nothing's
+ * been returned yet from the current cache.
  *
  * The cache is empty if nInMoveCache == 0, or if curCacheIndex is in a
  * position that, given engine->usePrev, indicates it's been walked through
@@ -63,13 +89,15 @@ typedef struct PossibleMove {
  */
 
 typedef struct MoveIterationData {
-    /* savedMoves: if any entries are unused (because result set doesn't fill,
-       they're at the low end (where sort'll put 'em) */
-    PossibleMove savedMoves[NUM_SAVED_ENGINE_MOVES];
-    //XP_U16 lowestSavedScore;
+    /* savedMoves, foundMoves and heap are owned by the engine and have
+       maxSavedMoves entries; engine_reset() leaves them alone */
+    PossibleMove* savedMoves;
+    PossibleMove* foundMoves;
+    MoveHeapEntry* heap;
+    XP_U16 nSaved;              /* entries in heap during a search */
     PossibleMove lastSeenMove;
     XP_U16 nInMoveCache; /* num entries, 
-                            0 <= nInMoveCache < NUM_SAVED_ENGINE_MOVES */
+                            0 <= nInMoveCache <= nMovesToSave */
     XP_U16 bottom;   /* lowest non-0 entry */
     XP_S16 curCacheIndex;       /* what we last returned */
 } MoveIterationData;
@@ -78,6 +106,65 @@ typedef struct MoveIterationData {
 typedef XP_U32 CrossBits;
 typedef struct Crosscheck { CrossBits bits[2]; } Crosscheck;
 
+/* Crosschecks depend only on the dict and the tiles in the line crossing
+ * the search direction, so they're kept across searches.  lines[1][col]
+ * holds those for a horizontal search, indexed by row; lines[0] is the same
+ * for a vertical search with col and row swapped as localGetBoardTile() does.
+ * A change at col,row spoils lines[1][col] and lines[0][row], nothing else.
+ */
+typedef struct CrossLine {
+    Crosscheck checks[MAX_ROWS];
+    XP_U16 scores[MAX_ROWS];
+    XP_Bool valid;
+} CrossLine;
+
+typedef struct CrossCache {
+    const ModelCtxt* model;     /* what the lines were figured for */
+    const DictionaryCtxt* dict;
+    XP_U16 nCols;
+    CrossLine lines[2][MAX_COLS];
+} CrossCache;
+
+/* What scoreBound() needs to know about each square in curRow */
+typedef struct BoundSquare {
+    XP_U16 boardValue;          /* value of the tile already there */
+    XP_U16 crossBase;           /* value of the crossword's other tiles */
+    XP_U8 letterMult;
+    XP_U8 wordMult;
+    XP_Bool empty;
+    XP_Bool hasCross;           /* a tile here would form a crossword */
+    XP_Bool blocked;            /* empty, but nothing in the rack fits */
+    XP_Bool anchor;
+} BoundSquare;
+
+#ifdef XWFEATURE_ENGINE_THREADS
+# ifndef MAX_ENGINE_WORKERS
+#  define MAX_ENGINE_WORKERS 8
+# endif
+
+/* A parallel search is broken into units, each one row searched in one
+ * orientation.  Workers claim units from the queue until it's empty, each
+ * searching with its own copy of the EngineCtxt (so its own rack, crosschecks
+ * and saved moves), and merge what they find into the parent's cache after
+ * every unit.  Since the cache keeps the best N moves under a total ordering
+ * (CMPMOVES) the result doesn't depend on which worker finishes first.
+ */
+typedef struct EngineWorkUnit {
+    XP_U8 row;
+    XP_Bool horizontal;
+} EngineWorkUnit;
+
+typedef struct EngineWorkQueue {
+    pthread_mutex_t mutex;      /* protects nextUnit and parent's miData */
+    EngineCtxt* parent;
+    XP_U16 nUnits;
+    XP_U16 nextUnit;
+    volatile XP_Bool abort;     /* set when util says to stop */
+    volatile XP_U16 cutoff;     /* parent's scoreCutoff() after last merge */
+    EngineWorkUnit units[2 * MAX_ROWS];
+} EngineWorkQueue;
+#endif
+
 struct EngineCtxt {
     const ModelCtxt* model;
     const DictionaryCtxt* dict;
@@ -94,6 +181,8 @@ struct EngineCtxt {
     XP_U16 curRow;
     XP_U16 blankCount;
     XP_U16 nMovesToSave;
+    XP_U16 nHumanMoves;         /* nMovesToSave when iq == 0 */
+    XP_U16 maxSavedMoves;       /* room in miData's arrays */
     XP_U16 star_row;
     XP_Bool returnNOW;
     XP_Bool isRobot;
@@ -102,6 +191,13 @@ struct EngineCtxt {
     XP_S16 blankValues[MAX_TRAY_TILES];
     Crosscheck rowChecks[MAX_ROWS]; // also used in xwscore
     XP_U16 scoreCache[MAX_ROWS];
+    CrossCache* crossCache;     /* NULL until first search */
+
+    BoundSquare boundRow[MAX_COLS];
+    Tile rackFaces[MAX_TRAY_TILES];      /* faces in the rack at the start */
+    XP_U16 nRackFaces;
+    XP_U16 rackValues[MAX_TRAY_TILES];   /* their values, highest first */
+    XP_U16 nRackValues;                  /* capped at nTilesMax */
 
     XP_U16 nTilesMax;
 #ifdef XWFEATURE_BONUSALL
@@ -115,6 +211,19 @@ struct EngineCtxt {
 #endif
     XP_U16 lastRowToFill;
 
+#ifdef XWFEATURE_ENGINE_THREADS
+    XP_U16 nWorkers;
+    EngineWorkQueue* queue;     /* non-NULL only for copies doing a unit */
+    XP_Bool isWorkerThread;     /* can't call util */
+#endif
+
+#ifdef XWFEATURE_GADDAG
+    XP_Bool useGaddag;
+    const Gaddag* gaddag;       /* non-NULL if this search is using it */
+    XP_Bool anchorCols[MAX_COLS]; /* for curRow */
+    Tile rowTiles[MAX_COLS];      /* curRow's tiles, as localGetBoardTile() */
+#endif
+
 #ifdef DEBUG
     XP_U16 curLimit;
 #endif
@@ -131,6 +240,9 @@ static void figureCrosschecks( EngineCtxt* engine, XP_U16 col,
                                XP_U16 row, XP_U16* scoreP,
                                Crosscheck* check );
 static XP_Bool isAnchorSquare( EngineCtxt* engine, XP_U16 col, XP_U16 row );
+static void refreshCrossCache( EngineCtxt* engine );
+static void figureBoundSquare( EngineCtxt* engine, XP_U16 col, XP_U16 row,
+                               BoundSquare* square );
 static array_edge* edge_from_tile( const DictionaryCtxt* dict, 
                                    array_edge* from, Tile tile );
 static void leftPart( EngineCtxt* engine, Tile* tiles, XP_U16 tileLength, 
@@ -141,6 +253,11 @@ static void extendRight( EngineCtxt* engine, Tile* tiles, XP_U16 tileLength,
                          XP_U16 firstCol, XP_U16 col, XP_U16 row );
 static array_edge* consumeFromLeft( EngineCtxt* engine, array_edge* edge, 
                                     short col, short row );
+#ifdef XWFEATURE_GADDAG
+static void gaddagGoLeft( EngineCtxt* engine, Tile* revTiles, XP_U16 nPlaced,
+                          const GaddagEdge* run, XP_U16 col,
+                          XP_U16 anchorCol, XP_U16 row );
+#endif
 static XP_Bool rack_remove( EngineCtxt* engine, Tile tile, XP_Bool* isBlank );
 static void rack_replace( EngineCtxt* engine, Tile tile, XP_Bool isBlank );
 static void considerMove( EngineCtxt* engine, Tile* tiles, short tileLength,
@@ -151,10 +268,17 @@ static void considerScoreWordHasBlanks( EngineCtxt* engine, XP_U16 blanksLeft,
                                         BlankTuple* usedBlanks,
                                         XP_U16 usedBlanksCount );
 static void saveMoveIfQualifies( EngineCtxt* engine, PossibleMove* posmove );
+static void sortSavedMoves( EngineCtxt* engine );
 static XP_Bool move_cache_empty( const EngineCtxt* engine );
 static void init_move_cache( EngineCtxt* engine );
 static PossibleMove* next_from_cache( EngineCtxt* engine );
 static void set_search_limits( EngineCtxt* engine );
+static XP_U16 scoreCutoff( const EngineCtxt* engine );
+static XP_U32 scoreBound( const EngineCtxt* engine, XP_U16 firstCol,
+                          XP_U16 firstStop );
+#ifdef XWFEATURE_ENGINE_THREADS
+static void findMovesParallel( EngineCtxt* engine );
+#endif
 
 
 #if defined __LITTLE_ENDIAN
@@ -192,8 +316,12 @@ engine_make( MPFORMAL XW_UtilCtxt* util )
     MPASSIGN(result->mpool, mpool);
 
     result->util = util;
+#ifdef XWFEATURE_GADDAG
+    result->useGaddag = XP_TRUE;
+#endif
 
     engine_reset( result );
+    engine_setMaxSavedMoves( result, NUM_SAVED_ENGINE_MOVES );
 
     return result;
 } /* engine_make */
@@ -221,7 +349,13 @@ engine_makeFromStream( MPFORMAL XWStreamCtxt* XP_UNUSED(stream),
 void
 engine_reset( EngineCtxt* engine )
 {
+    PossibleMove* savedMoves = engine->miData.savedMoves;
+    PossibleMove* foundMoves = engine->miData.foundMoves;
+    MoveHeapEntry* heap = engine->miData.heap;
     XP_MEMSET( &engine->miData, 0, sizeof(engine->miData) );
+    engine->miData.savedMoves = savedMoves;
+    engine->miData.foundMoves = foundMoves;
+    engine->miData.heap = heap;
     /* set last score to max possible */
     engine->miData.lastSeenMove.score = engine->usePrev? 0 : 0xffff;
     engine->searchInProgress = XP_FALSE;
@@ -234,13 +368,86 @@ engine_reset( EngineCtxt* engine )
 #endif
 } /* engine_reset */
 
+#ifdef XWFEATURE_ENGINE_THREADS
+void
+engine_setNWorkers( EngineCtxt* engine, XP_U16 nWorkers )
+{
+    engine->nWorkers = XP_MIN( nWorkers, MAX_ENGINE_WORKERS );
+}
+#endif
+
+#ifdef XWFEATURE_GADDAG
+void
+engine_setUseGaddag( EngineCtxt* engine, XP_Bool useGaddag )
+{
+    engine->useGaddag = useGaddag;
+}
+#endif
+
+/* mpool_realloc() needs an existing block, so the first time is a malloc */
+static void*
+resizeArray( EngineCtxt* engine, void* ptr, XP_U32 size )
+{
+    void* result;
+    if ( !ptr ) {
+        result = XP_MALLOC( engine->mpool, size );
+    } else {
+        result = XP_REALLOC( engine->mpool, ptr, size );
+    }
+    return result;
+} /* resizeArray */
+
+void
+engine_setMaxSavedMoves( EngineCtxt* engine, XP_U16 nMoves )
+{
+    XP_U16 maxSavedMoves;
+    if ( nMoves < 1 ) {
+        nMoves = 1;
+    } else if ( nMoves > MAX_SAVED_ENGINE_MOVES ) {
+        nMoves = MAX_SAVED_ENGINE_MOVES;
+    }
+    /* robots still pick from up to NUM_SAVED_ENGINE_MOVES */
+    maxSavedMoves = XP_MAX( nMoves, NUM_SAVED_ENGINE_MOVES );
+
+    /* Anything cached was found for the old count */
+    engine_reset( engine );
+    engine->nHumanMoves = nMoves;
+    if ( maxSavedMoves != engine->maxSavedMoves ) {
+        engine->maxSavedMoves = maxSavedMoves;
+        engine->miData.savedMoves = (PossibleMove*)
+            resizeArray( engine, engine->miData.savedMoves,
+                         maxSavedMoves * sizeof(PossibleMove) );
+        engine->miData.foundMoves = (PossibleMove*)
+            resizeArray( engine, engine->miData.foundMoves,
+                         maxSavedMoves * sizeof(PossibleMove) );
+        engine->miData.heap = (MoveHeapEntry*)
+            resizeArray( engine, engine->miData.heap,
+                         maxSavedMoves * sizeof(MoveHeapEntry) );
+    }
+} /* engine_setMaxSavedMoves */
+
 void
 engine_destroy( EngineCtxt* engine )
 {
     XP_ASSERT( engine != NULL );
+    XP_FREEP( engine->mpool, &engine->miData.savedMoves );
+    XP_FREEP( engine->mpool, &engine->miData.foundMoves );
+    XP_FREEP( engine->mpool, &engine->miData.heap );
+    XP_FREEP( engine->mpool, &engine->crossCache );
     XP_FREE( engine->mpool, engine );
 } /* engine_destroy */
 
+void
+engine_boardChanged( EngineCtxt* engine, XP_U16 col, XP_U16 row )
+{
+    CrossCache* cache = engine->crossCache;
+    if ( !!cache && col < VSIZE(cache->lines[0]) 
+         && row < VSIZE(cache->lines[0]) ) {
+        cache->lines[1][col].valid = XP_FALSE;
+        cache->lines[0][row].valid = XP_FALSE;
+    }
+} /* engine_boardChanged */
+
 static XP_Bool
 initTray( EngineCtxt* engine, const Tile* tiles, XP_U16 numTiles ) 
 {
@@ -258,6 +465,38 @@ initTray( EngineCtxt* engine, const Tile* tiles, XP_U16 numTiles )
     return result;
 } /* initTray */
 
+/* What scoreBound() needs to know about the rack: which faces are in it
+   (to spot squares no tile can fill) and its values, highest first. */
+static void
+initScoreBounds( EngineCtxt* engine )
+{
+    const DictionaryCtxt* dict = engine->dict;
+    XP_U16 nFaces = XP_MIN( dict_numTileFaces( dict ), MAX_UNIQUE_TILES );
+    XP_U16 count = 0;
+    Tile tile;
+
+    engine->nRackFaces = 0;
+    for ( tile = 0; tile < nFaces; ++tile ) {
+        XP_U16 value = dict_getTileValue( dict, tile );
+        XP_U16 nLeft;
+        if ( 0 < engine->rack[tile]
+             && engine->nRackFaces < VSIZE(engine->rackFaces) ) {
+            engine->rackFaces[engine->nRackFaces++] = tile;
+        }
+        for ( nLeft = engine->rack[tile];
+              nLeft > 0 && count < MAX_TRAY_TILES; --nLeft ) {
+            XP_U16 ii;
+            /* insert, keeping highest first */
+            for ( ii = count++; ii > 0 && engine->rackValues[ii-1] < value;
+                  --ii ) {
+                engine->rackValues[ii] = engine->rackValues[ii-1];
+            }
+            engine->rackValues[ii] = value;
+        }
+    }
+    engine->nRackValues = XP_MIN( count, engine->nTilesMax );
+} /* initScoreBounds */
+
 #if defined __LITTLE_ENDIAN
 static XP_S16
 cmpMoves( PossibleMove* m1, PossibleMove* m2 )
@@ -295,45 +534,25 @@ print_savedMoves( const EngineCtxt* engine, const char* label )
 static XP_Bool
 chooseMove( EngineCtxt* engine, PossibleMove** move ) 
 {
-    XP_U16 ii;
     PossibleMove* chosen = NULL;
     XP_Bool result;
-    XP_Bool done;
 
     print_savedMoves( engine, "unsorted moves" );
 
     /* First, sort 'em.  Put the higher-scoring moves at the top where they'll
-       get picked up first.  Don't sort if we're working for a robot; we've
-       only been saving the single best move anyway.  At least not until we
-       start applying other criteria than score to moves. */
-
-    done = !move_cache_empty( engine );
-    while ( !done ) { /* while so can break */
-        done = XP_TRUE;
-        PossibleMove* cur = engine->miData.savedMoves;
-        for ( ii = 0; ii < engine->nMovesToSave-1; ++ii ) {
-            PossibleMove* next = cur + 1;
-            if ( CMPMOVES( cur, next ) > 0 ) {
-                PossibleMove tmp;
-                XP_MEMCPY( &tmp, cur, sizeof(tmp) );
-                XP_MEMCPY( cur, next, sizeof(*cur) );
-                XP_MEMCPY( next, &tmp, sizeof(*next) );
-                done = XP_FALSE;
-            }
-            cur = next;
-        }
+       get picked up first.  A robot gets the same treatment: its pick is the
+       lowest of the nMovesToSave best. */
 
-        if ( done ) {
-            if ( !engine->isRobot ) {
-                init_move_cache( engine );
-            }
-            print_savedMoves( engine, "sorted moves" );
+    if ( move_cache_empty( engine ) ) {
+        sortSavedMoves( engine );
+        if ( !engine->isRobot ) {
+            init_move_cache( engine );
         }
+        print_savedMoves( engine, "sorted moves" );
     }
 
     /* now pick the one we're supposed to return */
     if ( engine->isRobot ) {
-        XP_ASSERT( engine->miData.nInMoveCache <= NUM_SAVED_ENGINE_MOVES );
         XP_ASSERT( engine->miData.nInMoveCache <= engine->nMovesToSave );
         /* PENDING not nInMoveCache-1 below?? */
         chosen = &engine->miData.savedMoves[engine->miData.nInMoveCache];
@@ -362,7 +581,7 @@ normalizeIQ( EngineCtxt* engine, XP_U16 iq )
 {
     engine->isRobot = 0 < iq;
     if ( 0 == iq ) {            /* human */
-        engine->nMovesToSave = NUM_SAVED_ENGINE_MOVES; /* save 'em all */
+        engine->nMovesToSave = engine->nHumanMoves; /* save 'em all */
     } else if ( 1 == iq ) {            /* smartest robot */
         engine->nMovesToSave = 1;
     } else {
@@ -432,6 +651,9 @@ engine_findMove( EngineCtxt* engine, const ModelCtxt* model,
     engine->usePrev = usePrev;
     engine->blankTile = dict_getBlankTile( engine->dict );
     engine->returnNOW = XP_FALSE;
+#ifdef XWFEATURE_GADDAG
+    engine->gaddag = engine->useGaddag ? engine->dict->gaddag : NULL;
+#endif
 #ifdef XWFEATURE_SEARCHLIMIT
     engine->searchLimits = searchLimits;
 #endif
@@ -451,14 +673,24 @@ engine_findMove( EngineCtxt* engine, const ModelCtxt* model,
 
         util_engineStarting( engine->util, 
                              engine->rack[engine->blankTile] );
+        initScoreBounds( engine );
+        refreshCrossCache( engine );
 
         normalizeIQ( engine, robotIQ );
 
         if ( move_cache_empty( engine ) ) {
             set_search_limits( engine );
 
-            XP_MEMSET( engine->miData.savedMoves, 0,
-                       sizeof(engine->miData.savedMoves) );
+            engine->miData.nSaved = 0;
+
+#ifdef XWFEATURE_ENGINE_THREADS
+            /* Workers can't call util, so model must not need it for
+               scoring */
+            if ( 1 < engine->nWorkers && model_hasBonusTable( model ) ) {
+                findMovesParallel( engine );
+                goto outer;
+            }
+#endif
 
             if ( engine->searchInProgress ) {
                 goto resumePoint;
@@ -543,6 +775,178 @@ engine_findMove( EngineCtxt* engine, const ModelCtxt* model,
     return result;
 } /* engine_findMove */
 
+#ifdef XWFEATURE_ENGINE_THREADS
+static void
+setOrientation( EngineCtxt* engine, XP_Bool horizontal )
+{
+    engine->searchHorizontal = horizontal;
+    engine->numRows = model_numRows( engine->model );
+    engine->numCols = model_numCols( engine->model );
+    if ( !horizontal ) {
+        XP_U16 tmp = engine->numRows;
+        engine->numRows = engine->numCols;
+        engine->numCols = tmp;
+    }
+}
+
+static void
+mergeMoves( EngineCtxt* parent, const EngineCtxt* worker )
+{
+    XP_U16 ii;
+    for ( ii = 0; ii < worker->miData.nSaved; ++ii ) {
+        PossibleMove* move = &worker->miData.foundMoves[ii];
+        if ( scoreQualifies( parent, move->score ) ) {
+            saveMoveIfQualifies( parent, move );
+        }
+    }
+}
+
+static void
+runWorkUnits( EngineCtxt* worker )
+{
+    EngineWorkQueue* queue = worker->queue;
+
+    for ( ; ; ) {
+        EngineWorkUnit unit;
+        XP_Bool haveUnit;
+
+        pthread_mutex_lock( &queue->mutex );
+        haveUnit = !queue->abort && queue->nextUnit < queue->nUnits;
+        if ( haveUnit ) {
+            unit = queue->units[queue->nextUnit++];
+        }
+        pthread_mutex_unlock( &queue->mutex );
+        if ( !haveUnit ) {
+            break;
+        }
+
+        setOrientation( worker, unit.horizontal );
+        worker->curRow = unit.row;
+        worker->miData.nSaved = 0;
+        findMovesOneRow( worker );
+
+        /* An interrupted unit's moves are incomplete; drop them */
+        if ( worker->returnNOW ) {
+            break;
+        }
+
+        pthread_mutex_lock( &queue->mutex );
+        mergeMoves( queue->parent, worker );
+        queue->cutoff = scoreCutoff( queue->parent );
+        pthread_mutex_unlock( &queue->mutex );
+    }
+} /* runWorkUnits */
+
+static void*
+workerProc( void* closure )
+{
+    runWorkUnits( (EngineCtxt*)closure );
+    return NULL;
+}
+
+static void
+addUnits( EngineCtxt* engine, EngineWorkQueue* queue, XP_Bool horizontal )
+{
+    XP_U16 row, firstRow, lastRow;
+#ifdef XWFEATURE_SEARCHLIMIT
+    const BdHintLimits* searchLimits = engine->searchLimits;
+#endif
+
+    setOrientation( engine, horizontal );
+    if ( 0 ) {
+#ifdef XWFEATURE_SEARCHLIMIT
+    } else if ( !!searchLimits ) {
+        firstRow = horizontal? searchLimits->top : searchLimits->left;
+        lastRow = horizontal? searchLimits->bottom : searchLimits->right;
+#endif
+    } else {
+        firstRow = 0;
+        lastRow = engine->numRows - 1;
+    }
+
+    for ( row = firstRow; row <= lastRow; ++row ) {
+        if ( !engine->isFirstMove || row == engine->star_row ) {
+            EngineWorkUnit* unit = &queue->units[queue->nUnits++];
+            XP_ASSERT( queue->nUnits <= VSIZE(queue->units) );
+            unit->row = (XP_U8)row;
+            unit->horizontal = horizontal;
+        }
+    }
+} /* addUnits */
+
+/* Same search as the loop in engine_findMove(), but split into units that
+ * nWorkers threads (this one included) share.  Only this thread's worker
+ * talks to util.  An interrupted search is started over on the next call
+ * rather than resumed.
+ */
+static void
+findMovesParallel( EngineCtxt* engine )
+{
+    EngineWorkQueue queue;
+    EngineCtxt* workers;
+    pthread_t threads[MAX_ENGINE_WORKERS];
+    XP_U16 nWorkers = engine->nWorkers;
+    XP_U16 nStarted;
+    XP_U16 ii;
+
+    XP_MEMSET( &queue, 0, sizeof(queue) );
+    pthread_mutex_init( &queue.mutex, NULL );
+    queue.parent = engine;
+
+    addUnits( engine, &queue, XP_TRUE );
+    if ( 0 ) {
+#ifdef XWFEATURE_SEARCHLIMIT
+    } else if ( engine->isFirstMove && !engine->searchLimits ) {
+        /* horizontal's enough */
+#endif
+    } else {
+        addUnits( engine, &queue, XP_FALSE );
+    }
+
+    workers = (EngineCtxt*)XP_MALLOC( engine->mpool,
+                                      nWorkers * sizeof(*workers) );
+    for ( ii = 0; ii < nWorkers; ++ii ) {
+        EngineCtxt* worker = &workers[ii];
+        XP_MEMCPY( worker, engine, sizeof(*worker) );
+        worker->queue = &queue;
+        worker->isWorkerThread = 0 < ii;
+        worker->returnNOW = XP_FALSE;
+        /* each needs its own heap; only nMovesToSave of it is used */
+        worker->miData.foundMoves = (PossibleMove*)
+            XP_MALLOC( engine->mpool, engine->nMovesToSave
+                       * sizeof(worker->miData.foundMoves[0]) );
+        worker->miData.heap = (MoveHeapEntry*)
+            XP_MALLOC( engine->mpool, engine->nMovesToSave
+                       * sizeof(worker->miData.heap[0]) );
+    }
+
+    for ( nStarted = 1; nStarted < nWorkers; ++nStarted ) {
+        if ( 0 != pthread_create( &threads[nStarted], NULL, workerProc,
+                                  &workers[nStarted] ) ) {
+            XP_LOGF( "%s: only %d of %d workers started", __func__,
+                     nStarted, nWorkers );
+            break;
+        }
+    }
+
+    runWorkUnits( &workers[0] );
+
+    for ( ii = 1; ii < nStarted; ++ii ) {
+        pthread_join( threads[ii], NULL );
+    }
+
+    for ( ii = 0; ii < nWorkers; ++ii ) {
+        XP_FREE( engine->mpool, workers[ii].miData.foundMoves );
+        XP_FREE( engine->mpool, workers[ii].miData.heap );
+    }
+    XP_FREE( engine->mpool, workers );
+    pthread_mutex_destroy( &queue.mutex );
+
+    engine->returnNOW = queue.abort;
+    engine->searchInProgress = XP_FALSE;
+} /* findMovesParallel */
+#endif
+
 static void
 findMovesOneRow( EngineCtxt* engine )
 {
@@ -575,21 +979,171 @@ findMovesOneRow( EngineCtxt* engine )
         if ( col < firstSearchCol || col > lastSearchCol ) {
             engine->scoreCache[col] = 0;
         } else {
-            figureCrosschecks( engine, col, row, 
-                               &engine->scoreCache[col],
-                               &engine->rowChecks[col]);
+            const CrossLine* line = 
+                &engine->crossCache->lines[engine->searchHorizontal][col];
+            XP_ASSERT( line->valid );
+            engine->scoreCache[col] = line->scores[row];
+            engine->rowChecks[col] = line->checks[row];
+        }
+    }
+
+    for ( col = 0; col <= lastCol; ++col ) {
+        figureBoundSquare( engine, col, row, &engine->boundRow[col] );
+    }
+
+#ifdef XWFEATURE_GADDAG
+    if ( !!engine->gaddag ) {
+        /* Going left from an anchor stops at the next one */
+        for ( col = 0; col <= lastCol; ++col ) {
+            engine->anchorCols[col] = isAnchorSquare( engine, col, row );
+            engine->rowTiles[col] = localGetBoardTile( engine, col, row,
+                                                       XP_FALSE );
         }
     }
+#endif
 
     prevAnchor = firstSearchCol - 1;
     for ( col = firstSearchCol; col <= lastSearchCol && !engine->returnNOW; 
           ++col ) {
-        if ( isAnchorSquare( engine, col, row ) ) { 
+        if ( engine->boundRow[col].anchor ) { 
             findMovesForAnchor( engine, &prevAnchor, col, row );
         }
     }
 } /* findMovesOneRow */
 
+/* Refigure whatever lines board changes have spoiled, or all of them if the
+ * game, dict or board size isn't what they were figured for.  Done before
+ * searching so findMovesOneRow() (which may be on a worker thread) only ever
+ * reads the cache.
+ */
+static void
+refreshCrossCache( EngineCtxt* engine )
+{
+    CrossCache* cache = engine->crossCache;
+    XP_U16 nCols = model_numCols( engine->model );
+    XP_Bool searchHorizontal = engine->searchHorizontal;
+    XP_U16 numRows = engine->numRows;
+    XP_U16 numCols = engine->numCols;
+    XP_U16 hh, col, row;
+
+    XP_ASSERT( nCols == model_numRows( engine->model ) );
+    XP_ASSERT( nCols <= MAX_COLS );
+    if ( !cache ) {
+        cache = (CrossCache*)XP_CALLOC( engine->mpool, sizeof(*cache) );
+        engine->crossCache = cache;
+    }
+    if ( cache->model != engine->model || cache->dict != engine->dict 
+         || cache->nCols != nCols ) {
+        for ( col = 0; col < VSIZE(cache->lines[0]); ++col ) {
+            cache->lines[0][col].valid = cache->lines[1][col].valid = XP_FALSE;
+        }
+        cache->model = engine->model;
+        cache->dict = engine->dict;
+        cache->nCols = nCols;
+    }
+
+    /* figureCrosschecks() sees the board through these */
+    engine->numRows = engine->numCols = nCols;
+    for ( hh = 0; hh < 2; ++hh ) {
+        engine->searchHorizontal = 1 == hh;
+        for ( col = 0; col < nCols; ++col ) {
+            CrossLine* line = &cache->lines[hh][col];
+            if ( !line->valid ) {
+                XP_MEMSET( line->checks, 0, sizeof(line->checks) );
+                for ( row = 0; row < nCols; ++row ) {
+                    figureCrosschecks( engine, col, row, &line->scores[row],
+                                       &line->checks[row] );
+                }
+                line->valid = XP_TRUE;
+            }
+        }
+    }
+    engine->searchHorizontal = searchHorizontal;
+    engine->numRows = numRows;
+    engine->numCols = numCols;
+} /* refreshCrossCache */
+
+static XP_U16
+crossTilesValue( EngineCtxt* engine, XP_U16 col, XP_U16 row, XP_S16 incr )
+{
+    XP_U16 value = 0;
+    XP_S16 yy;
+    for ( yy = row + incr; yy >= 0 && yy < engine->numRows; yy += incr ) {
+        Tile tile = localGetBoardTile( engine, col, yy, XP_TRUE );
+        if ( tile == EMPTY_TILE ) {
+            break;
+        }
+        value += dict_getTileValue( engine->dict, tile );
+    }
+    return value;
+}
+
+static void
+figureBoundSquare( EngineCtxt* engine, XP_U16 col, XP_U16 row,
+                   BoundSquare* square )
+{
+    Tile tile = localGetBoardTile( engine, col, row, XP_TRUE );
+    XWBonusType bonus;
+
+    XP_MEMSET( square, 0, sizeof(*square) );
+    square->letterMult = square->wordMult = 1;
+    square->empty = tile == EMPTY_TILE;
+    if ( !square->empty ) {
+        square->boardValue = dict_getTileValue( engine->dict, tile );
+    } else {
+        const Crosscheck* check = &engine->rowChecks[col];
+        XP_U16 ii;
+
+        /* Fits are judged against the whole rack, which is never smaller
+           than what's left of it */
+        if ( 0 < engine->rack[engine->blankTile] ) {
+            square->blocked = 0 == check->bits[0] && 0 == check->bits[1];
+        } else {
+            square->blocked = XP_TRUE;
+            for ( ii = 0; ii < engine->nRackFaces; ++ii ) {
+                Tile face = engine->rackFaces[ii];
+                if ( 0 != (check->bits[face >> 5] & (1L << (face & 0x1F))) ) {
+                    square->blocked = XP_FALSE;
+                    break;
+                }
+            }
+        }
+
+        square->anchor = isAnchorSquare( engine, col, row );
+        square->hasCross = 
+            (row > 0 && EMPTY_TILE != 
+             localGetBoardTile( engine, col, row - 1, XP_FALSE ))
+            || (row < engine->numRows - 1 && EMPTY_TILE != 
+                localGetBoardTile( engine, col, row + 1, XP_FALSE ));
+        if ( square->hasCross ) {
+            /* same as scoreCache[], which is only figured inside the search
+               limits */
+            square->crossBase = crossTilesValue( engine, col, row, -1 )
+                + crossTilesValue( engine, col, row, 1 );
+        }
+
+        bonus = engine->searchHorizontal
+            ? model_getSquareBonus( engine->model, col, row )
+            : model_getSquareBonus( engine->model, row, col );
+        switch ( bonus ) {
+        case BONUS_DOUBLE_LETTER:
+            square->letterMult = 2;
+            break;
+        case BONUS_TRIPLE_LETTER:
+            square->letterMult = 3;
+            break;
+        case BONUS_DOUBLE_WORD:
+            square->wordMult = 2;
+            break;
+        case BONUS_TRIPLE_WORD:
+            square->wordMult = 3;
+            break;
+        default:
+            break;
+        }
+    }
+} /* figureBoundSquare */
+
 static XP_Bool
 lookup( const DictionaryCtxt* dict, array_edge* edge, Tile* buf, 
         XP_U16 tileIndex, XP_U16 length ) 
@@ -597,7 +1151,7 @@ lookup( const DictionaryCtxt* dict, array_edge* edge, Tile* buf,
     XP_Bool result = XP_FALSE;
     while ( edge != NULL ) {
         Tile targetTile = buf[tileIndex];
-        edge = dict_edge_with_tile( dict, edge, targetTile );
+        edge = DICT_EDGE_WITH_TILE( dict, edge, targetTile );
         if ( edge == NULL ) { /* tile not available out of this node */
             break;
         } else {
@@ -605,7 +1159,7 @@ lookup( const DictionaryCtxt* dict, array_edge* edge, Tile* buf,
                 result = ISACCEPTING(dict, edge);
                 break;
             } else {
-                edge = dict_follow( dict, edge );
+                edge = DICT_FOLLOW( dict, edge );
                 continue;
             }
         }
@@ -735,6 +1289,98 @@ engine_check( DictionaryCtxt* dict, Tile* tiles, XP_U16 nTiles )
     return lookup( dict, in_edge, tiles, 0, nTiles );
 } /* engine_check */
 
+#ifdef XWFEATURE_FLATDICT
+# ifdef __GNUC__
+#  define PREFETCH_EDGE(e) __builtin_prefetch( (e) )
+# else
+#  define PREFETCH_EDGE(e)
+# endif
+
+/* With the flat index each step is a single lookup, so its cost is mostly
+ * waiting on memory.  Walk the words in lockstep, a tile per live lane per
+ * step, so the cache misses of up to ENGINE_CHECK_LANES walks overlap
+ * instead of following one another.  Each lane asks for the node it'll need
+ * next as soon as it knows it; lanes that finish are dropped so the rest stay
+ * packed.
+ */
+static void
+checkLockstep( const DictionaryCtxt* dict, array_edge* topEdge,
+               const Tile* const* words, const XP_U16* lengths, 
+               XP_U32 nWords, XP_U32* legal )
+{
+    XP_U32 first;
+
+    for ( first = 0; first < nWords; first += ENGINE_CHECK_LANES ) {
+        array_edge* edges[ENGINE_CHECK_LANES];
+        XP_U32 lanes[ENGINE_CHECK_LANES]; /* which word each lane has */
+        XP_U16 nLive = 0;
+        XP_U16 depth, ii;
+        XP_U32 word;
+
+        for ( word = first; word < nWords && word < first + ENGINE_CHECK_LANES;
+              ++word ) {
+            if ( 0 < lengths[word] ) {
+                edges[nLive] = topEdge;
+                lanes[nLive++] = word;
+            }
+        }
+
+        for ( depth = 0; 0 < nLive; ++depth ) {
+            XP_U16 nKept = 0;
+            for ( ii = 0; ii < nLive; ++ii ) {
+                array_edge* edge;
+                word = lanes[ii];
+                edge = dict_flatEdgeWithTile( dict, edges[ii], 
+                                              words[word][depth] );
+                if ( NULL == edge ) {
+                    /* no word starts this way */
+                } else if ( depth + 1 == lengths[word] ) {
+                    if ( ISACCEPTING( dict, edge ) ) {
+                        legal[word >> 5] |= 1L << (word & 0x1F);
+                    }
+                } else {
+                    edge = dict_flatFollow( dict, edge );
+                    if ( NULL != edge ) {
+                        PREFETCH_EDGE( edge );
+                        edges[nKept] = edge;
+                        lanes[nKept++] = word;
+                    }
+                }
+            }
+            nLive = nKept;
+        }
+    }
+} /* checkLockstep */
+#endif
+
+void
+engine_checkBatch( const DictionaryCtxt* dict, const Tile* const* words, 
+                   const XP_U16* lengths, XP_U32 nWords, XP_U32* legal )
+{
+    array_edge* topEdge = dict_getTopEdge( dict );
+    XP_U32 ii;
+
+    XP_MEMSET( legal, 0, ENGINE_CHECK_WORDS(nWords) * sizeof(legal[0]) );
+
+    if ( NULL == topEdge ) {
+        /* empty dict: nothing's legal */
+#ifdef XWFEATURE_FLATDICT
+    } else if ( !!dict->flatMasks ) {
+        checkLockstep( dict, topEdge, words, lengths, nWords, legal );
+#endif
+    } else {
+        /* Scanning siblings dominates here, and interleaving only adds
+           overhead */
+        for ( ii = 0; ii < nWords; ++ii ) {
+            if ( 0 < lengths[ii] 
+                 && lookup( dict, topEdge, (Tile*)words[ii], 0, 
+                            lengths[ii] ) ) {
+                legal[ii >> 5] |= 1L << (ii & 0x1F);
+            }
+        }
+    }
+} /* engine_checkBatch */
+
 static Tile
 localGetBoardTile( EngineCtxt* engine, XP_U16 col, XP_U16 row, 
                    XP_Bool substBlank )
@@ -798,6 +1444,11 @@ isAnchorSquare( EngineCtxt* engine, XP_U16 col, XP_U16 row )
 static void
 hiliteForAnchor( EngineCtxt* engine, XP_U16 col, XP_U16 row )
 {
+#ifdef XWFEATURE_ENGINE_THREADS
+    if ( !!engine->queue ) {
+        return;
+    }
+#endif
     if ( !engine->searchHorizontal ) {
         XP_U16 tmp = col;
         col = row;
@@ -812,6 +1463,35 @@ hiliteForAnchor( EngineCtxt* engine, XP_U16 col, XP_U16 row )
 # define hiliteForAnchor( engine, col, row )
 #endif
 
+/* Could any move through the anchor at col score enough to be saved?  Moves
+ * found from this anchor start after the nearest empty anchor to its left
+ * (leftPart() and gaddagGoLeft() both stop there) and at a square with
+ * nothing on its left.
+ */
+static XP_Bool
+anchorCanQualify( const EngineCtxt* engine, XP_U16 col )
+{
+    XP_Bool canQualify = XP_TRUE;
+    XP_U16 cutoff = scoreCutoff( engine );
+
+    if ( 0 < cutoff ) {
+        const BoundSquare* squares = engine->boundRow;
+        XP_U16 start = col;
+        while ( start > 0 
+                && !(squares[start-1].empty && squares[start-1].anchor) ) {
+            --start;
+        }
+
+        canQualify = XP_FALSE;
+        for ( ; start <= col && !canQualify; ++start ) {
+            if ( start == 0 || squares[start-1].empty ) {
+                canQualify = scoreBound( engine, start, col + 1 ) >= cutoff;
+            }
+        }
+    }
+    return canQualify;
+} /* anchorCanQualify */
+
 static void
 findMovesForAnchor( EngineCtxt* engine, XP_S16* prevAnchor, 
                     XP_U16 col, XP_U16 row ) 
@@ -825,6 +1505,16 @@ findMovesForAnchor( EngineCtxt* engine, XP_S16* prevAnchor,
 
     if ( engine->returnNOW ) {
         /* time to bail */
+    } else if ( !anchorCanQualify( engine, col ) ) {
+        /* nothing through here can make the cut */
+        *prevAnchor = col;
+#ifdef XWFEATURE_GADDAG
+    } else if ( !!engine->gaddag ) {
+        DEBUG_ASSIGN( engine->curLimit, 0 );
+        gaddagGoLeft( engine, tiles, 0, GADDAG_ROOT(engine->gaddag), 
+                      col, col, row );
+        *prevAnchor = col;
+#endif
     } else {
         limit = col - *prevAnchor - 1;
 #ifdef TEST_MINLIMIT
@@ -884,6 +1574,91 @@ consumeFromLeft( EngineCtxt* engine, array_edge* edge, short col, short row )
     return edge;
 } /* consumeFromLeft */
 
+#ifdef XWFEATURE_GADDAG
+/* GADDAG search.  Starting on the anchor, letters are laid down leftward
+ * while following the GADDAG, which only allows those that end (reading
+ * forward) in a way some word can continue.  Whenever what's been laid down
+ * starts a word, and nothing on the board is touching it on the left, the
+ * rest of the word is found by extendRight() using the DAWG, just as after
+ * leftPart().  Going left stops before the previous anchor, so as with
+ * leftPart() each move is found from its leftmost anchor only.
+ */
+static const GaddagEdge*
+gaddagEdgeWithTile( const GaddagEdge* edge, Tile tile )
+{
+    for ( ; ; ++edge ) {
+        if ( edge->tile == tile ) {
+            break;
+        } else if ( edge->tile > tile || GADDAG_IS_LAST(edge) ) {
+            edge = NULL;
+            break;
+        }
+    }
+    return edge;
+}
+
+/* Just laid down (or passed over) edge's tile at col */
+static void
+gaddagNext( EngineCtxt* engine, Tile* revTiles, XP_U16 nPlaced,
+            const GaddagEdge* edge, XP_U16 col, XP_U16 anchorCol, XP_U16 row )
+{
+    XP_Bool leftEmpty = col == 0 || EMPTY_TILE == engine->rowTiles[col-1];
+
+    if ( leftEmpty && GADDAG_IS_PREFIX(edge) ) {
+        Tile tiles[MAX_COLS];
+        XP_U16 ii;
+        for ( ii = 0; ii < nPlaced; ++ii ) {
+            tiles[ii] = revTiles[nPlaced - 1 - ii];
+        }
+        extendRight( engine, tiles, nPlaced, 
+                     dict_edge_for_index( engine->dict, edge->dawgIndex ),
+                     GADDAG_IS_WORD(edge), col, anchorCol + 1, row );
+    }
+
+    if ( !engine->returnNOW && col > 0 
+         && (!leftEmpty || !engine->anchorCols[col-1]) ) {
+        const GaddagEdge* next = GADDAG_FOLLOW( engine->gaddag, edge );
+        if ( !!next ) {
+            gaddagGoLeft( engine, revTiles, nPlaced, next, col - 1, 
+                          anchorCol, row );
+        }
+    }
+} /* gaddagNext */
+
+static void
+gaddagGoLeft( EngineCtxt* engine, Tile* revTiles, XP_U16 nPlaced,
+              const GaddagEdge* run, XP_U16 col, XP_U16 anchorCol, 
+              XP_U16 row )
+{
+    Tile tile = engine->rowTiles[col];
+
+    if ( tile != EMPTY_TILE ) {
+        const GaddagEdge* edge = gaddagEdgeWithTile( run, tile );
+        if ( !!edge ) {
+            gaddagNext( engine, revTiles, nPlaced, edge, col, anchorCol, row );
+        }
+    } else if ( engine->nTilesMax > 0 ) {
+        const Crosscheck* check = &engine->rowChecks[col];
+        const GaddagEdge* edge;
+        for ( edge = run; ; ++edge ) {
+            tile = edge->tile;
+            if ( 0 != (check->bits[tile >> 5] & (1L << (tile & 0x1F))) ) {
+                XP_Bool isBlank;
+                if ( rack_remove( engine, tile, &isBlank ) ) {
+                    revTiles[nPlaced] = tile;
+                    gaddagNext( engine, revTiles, nPlaced + 1, edge, col,
+                                anchorCol, row );
+                    rack_replace( engine, tile, isBlank );
+                }
+            }
+            if ( GADDAG_IS_LAST(edge) || engine->returnNOW ) {
+                break;
+            }
+        }
+    }
+} /* gaddagGoLeft */
+#endif
+
 static void
 leftPart( EngineCtxt* engine, Tile* tiles, XP_U16 tileLength, 
           array_edge* edge, XP_U16 limit, XP_U16 firstCol,
@@ -903,7 +1678,7 @@ leftPart( EngineCtxt* engine, Tile* tiles, XP_U16 tileLength,
                     if ( rack_remove( engine, tile, &isBlank ) ) {
                         tiles[tileLength] = tile;
                         leftPart( engine, tiles, tileLength+1, 
-                                  dict_follow( engine->dict, edge ), 
+                                  DICT_FOLLOW( engine->dict, edge ), 
                                   limit-1, firstCol-1, anchorCol, row );
                         rack_replace( engine, tile, isBlank );
                     }
@@ -961,8 +1736,10 @@ extendRight( EngineCtxt* engine, Tile* tiles, XP_U16 tileLength,
                     XP_Bool isBlank;
                     if ( rack_remove( engine, tile, &isBlank ) ) {
                         tiles[tileLength] = tile;
+                        /* edge already carries tile: no need to look it
+                           up again */
                         extendRight( engine, tiles, tileLength+1, 
-                                     edge_from_tile( dict, edge, tile ), 
+                                     DICT_FOLLOW( dict, edge ), 
                                      ISACCEPTING( dict, edge ), firstCol, 
                                      col+1, row );
                         rack_replace( engine, tile, isBlank );
@@ -979,9 +1756,9 @@ extendRight( EngineCtxt* engine, Tile* tiles, XP_U16 tileLength,
             }
         }
 
-    } else if ( (edge = dict_edge_with_tile( dict, edge, tile ) ) != NULL ) {
+    } else if ( (edge = DICT_EDGE_WITH_TILE( dict, edge, tile ) ) != NULL ) {
         accepting = ISACCEPTING( dict, edge );
-        extendRight( engine, tiles, tileLength, dict_follow(dict, edge), 
+        extendRight( engine, tiles, tileLength, DICT_FOLLOW(dict, edge), 
                      accepting, firstCol, col+1, row );
         goto no_check; /* don't do the check at the end */
     } else {
@@ -1036,6 +1813,26 @@ rack_replace( EngineCtxt* engine, Tile tile, XP_Bool isBlank )
     ++engine->nTilesMax;
 } /* rack_replace */
 
+static XP_Bool
+keepGoing( EngineCtxt* engine )
+{
+    XP_Bool result;
+#ifdef XWFEATURE_ENGINE_THREADS
+    if ( engine->isWorkerThread ) {
+        result = !engine->queue->abort;
+    } else
+#endif
+    {
+        result = util_engineProgressCallback( engine->util );
+#ifdef XWFEATURE_ENGINE_THREADS
+        if ( !result && !!engine->queue ) {
+            engine->queue->abort = XP_TRUE;
+        }
+#endif
+    }
+    return result;
+} /* keepGoing */
+
 static void
 considerMove( EngineCtxt* engine, Tile* tiles, XP_S16 tileLength,
               XP_S16 firstCol, XP_S16 lastRow )
@@ -1044,7 +1841,7 @@ considerMove( EngineCtxt* engine, Tile* tiles, XP_S16 tileLength,
     short col;
     BlankTuple blankTuples[MAX_NUM_BLANKS];
 
-    if ( !util_engineProgressCallback( engine->util ) ) {
+    if ( !keepGoing( engine ) ) {
         engine->returnNOW = XP_TRUE;
     } else {
 
@@ -1140,90 +1937,146 @@ considerScoreWordHasBlanks( EngineCtxt* engine, XP_U16 blanksLeft,
     }
 } /* considerScoreWordHasBlanks */
 
+static XP_U32
+heapKey( const PossibleMove* move )
+{
+    return ((XP_U32)move->score << 16) | (move->moveInfo.nTiles << 8)
+        | move->moveInfo.commonCoord;
+}
+
+/* Compare the way CMPMOVES would, but looking at the moves only on a tie */
+static XP_S16
+cmpHeapMoves( const EngineCtxt* engine, XP_U32 key1, PossibleMove* move1,
+              const MoveHeapEntry* entry2 )
+{
+    XP_S16 result;
+    if ( key1 < entry2->key ) {
+        result = -1;
+    } else if ( key1 > entry2->key ) {
+        result = 1;
+    } else {
+        result = CMPMOVES( move1, &engine->miData.foundMoves[entry2->slot] );
+    }
+    return result;
+}
+
+/* Would move1 be dropped before entry2?  That's the heap's ordering. */
+static XP_Bool
+heapIsWorse( const EngineCtxt* engine, const MoveHeapEntry* entry1,
+             const MoveHeapEntry* entry2 )
+{
+    XP_S16 cmpVal = cmpHeapMoves( engine, entry1->key,
+                                  &engine->miData.foundMoves[entry1->slot],
+                                  entry2 );
+    return engine->usePrev ? cmpVal > 0 : cmpVal < 0;
+}
+
+static void
+heapSiftUp( EngineCtxt* engine, XP_U16 indx )
+{
+    MoveHeapEntry* heap = engine->miData.heap;
+    MoveHeapEntry entry = heap[indx];
+    while ( 0 < indx ) {
+        XP_U16 parent = (indx - 1) / 2;
+        if ( !heapIsWorse( engine, &entry, &heap[parent] ) ) {
+            break;
+        }
+        heap[indx] = heap[parent];
+        indx = parent;
+    }
+    heap[indx] = entry;
+}
+
+static void
+heapSiftDown( EngineCtxt* engine, XP_U16 indx, XP_U16 nEntries )
+{
+    MoveHeapEntry* heap = engine->miData.heap;
+    MoveHeapEntry entry = heap[indx];
+    for ( ; ; ) {
+        XP_U16 child = (2 * indx) + 1;
+        if ( child >= nEntries ) {
+            break;
+        }
+        if ( child + 1 < nEntries
+             && heapIsWorse( engine, &heap[child+1], &heap[child] ) ) {
+            ++child;
+        }
+        if ( !heapIsWorse( engine, &heap[child], &entry ) ) {
+            break;
+        }
+        heap[indx] = heap[child];
+        indx = child;
+    }
+    heap[indx] = entry;
+}
+
 static void
 saveMoveIfQualifies( EngineCtxt* engine, PossibleMove* posmove )
 {
-    XP_S16 mostest = 0;
-    XP_S16 cmpVal;
+    MoveIterationData* miData = &engine->miData;
     XP_Bool usePrev = engine->usePrev;
-    XP_Bool foundEmpty = XP_FALSE;
+    XP_U32 key = heapKey( posmove );
+    XP_S16 cmpVal;
 
-    if ( 1 == engine->nMovesToSave ) { /* only saving one */
-        mostest = 0;
-    } else {
-        mostest = -1;
+    if ( 1 < engine->nMovesToSave ) {
         /* we're not interested if we've seen this */
-        cmpVal = CMPMOVES( posmove, &engine->miData.lastSeenMove );
-        if ( !usePrev && cmpVal >= 0 ) {
-            /* XP_LOGF( "%s: dropping %d: higher than %d", __func__, */
-            /*          posmove->score, engine->miData.lastSeenMove.score ); */
-        } else if ( usePrev && cmpVal <= 0 ) {
-            /* XP_LOGF( "%s: dropping %d: lower than %d", __func__, */
-            /*          posmove->score, engine->miData.lastSeenMove.score ); */
-        } else {
-            XP_S16 ii;
-            /* terminate i at 1 because mostest starts at 0 */
-            for ( ii = 0; ii < engine->nMovesToSave; ++ii ) {
-                /* Find the mostest value move and overwrite it.  Note that
-                   there might not be one, as all may have the same or higher
-                   scores and those that have the same score may compare
-                   higher.
-
-                   <eeh> can't have this asssertion until I start noting the
-                   mostest saved score (setting miData.mostestSavedScore)
-                   below. */
-                /* 1/20/2001  I don't see that this assertion is valid.  I
-                   simply don't understand why it isn't tripped all the time
-                   in the old crosswords. */
-                /* XP_ASSERT( (engine->miData.lastSeenMove.score == 0x7fff) */
-                /*    || (engine->miData.savedMoves[i].score */
-                /*        <= posmove->score) ); */
-
-                if ( 0 == engine->miData.savedMoves[ii].score ) {
-                    foundEmpty = XP_TRUE;
-                    mostest = ii;
-                    break;
-                } else if ( -1 == mostest ) {
-                    mostest = ii;
-                } else {
-                    cmpVal = CMPMOVES( &engine->miData.savedMoves[mostest], 
-                                       &engine->miData.savedMoves[ii] );
-                    if ( !usePrev && cmpVal > 0 ) {
-                        mostest = ii;
-                    } else if ( usePrev && cmpVal < 0 ) {
-                        mostest = ii;
-                    }
-                }
-            }
+        cmpVal = CMPMOVES( posmove, &miData->lastSeenMove );
+        if ( usePrev ? cmpVal <= 0 : cmpVal >= 0 ) {
+            goto done;
         }
     }
 
-    while ( mostest >= 0 ) {     /* while: so we can break */
-        /* record the score we're dumping.  No point in considering any scores
-           lower than this for the rest of this round. */
-        /* engine->miData.lowestSavedScore =  */
-        /*     engine->miData.savedMoves[lowest].score; */
-        /* XP_DEBUGF( "lowestSavedScore now %d\n",  */
-        /* engine->miData.lowestSavedScore ); */
-        if ( foundEmpty ) {
-            /* we're good */
-        } else {
-            cmpVal = CMPMOVES( posmove, &engine->miData.savedMoves[mostest]);
-            if ( !usePrev && cmpVal <= 0 ) {
-                break;
-            } else if ( usePrev && cmpVal >= 0 ) {
-                break;
-            }
+    if ( miData->nSaved < engine->nMovesToSave ) {
+        MoveHeapEntry* entry = &miData->heap[miData->nSaved];
+        entry->key = key;
+        entry->slot = miData->nSaved;
+        XP_MEMCPY( &miData->foundMoves[entry->slot], posmove,
+                   sizeof(miData->foundMoves[entry->slot]) );
+        heapSiftUp( engine, miData->nSaved++ );
+    } else {
+        /* Replace the root if it's worse */
+        MoveHeapEntry* root = &miData->heap[0];
+        cmpVal = cmpHeapMoves( engine, key, posmove, root );
+        if ( usePrev ? cmpVal < 0 : cmpVal > 0 ) {
+            root->key = key;
+            XP_MEMCPY( &miData->foundMoves[root->slot], posmove,
+                       sizeof(miData->foundMoves[root->slot]) );
+            heapSiftDown( engine, 0, miData->nSaved );
         }
-        /* XP_LOGF( "saving move with score %d at %d (replacing %d)\n", */
-        /*          posmove->score, mostest,  */
-        /*          engine->miData.savedMoves[mostest].score ); */
-        XP_MEMCPY( &engine->miData.savedMoves[mostest], posmove,
-                   sizeof(engine->miData.savedMoves[mostest]) );
-        break;
     }
+ done:
+    return;
 } /* saveMoveIfQualifies */
 
+/* Turn the heap into the sorted cache described above MoveIterationData */
+static void
+sortSavedMoves( EngineCtxt* engine )
+{
+    MoveIterationData* miData = &engine->miData;
+    MoveHeapEntry* heap = miData->heap;
+    XP_U16 nSaved = miData->nSaved;
+    XP_U16 nEmpty = engine->nMovesToSave - nSaved;
+    XP_U16 ii;
+
+    /* Heapsort leaves the worst last, so !usePrev's min-heap comes out
+       decreasing */
+    for ( ii = nSaved; ii > 1; ) {
+        MoveHeapEntry tmp = heap[--ii];
+        heap[ii] = heap[0];
+        heap[0] = tmp;
+        heapSiftDown( engine, 0, ii );
+    }
+
+    XP_MEMSET( miData->savedMoves, 0, nEmpty * sizeof(miData->savedMoves[0]) );
+    for ( ii = 0; ii < nSaved; ++ii ) {
+        XP_U16 indx = engine->usePrev ? ii : nSaved - 1 - ii;
+        XP_MEMCPY( &miData->savedMoves[nEmpty + ii],
+                   &miData->foundMoves[heap[indx].slot],
+                   sizeof(miData->savedMoves[0]) );
+    }
+    miData->nSaved = 0;
+} /* sortSavedMoves */
+
 static void
 set_search_limits( EngineCtxt* engine )
 {
@@ -1245,12 +2098,13 @@ set_search_limits( EngineCtxt* engine )
 static void
 init_move_cache( EngineCtxt* engine )
 {
-    XP_U16 nInMoveCache = engine->nMovesToSave;
+    XP_U16 nMovesToSave = engine->nMovesToSave;
+    XP_U16 nInMoveCache = nMovesToSave;
     XP_U16 ii;
 
-    XP_ASSERT( engine->nMovesToSave == NUM_SAVED_ENGINE_MOVES );
+    XP_ASSERT( nMovesToSave == engine->nHumanMoves );
 
-    for ( ii = 0; ii < NUM_SAVED_ENGINE_MOVES; ++ii ) {
+    for ( ii = 0; ii < nMovesToSave; ++ii ) {
         if ( 0 == engine->miData.savedMoves[ii].score ) {
             --nInMoveCache;
         } else {
@@ -1258,13 +2112,12 @@ init_move_cache( EngineCtxt* engine )
         }
     }
     engine->miData.nInMoveCache = nInMoveCache;
-    engine->miData.bottom = NUM_SAVED_ENGINE_MOVES - nInMoveCache;
+    engine->miData.bottom = nMovesToSave - nInMoveCache;
 
     if ( engine->usePrev ) {
-        engine->miData.curCacheIndex = 
-            NUM_SAVED_ENGINE_MOVES - nInMoveCache - 1;
+        engine->miData.curCacheIndex = nMovesToSave - nInMoveCache - 1;
     } else {
-        engine->miData.curCacheIndex = NUM_SAVED_ENGINE_MOVES;
+        engine->miData.curCacheIndex = nMovesToSave;
     }
 }
 
@@ -1294,7 +2147,7 @@ move_cache_empty( const EngineCtxt* engine )
     if ( 0 == miData->nInMoveCache ) {
         empty = XP_TRUE;
     } else if ( engine->usePrev ) {
-        empty = miData->curCacheIndex >= NUM_SAVED_ENGINE_MOVES - 1;
+        empty = miData->curCacheIndex >= engine->nMovesToSave - 1;
     } else {
         empty = miData->curCacheIndex <= miData->bottom;
     }
@@ -1312,37 +2165,124 @@ scoreQualifies( EngineCtxt* engine, XP_U16 score )
     } else if ( !usePrev && score > engine->miData.lastSeenMove.score
          /* || (score < engine->miData.lowestSavedScore) */ ) {
         /* drop it */
+    } else if ( engine->miData.nSaved < engine->nMovesToSave ) {
+        qualifies = XP_TRUE;    /* there's room */
     } else {
-        XP_S16 ii;
-        PossibleMove* savedMoves = engine->miData.savedMoves;
-        /* Look at each saved score, and return true as soon as one's found
-           with a lower or equal score to this.  <eeh> As an optimization,
-           consider remembering what the lowest score is *once there are
-           NUM_SAVED_ENGINE_MOVES moves in here* and doing a quick test on
-           that. Or better, keeping the list in sorted order. */
-        for ( ii = 0, savedMoves = engine->miData.savedMoves;
-              ii < engine->nMovesToSave; ++ii, ++savedMoves ) {
-            if ( savedMoves->score == 0 ) { /* empty slot */
-                qualifies = XP_TRUE;
-            } else if ( usePrev && score <= savedMoves->score ) {
-                qualifies = XP_TRUE;
-                break;
-            } else if ( !usePrev && score >= savedMoves->score ) {
-                qualifies = XP_TRUE;
-                break;
-            }
-        }
+        /* The heap's root has the lowest saved score (highest if usePrev) */
+        XP_U16 rootScore = (XP_U16)(engine->miData.heap[0].key >> 16);
+        qualifies = usePrev ? score <= rootScore : score >= rootScore;
     }
     //XP_LOGF( "%s(%d)->%d", __func__, score, qualifies );
     return qualifies;
 } /* scoreQualifies */
 
+/* Moves scoring below this won't be saved, or 0 if anything might be.  Only
+ * a full cache has a floor, and it only rises; iterating backward (usePrev)
+ * wants the lowest moves so there's none.
+ */
+static XP_U16
+scoreCutoff( const EngineCtxt* engine )
+{
+    XP_U16 cutoff = 0;
+    if ( !engine->usePrev ) {
+        if ( engine->miData.nSaved == engine->nMovesToSave ) {
+            cutoff = (XP_U16)(engine->miData.heap[0].key >> 16);
+        }
+#ifdef XWFEATURE_ENGINE_THREADS
+        /* other workers may have raised the parent's */
+        if ( !!engine->queue && engine->queue->cutoff > cutoff ) {
+            cutoff = engine->queue->cutoff;
+        }
+#endif
+    }
+    return cutoff;
+} /* scoreCutoff */
+
+/* Sum of values (highest first) times multipliers (highest first), where
+   counts[mult] says how many of each multiplier there are */
+static XP_U32
+pairValues( const XP_U16* values, const XP_U16* counts, XP_U16 nCounts )
+{
+    XP_U32 sum = 0;
+    XP_U16 mult, ii, next = 0;
+    for ( mult = nCounts; mult-- > 1; ) {
+        for ( ii = 0; ii < counts[mult]; ++ii ) {
+            sum += mult * values[next++];
+        }
+    }
+    return sum;
+}
+
+/* The most a move can score that starts at firstCol, takes tiles from the
+ * rack for every empty square it covers, and ends just before some square at
+ * or after firstStop.  Wherever the word ends we know which squares and
+ * multipliers are in play, so the highest values left in the rack are paired
+ * with the highest letter multipliers for the word and, separately, for the
+ * crosswords.
+ */
+static XP_U32
+scoreBound( const EngineCtxt* engine, XP_U16 firstCol, XP_U16 firstStop )
+{
+    const BoundSquare* squares = engine->boundRow;
+    XP_U16 numCols = engine->numCols;
+    XP_U32 wordScore = 0;
+    XP_U32 crossScore = 0;
+    XP_U32 wordMult = 1;
+    const XP_U16* values = engine->rackValues;
+    XP_U16 nValues = engine->nRackValues;
+    XP_U16 letterCounts[4] = {0}; /* new squares by letter multiplier */
+    XP_U16 crossCounts[10] = {0}; /* ... by its product with word mult */
+    XP_U16 nNew = 0;
+    XP_U32 best = 0;
+    XP_U16 cc;
+
+    for ( cc = firstCol; ; ++cc ) {
+        /* Can the word end before cc? */
+        if ( cc >= firstStop && 0 < nNew
+             && (cc == numCols || squares[cc].empty) ) {
+            XP_U32 bound = 
+                (wordMult * (wordScore + pairValues( values, letterCounts, 
+                                                     VSIZE(letterCounts) )))
+                + crossScore + pairValues( values, crossCounts, 
+                                           VSIZE(crossCounts) );
+            if ( nNew == MAX_TRAY_TILES ) {
+                bound += EMPTIED_TRAY_BONUS;
+            }
+#ifdef XWFEATURE_BONUSALL
+            if ( nNew == engine->nTilesMax ) {
+                bound += engine->allTilesBonus;
+            }
+#endif
+            if ( bound > best ) {
+                best = bound;
+            }
+        }
+        if ( cc == numCols ) {
+            break;
+        } else if ( !squares[cc].empty ) {
+            wordScore += squares[cc].boardValue;
+        } else if ( nNew == nValues || squares[cc].blocked ) {
+            break;              /* no tile can go here */
+        } else {
+            const BoundSquare* square = &squares[cc];
+            ++nNew;
+            ++letterCounts[square->letterMult];
+            wordMult *= square->wordMult;
+            if ( square->hasCross ) {
+                ++crossCounts[square->letterMult * square->wordMult];
+                crossScore += square->crossBase * square->wordMult;
+            }
+        }
+    }
+    return best;
+} /* scoreBound */
+
 static array_edge*
 edge_from_tile( const DictionaryCtxt* dict, array_edge* from, Tile tile ) 
 {
-    array_edge* edge = dict_edge_with_tile( dict, from, tile );
+    array_edge* edge = DICT_EDGE_WITH_TILE( dict, from, tile );
     if ( edge != NULL ) {
-        edge = dict_follow( dict, edge );
+        edge = DICT_FOLLOW( dict, edge );
     }
     return edge;
 } /* edge_from_tile */
@@ -48,6 +48,33 @@ void engine_init( EngineCtxt* ctxt );
 void engine_reset( EngineCtxt* ctxt );
 void engine_destroy( EngineCtxt* ctxt );
 
+/* How many moves a human (robotIQ 0) can iterate through before the engine
+   has to search again; 10 unless set.  Keeping more costs only O(log n)
+   per move found.  Discards any moves cached already. */
+void engine_setMaxSavedMoves( EngineCtxt* ctxt, XP_U16 nMoves );
+
+/* The board's cell at col,row changed (in either direction).  The engine
+   keeps crosschecks from one search to the next, dropping only those for the
+   lines through changed cells. */
+void engine_boardChanged( EngineCtxt* ctxt, XP_U16 col, XP_U16 row );
+
+#ifdef XWFEATURE_ENGINE_THREADS
+/* How many threads server.c gives each engine */
+# ifndef ENGINE_NWORKERS
+#  define ENGINE_NWORKERS 2
+# endif
+/* Search with up to nWorkers threads (the caller's included).  0 or 1 means
+   search serially on the caller's thread, as always.  Only used if the
+   model's bonuses can be had without util: see model_cacheBonuses(). */
+void engine_setNWorkers( EngineCtxt* ctxt, XP_U16 nWorkers );
+#endif
+
+#ifdef XWFEATURE_GADDAG
+/* Whether to search using the dict's GADDAG when it has one (the default).
+   Moves found are the same either way. */
+void engine_setUseGaddag( EngineCtxt* ctxt, XP_Bool useGaddag );
+#endif
+
 XP_Bool engine_findMove( EngineCtxt* ctxt, const ModelCtxt* model, 
                          XP_U16 turn, const Tile* tiles, 
                          XP_U16 nTiles, XP_Bool usePrev,
@@ -61,6 +88,20 @@ XP_Bool engine_findMove( EngineCtxt* ctxt, const ModelCtxt* model,
                          XP_U16 robotIQ, XP_Bool* canMove, MoveInfo* result );
 XP_Bool engine_check( DictionaryCtxt* dict, Tile* buf, XP_U16 buflen );
 
+/* Checks many words at once, for callers (replaying or importing games) with
+ * more than a move's worth to validate.  words[n] has lengths[n] tiles, with
+ * no blanks (use the faces they stand for).  On return bit n%32 of
+ * legal[n/32] is set iff words[n] is in dict; legal needs
+ * ENGINE_CHECK_WORDS(nWords) entries.  Same answers as engine_check(), just
+ * faster in bulk.
+ */
+#ifndef ENGINE_CHECK_LANES
+# define ENGINE_CHECK_LANES 8
+#endif
+#define ENGINE_CHECK_WORDS(n) (((n) + 31) / 32)
+void engine_checkBatch( const DictionaryCtxt* dict, const Tile* const* words,
+                        const XP_U16* lengths, XP_U32 nWords, XP_U32* legal );
+
 #ifdef CPLUS
 }
 #endif
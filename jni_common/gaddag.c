@@ -0,0 +1,362 @@
+/* -*-mode: C; compile-command: "cd ../linux && make MEMDEBUG=TRUE"; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifdef XWFEATURE_GADDAG
+
+#include "gaddag.h"
+#include "dictnry.h"
+
+#ifdef CPLUS
+extern "C" {
+#endif
+
+/* Building happens in two passes.  First every DAWG prefix is inserted,
+ * reversed, into a plain trie.  Then the trie is minimized bottom-up: nodes
+ * whose outgoing edges match (same tiles, flags, dawgIndex and equivalent
+ * children) share a single run in the output.  Children are always created
+ * after their parents, so walking the trie from the highest index down
+ * visits every child before its parent.
+ */
+
+typedef struct BuildNode {
+    XP_U32 firstChild;
+    XP_U32 sibling;
+    XP_U32 dawgIndex;
+    XP_U8 tile;
+    XP_U8 flags;
+} BuildNode;
+
+typedef struct BuildState {
+    const DictionaryCtxt* dict;
+    BuildNode* nodes;
+    XP_U32 nNodes;
+    XP_U32 nAllocated;
+    XP_U32 maxNodes;
+    XP_Bool failed;
+    MPSLOT
+} BuildState;
+
+#define NODES_INCREMENT 4096
+
+static XP_U32
+newNode( BuildState* state, Tile tile )
+{
+    XP_U32 result = 0;
+    if ( state->nNodes >= state->maxNodes ) {
+        state->failed = XP_TRUE;
+    } else {
+        if ( state->nNodes == state->nAllocated ) {
+            XP_U32 nAllocated = state->nAllocated + NODES_INCREMENT;
+            if ( nAllocated > state->maxNodes ) {
+                nAllocated = state->maxNodes;
+            }
+            BuildNode* nodes;
+            /* mpool_realloc() won't take NULL */
+            if ( !state->nodes ) {
+                nodes = (BuildNode*)
+                    XP_MALLOC( state->mpool, nAllocated * sizeof(*nodes) );
+            } else {
+                nodes = (BuildNode*)
+                    XP_REALLOC( state->mpool, state->nodes,
+                                nAllocated * sizeof(*nodes) );
+            }
+            if ( !nodes ) {
+                state->failed = XP_TRUE;
+                goto done;
+            }
+            state->nodes = nodes;
+            state->nAllocated = nAllocated;
+        }
+        result = state->nNodes++;
+        XP_MEMSET( &state->nodes[result], 0, sizeof(state->nodes[result]) );
+        state->nodes[result].tile = tile;
+    }
+ done:
+    return result;
+} /* newNode */
+
+/* Return the child of parent for tile, creating it if needed.  Siblings are
+   kept sorted by tile. */
+static XP_U32
+childFor( BuildState* state, XP_U32 parent, Tile tile )
+{
+    XP_U32 prev = 0;
+    XP_U32 cur = state->nodes[parent].firstChild;
+    XP_U32 result;
+
+    while ( 0 != cur && state->nodes[cur].tile < tile ) {
+        prev = cur;
+        cur = state->nodes[cur].sibling;
+    }
+
+    if ( 0 != cur && state->nodes[cur].tile == tile ) {
+        result = cur;
+    } else {
+        result = newNode( state, tile );
+        if ( 0 != result ) {
+            /* nodes may have moved */
+            state->nodes[result].sibling = cur;
+            if ( 0 == prev ) {
+                state->nodes[parent].firstChild = result;
+            } else {
+                state->nodes[prev].sibling = result;
+            }
+        }
+    }
+    return result;
+} /* childFor */
+
+static void
+insertPrefix( BuildState* state, const Tile* tiles, XP_U16 nTiles,
+              array_edge* edge )
+{
+    const DictionaryCtxt* dict = state->dict;
+    XP_U32 node = 0;            /* root */
+
+    while ( nTiles > 0 && !state->failed ) {
+        node = childFor( state, node, tiles[--nTiles] );
+    }
+    if ( !state->failed ) {
+        BuildNode* bn = &state->nodes[node];
+        bn->flags |= GADDAG_PREFIX;
+        if ( ISACCEPTING( dict, edge ) ) {
+            bn->flags |= GADDAG_WORD;
+        }
+        bn->dawgIndex = dict_index_from( dict, edge );
+    }
+} /* insertPrefix */
+
+/* Walk every path in the DAWG, inserting each prefix.  Iterative so deep
+   dicts can't blow the stack. */
+static void
+addAllPrefixes( BuildState* state )
+{
+    const DictionaryCtxt* dict = state->dict;
+    array_edge* edges[MAX_COLS];
+    Tile tiles[MAX_COLS];
+    XP_U16 depth = 0;
+
+    edges[0] = dict_getTopEdge( dict );
+    while ( !state->failed ) {
+        array_edge* edge = edges[depth];
+        array_edge* child;
+        tiles[depth] = EDGETILE( dict, edge );
+        insertPrefix( state, tiles, depth + 1, edge );
+
+        child = dict_follow( dict, edge );
+        if ( NULL != child ) {
+            if ( depth + 1 >= VSIZE(edges) ) {
+                XP_LOGF( "%s: word too long", __func__ );
+                state->failed = XP_TRUE;
+                break;
+            }
+            edges[++depth] = child;
+            continue;
+        }
+
+        /* No child: move to the next sibling, popping finished nodes */
+        while ( IS_LAST_EDGE( dict, edges[depth] ) ) {
+            if ( 0 == depth ) {
+                goto done;
+            }
+            --depth;
+        }
+        edges[depth] += dict->nodeSize;
+    }
+ done:
+    return;
+} /* addAllPrefixes */
+
+/* Minimization */
+
+typedef struct MinState {
+    BuildState* build;
+    XP_U32* runOf;              /* per node; 0 if leaf */
+    XP_U32* table;              /* open-addressed; node index + 1 */
+    XP_U32 tableMask;
+    GaddagEdge* edges;
+    XP_U32 nEdges;
+} MinState;
+
+static XP_U32
+hashNode( const MinState* ms, XP_U32 node )
+{
+    const BuildNode* nodes = ms->build->nodes;
+    XP_U32 hash = 5381;
+    XP_U32 child;
+    for ( child = nodes[node].firstChild; 0 != child;
+          child = nodes[child].sibling ) {
+        const BuildNode* bn = &nodes[child];
+        hash = (hash * 33) ^ bn->tile;
+        hash = (hash * 33) ^ bn->flags;
+        hash = (hash * 33) ^ bn->dawgIndex;
+        hash = (hash * 33) ^ ms->runOf[child];
+    }
+    return hash;
+}
+
+static XP_Bool
+sameNodes( const MinState* ms, XP_U32 node1, XP_U32 node2 )
+{
+    const BuildNode* nodes = ms->build->nodes;
+    XP_U32 child1 = nodes[node1].firstChild;
+    XP_U32 child2 = nodes[node2].firstChild;
+
+    while ( 0 != child1 && 0 != child2 ) {
+        const BuildNode* bn1 = &nodes[child1];
+        const BuildNode* bn2 = &nodes[child2];
+        if ( bn1->tile != bn2->tile || bn1->flags != bn2->flags
+             || bn1->dawgIndex != bn2->dawgIndex
+             || ms->runOf[child1] != ms->runOf[child2] ) {
+            break;
+        }
+        child1 = bn1->sibling;
+        child2 = bn2->sibling;
+    }
+    return 0 == child1 && 0 == child2;
+}
+
+static XP_U32
+emitRun( MinState* ms, XP_U32 node )
+{
+    const BuildNode* nodes = ms->build->nodes;
+    XP_U32 start = ms->nEdges;
+    XP_U32 child;
+    for ( child = nodes[node].firstChild; 0 != child;
+          child = nodes[child].sibling ) {
+        GaddagEdge* edge = &ms->edges[ms->nEdges++];
+        edge->tile = nodes[child].tile;
+        edge->flags = nodes[child].flags;
+        edge->dawgIndex = nodes[child].dawgIndex;
+        edge->childIndex = ms->runOf[child];
+    }
+    ms->edges[ms->nEdges-1].flags |= GADDAG_LAST;
+    return start;
+}
+
+static void
+minimize( MinState* ms )
+{
+    const BuildNode* nodes = ms->build->nodes;
+    XP_U32 node;
+
+    ms->nEdges = 1;             /* so no run starts at 0 */
+    for ( node = ms->build->nNodes; node-- > 0; ) {
+        if ( 0 == nodes[node].firstChild ) {
+            ms->runOf[node] = 0;
+        } else {
+            XP_U32 slot = hashNode( ms, node ) & ms->tableMask;
+            for ( ; ; ) {
+                XP_U32 entry = ms->table[slot];
+                if ( 0 == entry ) {
+                    ms->table[slot] = node + 1;
+                    ms->runOf[node] = emitRun( ms, node );
+                    break;
+                } else if ( sameNodes( ms, entry - 1, node ) ) {
+                    ms->runOf[node] = ms->runOf[entry - 1];
+                    break;
+                }
+                slot = (slot + 1) & ms->tableMask;
+            }
+        }
+    }
+} /* minimize */
+
+Gaddag*
+gaddag_make( MPFORMAL const DictionaryCtxt* dict, XP_U32 maxBytes )
+{
+    Gaddag* result = NULL;
+    BuildState state;
+    MinState ms;
+    /* per trie node: the node, its run, two hash slots, and at worst one
+       output edge */
+    XP_U32 perNode = sizeof(BuildNode) + sizeof(XP_U32)
+        + (2 * sizeof(XP_U32)) + sizeof(GaddagEdge);
+
+    XP_MEMSET( &state, 0, sizeof(state) );
+    XP_MEMSET( &ms, 0, sizeof(ms) );
+    MPASSIGN( state.mpool, mpool );
+    state.dict = dict;
+    state.maxNodes = maxBytes / perNode;
+
+    if ( NULL == dict_getTopEdge( dict ) ) {
+        goto done;
+    }
+
+    (void)newNode( &state, 0 ); /* root */
+    addAllPrefixes( &state );
+    if ( state.failed ) {
+        XP_LOGF( "%s: giving up after %ld nodes", __func__, state.nNodes );
+        goto done;
+    }
+
+    ms.build = &state;
+    for ( ms.tableMask = 1; ms.tableMask < 2 * state.nNodes;
+          ms.tableMask <<= 1 ) {
+    }
+    ms.runOf = (XP_U32*)XP_MALLOC( mpool, state.nNodes * sizeof(ms.runOf[0]) );
+    ms.table = (XP_U32*)XP_CALLOC( mpool, ms.tableMask * sizeof(ms.table[0]) );
+    ms.edges = (GaddagEdge*)XP_MALLOC( mpool,
+                                       state.nNodes * sizeof(ms.edges[0]) );
+    --ms.tableMask;
+    if ( !ms.runOf || !ms.table || !ms.edges ) {
+        goto done;
+    }
+
+    minimize( &ms );
+
+    /* Done with the trie; drop it before shrinking the output */
+    XP_FREEP( mpool, &state.nodes );
+    XP_FREEP( mpool, &ms.table );
+
+    result = (Gaddag*)XP_CALLOC( mpool, sizeof(*result) );
+    MPASSIGN( result->mpool, mpool );
+    result->nEdges = ms.nEdges;
+    result->rootIndex = ms.runOf[0];
+    result->edges = (GaddagEdge*)
+        XP_REALLOC( mpool, ms.edges, ms.nEdges * sizeof(ms.edges[0]) );
+    if ( !result->edges ) {     /* shrinking failed; keep the big one */
+        result->edges = ms.edges;
+    }
+    ms.edges = NULL;
+    XP_ASSERT( 0 != result->rootIndex );
+    XP_LOGF( "%s: %ld trie nodes became %ld edges (%ld bytes)", __func__,
+             state.nNodes, result->nEdges,
+             (XP_U32)(result->nEdges * sizeof(result->edges[0])) );
+
+ done:
+    XP_FREEP( mpool, &state.nodes );
+    XP_FREEP( mpool, &ms.runOf );
+    XP_FREEP( mpool, &ms.table );
+    XP_FREEP( mpool, &ms.edges );
+    return result;
+} /* gaddag_make */
+
+void
+gaddag_destroy( Gaddag* gaddag )
+{
+    XP_FREE( gaddag->mpool, gaddag->edges );
+    XP_FREE( gaddag->mpool, gaddag );
+}
+
+#ifdef CPLUS
+}
+#endif
+
+#endif /* XWFEATURE_GADDAG */
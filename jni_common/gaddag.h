@@ -0,0 +1,85 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _GADDAG_H_
+#define _GADDAG_H_
+
+#ifdef XWFEATURE_GADDAG
+
+#include "comtypes.h"
+#include "mempool.h"
+
+#ifdef CPLUS
+extern "C" {
+#endif
+
+/* The reversed-prefix half of a GADDAG, built from a loaded DAWG.  Walking it
+ * from the root spells a word's letters from some square leftward to the
+ * word's first letter.  An edge flagged GADDAG_PREFIX means the letters
+ * walked so far, read forward, are a prefix in the DAWG.  dawgIndex is then
+ * the DAWG edge index to continue rightward from (0 if nothing can follow),
+ * and GADDAG_WORD means the prefix is itself a word.  So the "separator"
+ * half of a classic GADDAG is just the DAWG we already have.
+ *
+ * Like the DAWG, edges are stored in runs, one run per node, sorted by tile,
+ * the last flagged GADDAG_LAST.  childIndex 0 means no node follows.
+ */
+
+/* Most memory building one may take before we give up and stick with the
+   DAWG */
+#ifndef GADDAG_MAX_BYTES
+# define GADDAG_MAX_BYTES (8 * 1024 * 1024)
+#endif
+
+#define GADDAG_LAST   0x01
+#define GADDAG_PREFIX 0x02
+#define GADDAG_WORD   0x04
+
+typedef struct GaddagEdge {
+    XP_U32 childIndex;
+    XP_U32 dawgIndex;
+    XP_U8 tile;
+    XP_U8 flags;
+} GaddagEdge;
+
+typedef struct Gaddag {
+    GaddagEdge* edges;
+    XP_U32 nEdges;
+    XP_U32 rootIndex;
+    MPSLOT
+} Gaddag;
+
+/* Returns NULL if the dict can't be converted or doing so would use more
+   than maxBytes at any point; callers then keep using the DAWG alone. */
+Gaddag* gaddag_make( MPFORMAL const DictionaryCtxt* dict, XP_U32 maxBytes );
+void gaddag_destroy( Gaddag* gaddag );
+
+#define GADDAG_ROOT(g) (&(g)->edges[(g)->rootIndex])
+#define GADDAG_FOLLOW(g,e) \
+    ((e)->childIndex == 0 ? (GaddagEdge*)NULL : &(g)->edges[(e)->childIndex])
+#define GADDAG_IS_LAST(e) (((e)->flags & GADDAG_LAST) != 0)
+#define GADDAG_IS_PREFIX(e) (((e)->flags & GADDAG_PREFIX) != 0)
+#define GADDAG_IS_WORD(e) (((e)->flags & GADDAG_WORD) != 0)
+
+#ifdef CPLUS
+}
+#endif
+
+#endif /* XWFEATURE_GADDAG */
+#endif /* _GADDAG_H_ */
@@ -291,6 +291,11 @@ model_setSize( ModelCtxt* model, XP_U16 nCols )
         if ( !!model->vol.tiles ) {
             XP_FREE( model->vol.mpool, model->vol.tiles );
         }
+#ifdef XWFEATURE_ENGINE_THREADS
+        if ( !!model->vol.bonusCache ) {
+            XP_FREEP( model->vol.mpool, &model->vol.bonusCache );
+        }
+#endif
         model->vol.tiles = XP_MALLOC( model->vol.mpool, TILES_SIZE(model, nCols) );
     }
     XP_MEMSET( model->vol.tiles, TILE_EMPTY_BIT, TILES_SIZE(model, nCols) );
@@ -311,6 +316,11 @@ model_destroy( ModelCtxt* model )
     if ( !!model->vol.bonuses ) {
         XP_FREE( model->vol.mpool, model->vol.bonuses );
     }
+#ifdef XWFEATURE_ENGINE_THREADS
+    if ( !!model->vol.bonusCache ) {
+        XP_FREE( model->vol.mpool, model->vol.bonusCache );
+    }
+#endif
     XP_FREE( model->vol.mpool, model->vol.tiles );
     XP_FREE( model->vol.mpool, model );
 } /* model_destroy */
@@ -371,6 +381,41 @@ model_setSquareBonuses( ModelCtxt* model, XWBonusType* bonuses, XP_U16 nBonuses
 }
 #endif
 
+XP_Bool
+model_hasBonusTable( const ModelCtxt* model )
+{
+    XP_Bool result = XP_FALSE;
+#ifdef STREAM_VERS_BIGBOARD
+    const ModelCtxt* bonusOwner = model->loaner? model->loaner : model;
+    result = !!bonusOwner->vol.bonuses;
+#endif
+#ifdef XWFEATURE_ENGINE_THREADS
+    result = result || !!model->vol.bonusCache;
+#endif
+    return result;
+}
+
+#ifdef XWFEATURE_ENGINE_THREADS
+void
+model_cacheBonuses( ModelCtxt* model )
+{
+    if ( !model_hasBonusTable( model ) ) {
+        XP_U16 nCols = model_numCols( model );
+        XP_U16 nRows = model_numRows( model );
+        XWBonusType* cache = (XWBonusType*)
+            XP_MALLOC( model->vol.mpool, nCols * nRows * sizeof(cache[0]) );
+        XP_U16 col, row;
+        for ( row = 0; row < nRows; ++row ) {
+            for ( col = 0; col < nCols; ++col ) {
+                cache[(row * nCols) + col] = 
+                    model_getSquareBonus( model, col, row );
+            }
+        }
+        model->vol.bonusCache = cache;
+    }
+}
+#endif
+
 XWBonusType
 model_getSquareBonus( const ModelCtxt* model, XP_U16 col, XP_U16 row )
 {
@@ -402,6 +447,10 @@ model_getSquareBonus( const ModelCtxt* model, XP_U16 col, XP_U16 row )
         if ( col < bonusOwner->vol.nBonuses ) {
             result = bonusOwner->vol.bonuses[col];
         }
+#endif
+#ifdef XWFEATURE_ENGINE_THREADS
+    } else if ( !!model->vol.bonusCache ) {
+        result = model->vol.bonusCache[(row * model_numCols(model)) + col];
 #endif
     } else {
         result = util_getSquareBonus( model->vol.util, model_numRows(model), 
@@ -1958,6 +2007,13 @@ model_setBoardListener( ModelCtxt* model, BoardListener bl, void* data )
     model->vol.boardListenerData = data;
 } /* model_setBoardListener */
 
+void
+model_setEngineListener( ModelCtxt* model, BoardListener bl, void* data )
+{
+    model->vol.engineListenerFunc = bl;
+    model->vol.engineListenerData = data;
+} /* model_setEngineListener */
+
 void
 model_setTrayListener( ModelCtxt* model, TrayListener tl, void* data )
 {
@@ -1980,6 +2036,10 @@ notifyBoardListeners( ModelCtxt* model, XP_U16 turn, XP_U16 col, XP_U16 row,
         (*model->vol.boardListenerFunc)( model->vol.boardListenerData, turn, 
                                          col, row, added );
     }
+    if ( model->vol.engineListenerFunc != NULL ) {
+        (*model->vol.engineListenerFunc)( model->vol.engineListenerData, turn,
+                                          col, row, added );
+    }
 } /* notifyBoardListeners */
 
 static void
@@ -2001,6 +2061,16 @@ notifyDictListeners( ModelCtxt* model, XP_S16 playerNum,
         (*model->vol.dictListenerFunc)( model->vol.dictListenerData, playerNum, 
                                         oldDict, newDict );
     }
+    /* A new dict spoils whatever the engines figured from the board */
+    if ( model->vol.engineListenerFunc != NULL && oldDict != newDict ) {
+        XP_U16 col, row;
+        for ( col = 0; col < model->nCols; ++col ) {
+            for ( row = 0; row < model->nRows; ++row ) {
+                (*model->vol.engineListenerFunc)( model->vol.engineListenerData,
+                                                  0, col, row, XP_FALSE );
+            }
+        }
+    }
 } /* notifyDictListeners */
 
 static void
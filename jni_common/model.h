@@ -239,6 +239,11 @@ typedef void (*BoardListener)(void* data, XP_U16 turn, XP_U16 col,
                               XP_U16 row, XP_Bool added );
 void model_setBoardListener( ModelCtxt* model, BoardListener bl, 
                              void* data );
+/* Like the board listener, but for whoever owns the robot engines, which
+   cache per-line crosschecks across turns.  Set independently of it, and
+   also told of every cell when a dict changes. */
+void model_setEngineListener( ModelCtxt* model, BoardListener bl, 
+                              void* data );
 typedef void (*TrayListener)( void* data, XP_U16 turn, 
                               XP_S16 index1, XP_S16 index2 );
 void model_setTrayListener( ModelCtxt* model, TrayListener bl, 
@@ -299,6 +304,14 @@ XWBonusType model_getSquareBonus( const ModelCtxt* model,
 void model_setSquareBonuses( ModelCtxt* model, XWBonusType* bonuses, 
                              XP_U16 nBonuses );
 #endif
+/* True if model_getSquareBonus() can answer without calling into util,
+   i.e. is safe to call from a thread other than the one driving the game. */
+XP_Bool model_hasBonusTable( const ModelCtxt* model );
+#ifdef XWFEATURE_ENGINE_THREADS
+/* Ask util for every square's bonus now, on the game's thread, so that
+   model_hasBonusTable() is true until the board changes size */
+void model_cacheBonuses( ModelCtxt* model );
+#endif
                                   
 XP_Bool model_checkMoveLegal( ModelCtxt* model, XP_S16 player, 
                               XWStreamCtxt* stream,
@@ -58,6 +58,8 @@ typedef struct ModelVolatiles {
     BoardListener boardListenerFunc;
     StackCtxt* stack;
     void* boardListenerData;
+    BoardListener engineListenerFunc;
+    void* engineListenerData;
     TrayListener trayListenerFunc;
     void* trayListenerData;
     DictListener dictListenerFunc;
@@ -69,6 +71,9 @@ typedef struct ModelVolatiles {
 
     XP_U16 nBonuses;
     XWBonusType* bonuses;
+#ifdef XWFEATURE_ENGINE_THREADS
+    XWBonusType* bonusCache;    /* util's, nCols * nRows of them; not saved */
+#endif
 
     MPSLOT
 } ModelVolatiles;
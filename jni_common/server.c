@@ -253,6 +253,22 @@ initServer( ServerCtxt* server )
     server->nv.quitter = -1;
 } /* initServer */
 
+/* Engines keep crosschecks across turns; tell them which ones a change to
+   the board spoils. */
+static void
+engineCellChanged( void* closure, XP_U16 XP_UNUSED(turn), XP_U16 col, 
+                   XP_U16 row, XP_Bool XP_UNUSED(added) )
+{
+    ServerCtxt* server = (ServerCtxt*)closure;
+    XP_U16 ii;
+    for ( ii = 0; ii < VSIZE(server->players); ++ii ) {
+        EngineCtxt* engine = server->players[ii].engine;
+        if ( !!engine ) {
+            engine_boardChanged( engine, col, row );
+        }
+    }
+} /* engineCellChanged */
+
 ServerCtxt* 
 server_make( MPFORMAL ModelCtxt* model, CommsCtxt* comms, XW_UtilCtxt* util )
 {
@@ -268,6 +284,8 @@ server_make( MPFORMAL ModelCtxt* model, CommsCtxt* comms, XW_UtilCtxt* util )
         result->vol.util = util;
         result->vol.gi = util->gameInfo;
 
+        model_setEngineListener( model, engineCellChanged, result );
+
         initServer( result );
     }
     return result;
@@ -1586,8 +1604,17 @@ server_getEngineFor( ServerCtxt* server, XP_U16 playerNum )
     if ( !engine && server->vol.gi->players[playerNum].isLocal ) {
         engine = engine_make( MPPARM(server->mpool)
                               server->vol.util );
+#ifdef XWFEATURE_ENGINE_THREADS
+        engine_setNWorkers( engine, ENGINE_NWORKERS );
+#endif
         player->engine = engine;
     }
+#ifdef XWFEATURE_ENGINE_THREADS
+    /* The engine's workers can't call util for bonuses */
+    if ( !!engine ) {
+        model_cacheBonuses( server->vol.model );
+    }
+#endif
 
     return engine;
 } /* server_getEngineFor */
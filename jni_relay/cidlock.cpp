@@ -38,26 +38,31 @@ CidLock* CidLock::s_instance = NULL;
 
 CidLock::CidLock() : m_nextCID(0)
 {
-    pthread_mutex_init( &m_infos_mutex, NULL );
-    pthread_cond_init( &m_infos_condvar, NULL );
+    for ( int ii = 0; ii < CIDLOCK_SHARDS; ++ii ) {
+        pthread_mutex_init( &m_shards[ii].mutex, NULL );
+    }
+    pthread_rwlock_init( &m_addrIndexRWLock, NULL );
 }
  
 CidLock::~CidLock()
 {
-    pthread_mutex_destroy( &m_infos_mutex );
+    for ( int ii = 0; ii < CIDLOCK_SHARDS; ++ii ) {
+        pthread_mutex_destroy( &m_shards[ii].mutex );
+    }
+    pthread_rwlock_destroy( &m_addrIndexRWLock );
 }
 
 #ifdef CIDLOCK_DEBUG
-# define PRINT_CLAIMED() print_claimed(__func__)
+# define PRINT_CLAIMED(shard) print_claimed(__func__, (shard))
 void 
-CidLock::print_claimed( const char* caller )
+CidLock::print_claimed( const char* caller, Shard* shard )
 {
     int unclaimed = 0;
     string str;
     string_printf( str, "after %s: ", caller );
-    // Assume we have the mutex!!!!
+    // Assume we have the shard's mutex!!!!
     map< CookieID, CidInfo*>::iterator iter;
-    for ( iter = m_infos.begin(); iter != m_infos.end(); ++iter ) {
+    for ( iter = shard->infos.begin(); iter != shard->infos.end(); ++iter ) {
         CidInfo* info = iter->second;
         if ( 0 == info->GetOwner() ) {
             ++unclaimed;
@@ -65,32 +70,45 @@ CidLock::print_claimed( const char* caller )
             string_printf( str, "%d,", info->GetCid() );
         }
     }
-    string_printf( str, "%d,", " (plus %d unclaimed.)", unclaimed );
+    string_printf( str, " (plus %d unclaimed.)", unclaimed );
     logf( XW_LOGINFO, "%s: claimed: %s", __func__, str.c_str() );
 }
 #else
-# define PRINT_CLAIMED()
+# define PRINT_CLAIMED(shard)
 #endif
 
+/* Wait, with shard's mutex held, until info's relinquished or dropped.  info
+   may be gone on return so look it up again. */
+void
+CidLock::waitFor( Shard* shard, CidInfo* info )
+{
+    ++info->m_nWaiters;
+    pthread_cond_wait( &info->m_cond, &shard->mutex );
+    if ( 0 == --info->m_nWaiters && info->m_dropped ) {
+        delete info;
+    }
+}
+
 CidInfo* 
 CidLock::Claim( CookieID cid )
 {
 #ifdef CIDLOCK_DEBUG
     logf( XW_LOGINFO, "%s(%d)", __func__, cid );
 #endif
-    CidInfo* info = NULL;
-    for ( ; ; ) {
-        MutexLock ml( &m_infos_mutex );
+    if ( 0 == cid ) {
+        cid = __sync_add_and_fetch( &m_nextCID, 1 );
+        logf( XW_LOGINFO, "%s: assigned cid: %d", __func__, cid );
+    }
 
-        if ( 0 == cid ) {
-            cid = ++m_nextCID;
-            logf( XW_LOGINFO, "%s: assigned cid: %d", __func__, cid );
-        }
+    Shard* shard = getShard( cid );
+    MutexLock ml( &shard->mutex );
 
-        map< CookieID, CidInfo*>::iterator iter = m_infos.find( cid );
-        if ( iter == m_infos.end() ) { // not there at all
+    CidInfo* info = NULL;
+    for ( ; ; ) {
+        map< CookieID, CidInfo*>::iterator iter = shard->infos.find( cid );
+        if ( iter == shard->infos.end() ) { // not there at all
             info = new CidInfo( cid );
-            m_infos.insert( pair<CookieID, CidInfo*>( cid, info ) );
+            shard->infos.insert( pair<CookieID, CidInfo*>( cid, info ) );
         } else {
             if ( 0 == iter->second->GetOwner() ) {
                 info = iter->second;
@@ -99,14 +117,14 @@ CidLock::Claim( CookieID cid )
 
         if ( NULL != info ) {   // we're done
             info->SetOwner( pthread_self() );
-            PRINT_CLAIMED();
+            PRINT_CLAIMED(shard);
             break;
         }
 
 #ifdef CIDLOCK_DEBUG
         logf( XW_LOGINFO, "%s(%d): waiting....", __func__, cid );
 #endif
-        pthread_cond_wait( &m_infos_condvar, &m_infos_mutex );
+        waitFor( shard, iter->second );
     }
 #ifdef CIDLOCK_DEBUG
     logf( XW_LOGINFO, "%s(%d): DONE", __func__, cid );
@@ -119,35 +137,42 @@ CidLock::ClaimSocket( const AddrInfo* addr )
 {
     CidInfo* info = NULL;
 #ifdef CIDLOCK_DEBUG
-    logf( XW_LOGINFO, "%s(sock=%d)", __func__, sock );
+    logf( XW_LOGINFO, "%s(sock=%d)", __func__, addr->socket() );
 #endif
     for ( ; ; ) {
-        MutexLock ml( &m_infos_mutex );
-
-        map<CookieID, CidInfo*>::iterator iter;
-        for ( iter = m_infos.begin(); NULL == info && iter != m_infos.end(); ++iter ) {
-            const vector<AddrInfo>& addrs = iter->second->GetAddrs();
-            vector<AddrInfo>::const_iterator iter2;
-            for ( iter2 = addrs.begin(); iter2 != addrs.end(); ++iter2 ) {
-                if ( iter2->equals(*addr) ) {
-                    if ( 0 == iter->second->GetOwner() ) {
-                        info = iter->second;
-                        info->SetOwner( pthread_self() );
-                        PRINT_CLAIMED();
-                    }
-                    break;
-                }
+        CookieID cid = 0;
+        {
+            RWReadLock rrl( &m_addrIndexRWLock );
+            AddrIndex::const_iterator iter = m_addrIndex.find( *addr );
+            if ( iter != m_addrIndex.end() ) {
+                cid = iter->second;
             }
         }
+        if ( 0 == cid ) {
+            break;              /* socket isn't here */
+        }
 
-        /* break if socket isn't here or if it's not claimed */
-        if ( iter == m_infos.end() || NULL != info ) {
+        Shard* shard = getShard( cid );
+        MutexLock ml( &shard->mutex );
+        map<CookieID, CidInfo*>::iterator iter = shard->infos.find( cid );
+        if ( iter == shard->infos.end() ) {
+            break;              /* dropped since we looked */
+        }
+
+        CidInfo* candidate = iter->second;
+        if ( 0 == candidate->GetOwner() ) {
+            info = candidate;
+            info->SetOwner( pthread_self() );
+            PRINT_CLAIMED(shard);
             break;
         }
+
 #ifdef CIDLOCK_DEBUG
-        logf( XW_LOGINFO, "%s(sock=%d): waiting....", __func__, sock );
+        logf( XW_LOGINFO, "%s(sock=%d): waiting....", __func__, 
+              addr->socket() );
 #endif
-        pthread_cond_wait( &m_infos_condvar, &m_infos_mutex );
+        /* It may have moved by the time we're woken, so start over */
+        waitFor( shard, candidate );
     }
 
 #ifdef CIDLOCK_DEBUG
@@ -156,6 +181,25 @@ CidLock::ClaimSocket( const AddrInfo* addr )
     return info;
 }
 
+void
+CidLock::reindex( CookieID cid, const vector<AddrInfo>& oldAddrs, 
+                  const vector<AddrInfo>& newAddrs )
+{
+    RWWriteLock rwl( &m_addrIndexRWLock );
+
+    vector<AddrInfo>::const_iterator iter;
+    for ( iter = oldAddrs.begin(); iter != oldAddrs.end(); ++iter ) {
+        AddrIndex::iterator found = m_addrIndex.find( *iter );
+        /* Unless a newer game's claimed it since */
+        if ( found != m_addrIndex.end() && found->second == cid ) {
+            m_addrIndex.erase( found );
+        }
+    }
+    for ( iter = newAddrs.begin(); iter != newAddrs.end(); ++iter ) {
+        m_addrIndex[*iter] = cid;
+    }
+}
+
 void
 CidLock::Relinquish( CidInfo* claim, bool drop )
 {
@@ -163,27 +207,44 @@ CidLock::Relinquish( CidInfo* claim, bool drop )
 #ifdef CIDLOCK_DEBUG
     logf( XW_LOGINFO, "%s(%d,drop=%d)", __func__, cid, drop );
 #endif
+    assert( claim->GetOwner() == pthread_self() );
+
+    /* Still ours, so its addresses can't change under us */
+    if ( drop ) {
+        reindex( cid, claim->m_addrs, vector<AddrInfo>() );
+    } else {
+        CookieRef* ref = claim->GetRef();
+        if ( NULL != ref ) {
+            vector<AddrInfo> addrs = ref->GetAddrs();
+            reindex( cid, claim->m_addrs, addrs );
+            claim->SetAddrs( addrs ); /* cache these */
+        }
+    }
 
-    MutexLock ml( &m_infos_mutex );
-    map< CookieID, CidInfo*>::iterator iter = m_infos.find( cid );
-    assert( iter != m_infos.end() );
+    Shard* shard = getShard( cid );
+    MutexLock ml( &shard->mutex );
+    map< CookieID, CidInfo*>::iterator iter = shard->infos.find( cid );
+    assert( iter != shard->infos.end() );
     assert( iter->second == claim );
-    assert( claim->GetOwner() == pthread_self() );
     if ( drop ) {
 #ifdef CIDLOCK_DEBUG
         logf( XW_LOGINFO, "%s: deleting %p", __func__, iter->second );
 #endif
-        m_infos.erase( iter );
-        delete claim;
-    } else {
-        CookieRef* ref = claim->GetRef();
-        if ( NULL != ref ) {
-            claim->SetAddrs( ref->GetAddrs() ); /* cache these */
+        shard->infos.erase( iter );
+        if ( 0 == claim->m_nWaiters ) {
+            delete claim;
+        } else {
+            /* They'll find it gone and make another; last one deletes */
+            claim->m_dropped = true;
+            pthread_cond_broadcast( &claim->m_cond );
         }
+    } else {
         claim->SetOwner( 0 );
+        /* ClaimSocket() waiters share the condvar and may give up rather
+           than claim, so wake everybody */
+        pthread_cond_broadcast( &claim->m_cond );
     }
-    PRINT_CLAIMED();
-    pthread_cond_signal( &m_infos_condvar );
+    PRINT_CLAIMED(shard);
 #ifdef CIDLOCK_DEBUG
     logf( XW_LOGINFO, "%s(%d,drop=%d): DONE", __func__, cid, drop );
 #endif
@@ -24,17 +24,25 @@
 
 #include <map>
 #include <set>
+#include <tr1/unordered_map>
 #include "xwrelay.h"
 #include "cref.h"
 
 using namespace std;
 
+/* CidInfos are spread across this many shards by cid, each with its own
+   mutex, so claiming one game never waits on another's shard-mate for long */
+#define CIDLOCK_SHARDS 16
+
 class CidInfo {
  public:
     CidInfo( CookieID cid )
         :m_cid(cid),
         m_cref(NULL),
-        m_owner(0) {}
+        m_owner(0),
+        m_nWaiters(0),
+        m_dropped(false) { pthread_cond_init( &m_cond, NULL ); }
+    ~CidInfo() { pthread_cond_destroy( &m_cond ); }
 
     CookieID GetCid( void ) { return m_cid; }
     CookieRef* GetRef( void ) { return m_cref; }
@@ -46,10 +54,18 @@ class CidInfo {
     void SetOwner( pthread_t owner ) { m_owner = owner; }
 
  private:
+    friend class CidLock;
+
     CookieID m_cid;
     CookieRef* m_cref;
     pthread_t m_owner;
     vector<AddrInfo> m_addrs;
+
+    /* Threads waiting to claim this one, on its shard's mutex.  If it's
+       dropped while they wait the last one out deletes it. */
+    pthread_cond_t m_cond;
+    int m_nWaiters;
+    bool m_dropped;
 };
 
 class CidLock {
@@ -69,14 +85,49 @@ class CidLock {
     void Relinquish( CidInfo* claim, bool drop );
 
  private:
+    typedef struct {
+        pthread_mutex_t mutex;
+        map< CookieID, CidInfo* > infos;
+    } Shard;
+
+    /* Consistent with AddrInfo::equals() */
+    struct AddrHash {
+        size_t operator()( const AddrInfo& addr ) const {
+            size_t hash;
+            if ( addr.isTCP() ) {
+                hash = addr.socket();
+            } else {
+                const struct sockaddr_in* sin = &addr.saddr()->addr_in;
+                hash = (addr.clientToken() * 31) ^ sin->sin_addr.s_addr
+                    ^ (sin->sin_port << 16);
+            }
+            return hash;
+        }
+    };
+    struct AddrEquals {
+        bool operator()( const AddrInfo& addr1, const AddrInfo& addr2 ) const {
+            return addr1.equals( addr2 );
+        }
+    };
+    typedef tr1::unordered_map<AddrInfo, CookieID, AddrHash, AddrEquals> 
+        AddrIndex;
+
     static CidLock* s_instance;
 
     CidLock();
-    void print_claimed( const char* caller );
+    Shard* getShard( CookieID cid ) { return &m_shards[cid % CIDLOCK_SHARDS]; }
+    void waitFor( Shard* shard, CidInfo* info );
+    void reindex( CookieID cid, const vector<AddrInfo>& oldAddrs, 
+                  const vector<AddrInfo>& newAddrs );
+    void print_claimed( const char* caller, Shard* shard );
+
+    Shard m_shards[CIDLOCK_SHARDS];
+
+    /* Which cid each address belonged to when that game was last
+       relinquished: what ClaimSocket() searches */
+    AddrIndex m_addrIndex;
+    pthread_rwlock_t m_addrIndexRWLock;
 
-    map< CookieID, CidInfo* > m_infos;
-    pthread_mutex_t m_infos_mutex;
-    pthread_cond_t m_infos_condvar;
     int m_nextCID;
 
 }; /* CidLock */
@@ -31,6 +31,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <time.h>
 
 #include "cref.h"
 #include "xwrelay.h"
@@ -853,6 +854,32 @@ CookieRef::store_message( HostID dest, const unsigned char* buf,
     DBMgr::Get()->StoreMessage( ConnName(), dest, buf, len );
 }
 
+#define DRAIN_HIST_INTERVAL 100  /* drains between logs */
+
+/* How many messages each send_stored_messages() sends and how many ms it
+   takes */
+static Pow2Hist s_drainSizes( "drain", "msgs", DRAIN_HIST_INTERVAL );
+static Pow2Hist s_drainMillis( "drain", "ms", DRAIN_HIST_INTERVAL );
+
+typedef struct _DrainState {
+    vector<int> msgIDs;
+    vector<size_t> lens;
+    vector<unsigned char> bytes; /* all of them, end to end */
+} DrainState;
+
+static bool
+collectMsg( void* closure, int indx, int msgID, AddrInfo::ClientToken token,
+            const unsigned char* buf, size_t len )
+{
+    DrainState* ds = (DrainState*)closure;
+    ds->msgIDs.push_back( msgID );
+    ds->lens.push_back( len );
+    ds->bytes.insert( ds->bytes.end(), buf, buf + len );
+    return true;
+}
+
+/* Read dest's whole backlog with one query, send it all at once, then
+   delete what went out (crediting the game with it) with one statement */
 void
 CookieRef::send_stored_messages( HostID dest, const AddrInfo* addr )
 {
@@ -861,18 +888,31 @@ CookieRef::send_stored_messages( HostID dest, const AddrInfo* addr )
     assert( dest > 0 && dest <= 4 );
     assert( -1 != addr->socket() );
 
-    for ( ; ; ) {
-        unsigned char buf[MAX_MSG_LEN];
-        size_t buflen = sizeof(buf);
-        int msgID;
-        if ( !DBMgr::Get()->GetStoredMessage( ConnName(), dest, 
-                                              buf, &buflen, &msgID ) ) {
-            break;
+    uint64_t start = now_ms();
+    DBMgr* dbmgr = DBMgr::Get();
+    DrainState ds;
+    const char* connName = ConnName();
+    dbmgr->GetPendingMsgs( &connName, &dest, 1, collectMsg, &ds );
+
+    int nMsgs = ds.msgIDs.size();
+    if ( 0 < nMsgs ) {
+        const unsigned char* next = ds.bytes.empty() ? NULL : &ds.bytes[0];
+        vector<const unsigned char*> bufs;
+        for ( int ii = 0; ii < nMsgs; ++ii ) {
+            bufs.push_back( next );
+            next += ds.lens[ii];
         }
-        if ( ! send_with_length( addr, dest, buf, buflen, true ) ) {
-            break;
+
+        int nSent = send_msgs_unsafe( addr, &bufs[0], &ds.lens[0], nMsgs );
+        if ( 0 < nSent ) {
+            dbmgr->RecordSentAndRemove( &ds.msgIDs[0], nSent );
+        }
+        if ( nSent < nMsgs ) {
+            pushRemoveSocketEvent( addr );
+            XWThreadPool::GetTPool()->CloseSocket( addr );
         }
-        DBMgr::Get()->RemoveStoredMessages( &msgID, 1 );
+        s_drainSizes.note( nMsgs );
+        s_drainMillis.note( now_ms() - start );
     }
 } /* send_stored_messages */
 
@@ -1010,7 +1050,7 @@ CookieRef::setAllConnectedTimer()
 {
     time_t inHowLong;
     if ( RelayConfigs::GetConfigs()->GetValueFor( "ALLCONN", &inHowLong ) ) {
-        TimerMgr::GetTimerMgr()->SetTimer( inHowLong,
+        TimerMgr::GetTimerMgr()->SetTimer( inHowLong * 1000,
                                            s_checkAllConnected, this, 0 );
     }
 }
@@ -1030,7 +1070,7 @@ CookieRef::setAckTimer( HostID hid )
 
     time_t inHowLong;
     if ( RelayConfigs::GetConfigs()->GetValueFor( "DEVACK", &inHowLong ) ) {
-        TimerMgr::GetTimerMgr()->SetTimer( inHowLong,
+        TimerMgr::GetTimerMgr()->SetTimer( inHowLong * 1000,
                                            s_checkAck, &m_timers[hid], 0 );
     } else {
         logf( XW_LOGINFO, "not setting timer" );
@@ -1175,9 +1215,9 @@ CookieRef::forward_or_store( const CRefEvent* evt )
             DevIDRelay devid;
             AddrInfo::ClientToken token;
             if ( DBMgr::Get()->TokenFor( ConnName(), dest, &devid, &token ) ) {
-                const AddrInfo::AddrUnion* saddr = DevMgr::Get()->get( devid );
-                if ( !!saddr ) {
-                    AddrInfo addr( -1, token, saddr );
+                AddrInfo::AddrUnion saddr;
+                if ( DevMgr::Get()->get( devid, &saddr ) ) {
+                    AddrInfo addr( -1, token, &saddr );
                     postTellHaveMsgs( &addr );
                 }
             }
@@ -475,8 +475,8 @@ CRefMgr::AddNew( const char* cookie, const char* connName, CookieID cid,
         RelayConfigs* cfg = RelayConfigs::GetConfigs();
         int heartbeat;
         cfg->GetValueFor( "HEARTBEAT", &heartbeat );
-        TimerMgr::GetTimerMgr()->SetTimer( heartbeat, heartbeatProc, this,
-                                           heartbeat );
+        TimerMgr::GetTimerMgr()->SetTimer( heartbeat * 1000, heartbeatProc, 
+                                           this, heartbeat * 1000 );
     }
 #endif
 
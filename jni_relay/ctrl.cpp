@@ -47,6 +47,7 @@
 #include "configs.h"
 #include "lstnrmgr.h"
 #include "tpool.h"
+#include "xwlog.h"
 
 #define MAX_ARGS 10
 
@@ -314,6 +315,7 @@ cmd_set( int socket, const char** args )
             RelayConfigs* rc = RelayConfigs::GetConfigs();
             if ( rc != NULL ) {
                 rc->SetValueFor( "LOGLEVEL", val );
+                xwlog_reloadConfigs();
                 needsHelp = false;
             }
         }
@@ -26,6 +26,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/time.h>
 
 #include <glib.h>
 
@@ -44,12 +45,131 @@ static DBMgr* s_instance = NULL;
 
 #define DELIM "\1"
 #define MAX_NUM_PLAYERS 4
+#define DEFAULT_POOL_SIZE 8
+#define METRICS_INTERVAL 1000   /* checkouts between logging pool metrics */
+#define MAX_INSERT_ROWS 200     /* cached messages written per INSERT */
+#define DEFAULT_SENT_FLUSH_MS 2000
+
+#ifdef HAVE_STIME
+# define NOT_SENT " AND stime IS NULL"
+#else
+# define NOT_SENT ""
+#endif
+
+/* Names of statements prepared on every pooled connection */
+#define STMT_STORE_MSG "storeMsg"
+#define STMT_NTH_MSG "nthMsg"
+#define STMT_PENDING_MSGS "pendingMsgs"
+#define STMT_PENDING_COUNTS "pendingCounts"
+#define STMT_DEVICE_MSGS "deviceMsgs"
+#define STMT_RECORD_SENT "recordSent"
+#define STMT_SENT_AND_REMOVE "sentAndRemove"
+#define STMT_REMOVE_MSGS "removeMsgs"
+#define STMT_FIND_PLAYER "findPlayer"
+#define STMT_ADD_DEVICE "addDevice"
+#define STMT_GAME_ADDRS "gameAddrs"
+
+/* Every parameter's cast so the server needn't guess its type.  Lists of
+   msg ids are passed as int[] literals, e.g. "{1,2,3}", and lists of games
+   as parallel varchar[] and int[] literals of connNames and hids. */
+static const struct {
+    const char* name;
+    const char* sql;
+} s_stmts[] = {
+    { STMT_STORE_MSG, "INSERT INTO " MSGS_TABLE
+      " (connname, hid, devid, token, msg, msglen)"
+      " SELECT $1::varchar, $2::int, devids[$2::int], tokens[$2::int],"
+      " $3::bytea, $4::int FROM " GAMES_TABLE " WHERE connname = $1::varchar"
+    },
+    { STMT_NTH_MSG, "SELECT id, msg, msg64, msglen FROM " MSGS_TABLE
+      " WHERE connName = $1::varchar AND hid = $2::int" NOT_SENT
+      " ORDER BY id LIMIT 1 OFFSET $3::int"
+    },
+    /* The first column of these says which of the games passed in (or 0
+       for a device) the message's for; see fetchMsgs() */
+    { STMT_PENDING_MSGS, "SELECT indx, id, token, msg, msg64, msglen FROM "
+      MSGS_TABLE ", generate_subscripts($1::varchar[], 1) AS indx"
+      " WHERE connName = ($1::varchar[])[indx]"
+      " AND hid = ($2::int[])[indx]" NOT_SENT " ORDER BY indx, id"
+    },
+    { STMT_PENDING_COUNTS, "SELECT indx, count(*) FROM " MSGS_TABLE
+      ", generate_subscripts($1::varchar[], 1) AS indx"
+      " WHERE connName = ($1::varchar[])[indx]"
+      " AND hid = ($2::int[])[indx]" NOT_SENT " GROUP BY indx"
+    },
+    { STMT_DEVICE_MSGS, "SELECT 0, id, token, msg, msg64, msglen FROM "
+      MSGS_TABLE " WHERE devid = $1::int" NOT_SENT
+      " AND connname IN (SELECT connname FROM " GAMES_TABLE
+      " WHERE NOT " GAMES_TABLE ".dead) ORDER BY id"
+    },
+    /* Parallel connName, hid and byte count arrays, a game perhaps
+       appearing more than once */
+    { STMT_RECORD_SENT, "WITH sent AS (SELECT ($1::varchar[])[indx]"
+      " AS connname, ($2::int[])[indx] AS hid, ($3::int[])[indx] AS nbytes"
+      " FROM generate_subscripts($1::varchar[], 1) AS indx),"
+      " totals AS (SELECT connname, array_agg(hid) AS hids,"
+      " sum(nbytes) AS nbytes FROM sent GROUP BY connname)"
+      " UPDATE " GAMES_TABLE " SET nsent = nsent + totals.nbytes,"
+      " mtimes = ARRAY(SELECT CASE WHEN ii = ANY(totals.hids)"
+      " THEN 'now' ELSE " GAMES_TABLE ".mtimes[ii] END"
+      " FROM generate_series(1, 4) AS ii ORDER BY ii)" /* MAX_NUM_PLAYERS */
+      " FROM totals WHERE " GAMES_TABLE ".connname = totals.connname"
+    },
+    /* Remove the messages and credit their games with them.  A game may
+       have had messages for more than one hid, so mtimes is rebuilt rather
+       than assigned one element. */
+    { STMT_SENT_AND_REMOVE, "WITH sent AS ("
+#ifdef HAVE_STIME
+      "UPDATE " MSGS_TABLE " SET stime='now'"
+#else
+      "DELETE FROM " MSGS_TABLE
+#endif
+      " WHERE id = ANY($1::int[])" NOT_SENT " RETURNING connname, hid, msglen),"
+      " totals AS (SELECT connname, array_agg(hid) AS hids,"
+      " sum(msglen) AS nbytes FROM sent GROUP BY connname)"
+      " UPDATE " GAMES_TABLE " SET nsent = nsent + totals.nbytes,"
+      " mtimes = ARRAY(SELECT CASE WHEN ii = ANY(totals.hids)"
+      " THEN 'now' ELSE " GAMES_TABLE ".mtimes[ii] END"
+      " FROM generate_series(1, 4) AS ii ORDER BY ii)" /* MAX_NUM_PLAYERS */
+      " FROM totals WHERE " GAMES_TABLE ".connname = totals.connname"
+    },
+    { STMT_REMOVE_MSGS,
+#ifdef HAVE_STIME
+      "UPDATE " MSGS_TABLE " SET stime='now'"
+#else
+      "DELETE FROM " MSGS_TABLE
+#endif
+      " WHERE id = ANY($1::int[])"
+    },
+    { STMT_FIND_PLAYER, "SELECT connname, hid, seeds[hid] FROM " GAMES_TABLE
+      ", generate_series(1, 4) AS hid"  /* MAX_NUM_PLAYERS */
+      " WHERE devids[hid] = $1::int AND tokens[hid] = $2::int"
+    },
+    /* devids[] is left alone when $6 is DEVID_NONE */
+    { STMT_ADD_DEVICE, "UPDATE " GAMES_TABLE " SET"
+      " nPerDevice[$1::int] = $2::int, clntVers[$1::int] = $3::int,"
+      " seeds[$1::int] = $4::int, addrs[$1::int] = $5::inet,"
+      " devids[$1::int] = CASE WHEN 0 = $6::int THEN devids[$1::int]"
+      " ELSE $6::int END,"
+      " tokens[$1::int] = $7::int, mtimes[$1::int] = 'now',"
+      " ack[$1::int] = $8::varchar WHERE connName = $9::varchar"
+    },
+    { STMT_GAME_ADDRS, "SELECT indx, devids[($2::int[])[indx]],"
+      " tokens[($2::int[])[indx]], dead FROM " GAMES_TABLE
+      ", generate_subscripts($1::varchar[], 1) AS indx"
+      " WHERE connname = ($1::varchar[])[indx]"
+    },
+};
 
 static void formatParams( char* paramValues[], int nParams, const char* fmt, 
                           char* buf, int bufLen, ... );
+static void formatIDArray( const int* msgIDs, int nMsgIDs, string& out );
+static void formatNameArray( const char* const* names, int nNames,
+                             string& out );
+static int getBinaryInt( const PGresult* result, int row, int col );
 static int here_less_seed( const char* seeds, int perDeviceSum, 
                            unsigned short seed );
-static void destr_function( void* conn );
+static void prepare_statements( PGconn* conn );
 
 /* static */ DBMgr*
 DBMgr::Get() 
@@ -61,12 +181,55 @@ DBMgr::Get()
 } /* Get */
 
 DBMgr::DBMgr()
+    : m_nConns(0)
+    , m_nCheckouts(0)
+    , m_nWaits(0)
+    , m_waitMillis(0)
+    , m_maxBusy(0)
 {
     int tmp;
     RelayConfigs::GetConfigs()->GetValueFor( "USE_B64", &tmp );
     m_useB64 = tmp != 0;
 
-    pthread_key_create( &m_conn_key, destr_function );
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "DB_POOL_SIZE",
+                                                   &m_poolSize )
+         || 0 >= m_poolSize ) {
+        m_poolSize = DEFAULT_POOL_SIZE;
+    }
+    pthread_mutex_init( &m_poolMutex, NULL );
+    pthread_cond_init( &m_poolCondVar, NULL );
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init( &attr );
+    /* else a steady stream of readers keeps the flusher out */
+    pthread_rwlockattr_setkind_np( &attr,
+                                   PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP );
+    pthread_rwlock_init( &m_flushLock, &attr );
+    pthread_rwlockattr_destroy( &attr );
+
+    pthread_mutex_init( &m_sentMutex, NULL );
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "SENT_FLUSH_MS",
+                                                   &m_sentFlushMS ) ) {
+        m_sentFlushMS = DEFAULT_SENT_FLUSH_MS;
+    }
+    if ( 0 < m_sentFlushMS ) {
+        pthread_t thread;
+        int err = pthread_create( &thread, NULL, sent_main, this );
+        assert( 0 == err );
+        pthread_detach( thread );
+    }
+
+    m_msgCache = NULL;
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "MSG_CACHE_MS",
+                                                   &m_msgCacheMS ) ) {
+        m_msgCacheMS = 0;
+    }
+#ifdef HAVE_STIME
+    m_msgCacheMS = 0;           /* sent messages are kept in the table */
+#endif
+    if ( 0 < m_msgCacheMS ) {
+        startCache();
+    }
 
     /* Now figure out what the largest cid currently is.  There must be a way
        to get postgres to do this for me.... */
@@ -90,8 +253,14 @@ DBMgr::~DBMgr()
     assert( s_instance == this );
     s_instance = NULL;
 
-    int err = pthread_key_delete( m_conn_key );
-    logf( XW_LOGINFO, "%s: pthread_key_delete=>%d", __func__, err );
+    MutexLock ml( &m_poolMutex );
+    logf( XW_LOGINFO, "%s: closing %d of %d connections", __func__,
+          (int)m_idleConns.size(), m_nConns );
+    vector<PGconn*>::iterator iter;
+    for ( iter = m_idleConns.begin(); iter != m_idleConns.end(); ++iter ) {
+        PQfinish( *iter );
+    }
+    m_idleConns.clear();
 }
 
 void
@@ -112,10 +281,7 @@ DBMgr::AddNew( const char* cookie, const char* connName, CookieID cid,
                   buf, sizeof(buf), cid, cookie, connName, nPlayersT, 
                   langCode, isPublic?"TRUE":"FALSE" );
 
-    PGresult* result = PQexecParams( getThreadConn(), command,
-                                     nParams, NULL,
-                                     paramValues, 
-                                     NULL, NULL, 0 );
+    PGresult* result = execParams( command, nParams, paramValues );
     if ( PGRES_COMMAND_OK != PQresultStatus(result) ) {
         logf( XW_LOGERROR, "PQexec=>%s;%s", PQresStatus(PQresultStatus(result)), 
               PQresultErrorMessage(result) );
@@ -136,7 +302,7 @@ DBMgr::FindGame( const char* connName, char* cookieBuf, int bufLen,
     string_printf( query, fmt, connName );
     logf( XW_LOGINFO, "query: %s", query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     if ( 1 == PQntuples( result ) ) {
         cid = atoi( PQgetvalue( result, 0, 0 ) );
         snprintf( cookieBuf, bufLen, "%s", PQgetvalue( result, 0, 1 ) );
@@ -155,43 +321,22 @@ bool
 DBMgr::FindPlayer( DevIDRelay relayID, AddrInfo::ClientToken token, 
                    string& connName, HostID* hidp, unsigned short* seed )
 {
-    int nSuccesses = 0;
-
-    const char* fmt = 
-        "SELECT connName FROM %s WHERE %d = ANY(devids) AND %d = ANY(tokens)";
-    string query;
-    string_printf( query, fmt, GAMES_TABLE, relayID, token );
-
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    int nTuples = PQntuples( result );
-    vector<string> names(nTuples);
-    for ( int ii = 0; ii < nTuples; ++ii ) {
-        string name( PQgetvalue( result, ii, 0 ) );
-        names.push_back( name );
+    char relayIDBuf[16];
+    char tokenBuf[16];
+    snprintf( relayIDBuf, sizeof(relayIDBuf), "%d", relayID );
+    snprintf( tokenBuf, sizeof(tokenBuf), "%d", token );
+    const char* values[] = { relayIDBuf, tokenBuf };
+
+    PGresult* result = execPrepared( STMT_FIND_PLAYER, 2, values, NULL, NULL,
+                                     0 );
+    int nSuccesses = PQntuples( result );
+    if ( 0 < nSuccesses ) {
+        connName = PQgetvalue( result, 0, 0 );
+        *hidp = atoi( PQgetvalue( result, 0, 1 ) );
+        *seed = atoi( PQgetvalue( result, 0, 2 ) );
     }
     PQclear( result );
 
-    for ( vector<string>::const_iterator iter = names.begin();
-          iter != names.end(); ++iter ) {
-        const char* name = iter->c_str();
-        for ( HostID hid = 1; hid <= MAX_NUM_PLAYERS; ++hid ) {
-            fmt = "SELECT seeds[%d] FROM %s WHERE connname = '%s' "
-                "AND devids[%d] = %d AND tokens[%d] = %d";
-            string query;
-            string_printf( query, fmt, hid, GAMES_TABLE, name,
-                           hid, relayID, hid, token );
-            result = PQexec( getThreadConn(), query.c_str() );
-            int nTuples2 = PQntuples( result );
-            for ( int jj = 0; jj < nTuples2; ++jj ) {
-                connName = name;
-                *hidp = hid;
-                *seed = atoi( PQgetvalue( result, 0, 0 ) );
-                ++nSuccesses;
-            }
-            PQclear( result );
-        }
-    }
-
     if ( 1 < nSuccesses ) {
         logf( XW_LOGERROR, "%s found %d matches!!!", __func__, nSuccesses );
     }
@@ -224,10 +369,7 @@ DBMgr::SeenSeed( const char* cookie, unsigned short seed,
         " ORDER BY ctime DESC"
         " LIMIT 1";
 
-    PGresult* result = PQexecParams( getThreadConn(), cmd,
-                                     nParams, NULL,
-                                     paramValues, 
-                                     NULL, NULL, 0 );
+    PGresult* result = execParams( cmd, nParams, paramValues );
     bool found = 1 == PQntuples( result );
     if ( found ) {
         *cid = atoi( PQgetvalue( result, 0, 0 ) );
@@ -267,10 +409,7 @@ DBMgr::FindOpen( const char* cookie, int lang, int nPlayersT, int nPlayersH,
         " AND $5 = pub"
         " LIMIT 1";
 
-    PGresult* result = PQexecParams( getThreadConn(), cmd,
-                                     nParams, NULL,
-                                     paramValues, 
-                                     NULL, NULL, 0 );
+    PGresult* result = execParams( cmd, nParams, paramValues );
     if ( 1 == PQntuples( result ) ) {
         cid = atoi( PQgetvalue( result, 0, 0 ) );
         snprintf( connNameBuf, bufLen, "%s", PQgetvalue( result, 0, 1 ) );
@@ -291,7 +430,7 @@ DBMgr::AllDevsAckd( const char* const connName )
     string_printf( query, cmd, connName );
     logf( XW_LOGINFO, "query: %s", query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     int nTuples = PQntuples( result );
     assert( nTuples <= 1 );
     bool full = nTuples == 1 && 't' == PQgetvalue( result, 0, 0 )[0];
@@ -339,10 +478,7 @@ DBMgr::RegisterDevice( const DevID* host )
                           buf, sizeof(buf), devID, host->m_devIDType, 
                           host->m_devIDString.c_str() );
 
-            PGresult* result = PQexecParams( getThreadConn(), command,
-                                             nParams, NULL,
-                                             paramValues, 
-                                             NULL, NULL, 0 );
+            PGresult* result = execParams( command, nParams, paramValues );
             success = PGRES_COMMAND_OK == PQresultStatus(result);
             if ( !success ) {
                 logf( XW_LOGERROR, "PQexec=>%s;%s", 
@@ -393,27 +529,34 @@ DBMgr::AddDevice( const char* connName, HostID curID, int clientVersion,
     }
     assert( newID <= 4 );
 
-    string devIDBuf;
-    if ( DEVID_NONE != devID ) {
-        string_printf( devIDBuf, "devids[%d] = %d, ", newID, devID );
-    } else {
-        assert( 0 == strlen(devIDBuf.c_str()) );
-    }
-
-    const char* fmt = "UPDATE " GAMES_TABLE " SET nPerDevice[%d] = %d,"
-        " clntVers[%d] = %d,"
-        " seeds[%d] = %d, addrs[%d] = \'%s\', %s"
-        " tokens[%d] = %d, mtimes[%d]='now', ack[%d]=\'%c\'"
-        " WHERE connName = '%s'";
-    string query;
+    char hidBuf[16];
+    char nToAddBuf[16];
+    char versBuf[16];
+    char seedBuf[16];
+    char devIDBuf[16];
+    char tokenBuf[16];
+    snprintf( hidBuf, sizeof(hidBuf), "%d", newID );
+    snprintf( nToAddBuf, sizeof(nToAddBuf), "%d", nToAdd );
+    snprintf( versBuf, sizeof(versBuf), "%d", clientVersion );
+    snprintf( seedBuf, sizeof(seedBuf), "%d", seed );
+    snprintf( devIDBuf, sizeof(devIDBuf), "%d", devID );
+    snprintf( tokenBuf, sizeof(tokenBuf), "%d", addr->clientToken() );
     char* ntoa = inet_ntoa( addr->sin_addr() );
-    string_printf( query, fmt, newID, nToAdd, newID, clientVersion,
-                   newID, seed, newID, ntoa, devIDBuf.c_str(), 
-                   newID, addr->clientToken(), newID, newID, ackd?'A':'a', 
-                   connName );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
+    const char* values[] = { hidBuf, nToAddBuf, versBuf, seedBuf, ntoa,
+                             devIDBuf, tokenBuf, ackd ? "A" : "a", connName };
+    logf( XW_LOGINFO, "%s(%s, hid=%d, seed=%d)", __func__, connName, newID,
+          seed );
 
-    execSql( query );
+    PGresult* result = execPrepared( STMT_ADD_DEVICE, 9, values, NULL, NULL,
+                                     0 );
+    if ( PGRES_COMMAND_OK != PQresultStatus(result) ) {
+        logf( XW_LOGERROR, "PQexec=>%s;%s", PQresStatus(PQresultStatus(result)), 
+              PQresultErrorMessage(result) );
+    }
+    PQclear( result );
+    if ( NULL != m_msgCache ) {
+        m_msgCache->ForgetAddrs( connName ); /* devid, token may be new */
+    }
 
     return newID;
 } /* AddDevice */
@@ -453,7 +596,7 @@ DBMgr::HIDForSeed( const char* const connName, unsigned short seed )
     string query;
     string_printf( query, fmt, connName, seed );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     if ( 1 == PQntuples( result ) ) {
         snprintf( seeds, sizeof(seeds), "%s", PQgetvalue( result, 0, 0 ) );
     }
@@ -500,7 +643,7 @@ DBMgr::HaveDevice( const char* connName, HostID hid, int seed )
     string query;
     string_printf( query, fmt, connName, hid, seed );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     found = 1 == PQntuples( result );
     PQclear( result );
     return found;
@@ -536,45 +679,90 @@ void
 DBMgr::RecordSent( const char* const connName, HostID hid, int nBytes )
 {
     assert( hid >= 0 && hid <= 4 );
-    const char* fmt = "UPDATE " GAMES_TABLE " SET"
-        " nsent = nsent + %d, mtimes[%d] = 'now'"
-        " WHERE connName = '%s'";
-    string query;
-    string_printf( query, fmt, nBytes, hid, connName );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-
-    execSql( query );
+    logf( XW_LOGINFO, "%s(%s, %d, %d)", __func__, connName, hid, nBytes );
+    if ( 0 < m_sentFlushMS ) {
+        MutexLock ml( &m_sentMutex );
+        SentCounts& counts = m_sent[SentKey( connName, hid )];
+        counts.nBytes += nBytes;
+        ++counts.nMsgs;
+    } else {
+        writeSent( &connName, &hid, &nBytes, 1 );
+    }
 }
 
 void
-DBMgr::RecordSent( const int* msgIDs, int nMsgIDs )
-{
-    if ( nMsgIDs > 0 ) {
-        string query( "SELECT connname,hid,sum(msglen)"
-                      " FROM " MSGS_TABLE " WHERE id IN (" );
-        for ( int ii = 0; ; ) {
-            string_printf( query, "%d", msgIDs[ii] );
-            if ( ++ii == nMsgIDs ) {
-                break;
-            } else {
-                query.append( "," );
-            }
+DBMgr::FlushSent( void )
+{
+    SentMap sent;
+    {
+        MutexLock ml( &m_sentMutex );
+        sent.swap( m_sent );
+    }
+
+    if ( 0 < sent.size() ) {
+        vector<const char*> connNames;
+        vector<HostID> hids;
+        vector<int> nBytes;
+        int nMsgs = 0;
+        SentMap::const_iterator iter;
+        for ( iter = sent.begin(); iter != sent.end(); ++iter ) {
+            connNames.push_back( iter->first.first.c_str() );
+            hids.push_back( iter->first.second );
+            nBytes.push_back( iter->second.nBytes );
+            nMsgs += iter->second.nMsgs;
         }
-        query.append( ") GROUP BY connname,hid" );
 
-        PGresult* result = PQexec( getThreadConn(), query.c_str() );
-        if ( PGRES_TUPLES_OK == PQresultStatus( result ) ) {
-            int ntuples = PQntuples( result );
-            for ( int ii = 0; ii < ntuples; ++ii ) {
-                RecordSent( PQgetvalue( result, ii, 0 ),
-                            atoi( PQgetvalue( result, ii, 1 ) ),
-                            atoi( PQgetvalue( result, ii, 2 ) ) );
+        if ( writeSent( &connNames[0], &hids[0], &nBytes[0],
+                        sent.size() ) ) {
+            logf( XW_LOGINFO, "%s: recorded %d msgs for %d games", __func__,
+                  nMsgs, (int)sent.size() );
+        } else {                /* keep them for next time */
+            MutexLock ml( &m_sentMutex );
+            for ( iter = sent.begin(); iter != sent.end(); ++iter ) {
+                SentCounts& counts = m_sent[iter->first];
+                counts.nBytes += iter->second.nBytes;
+                counts.nMsgs += iter->second.nMsgs;
             }
         }
-        PQclear( result );
     }
 }
 
+bool
+DBMgr::writeSent( const char* const* connNames, const HostID* hids,
+                  const int* nBytes, int nGames )
+{
+    string names;
+    string hidArray;
+    string byteArray;
+    formatGames( connNames, hids, nGames, names, hidArray );
+    formatIDArray( nBytes, nGames, byteArray );
+    const char* values[] = { names.c_str(), hidArray.c_str(),
+                             byteArray.c_str() };
+
+    PGresult* result = execPrepared( STMT_RECORD_SENT, 3, values, NULL, NULL,
+                                     0 );
+    bool ok = PGRES_COMMAND_OK == PQresultStatus(result);
+    if ( !ok ) {
+        logf( XW_LOGERROR, "PQexec=>%s;%s", PQresStatus(PQresultStatus(result)), 
+              PQresultErrorMessage(result) );
+    }
+    PQclear( result );
+    return ok;
+}
+
+/* static */ void*
+DBMgr::sent_main( void* closure )
+{
+    blockSignals();
+
+    DBMgr* self = (DBMgr*)closure;
+    for ( ; ; ) {
+        usleep( self->m_sentFlushMS * 1000 );
+        self->FlushSent();
+    }
+    return NULL;
+}
+
 void
 DBMgr::RecordAddress( const char* const connName, HostID hid, 
                       const AddrInfo* addr )
@@ -599,7 +787,7 @@ DBMgr::GetPlayerCounts( const char* const connName, int* nTotal, int* nHere )
     string_printf( query, fmt, connName );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     assert( 1 == PQntuples( result ) );
     *nTotal = atoi( PQgetvalue( result, 0, 0 ) );
     *nHere = atoi( PQgetvalue( result, 0, 1 ) );
@@ -615,6 +803,9 @@ DBMgr::KillGame( const char* const connName, int hid )
     string query;
     string_printf( query, fmt, hid, hid, connName );
     execSql( query );
+    if ( NULL != m_msgCache ) {
+        m_msgCache->ForgetAddrs( connName ); /* it's dead now */
+    }
 }
 
 void
@@ -639,7 +830,7 @@ DBMgr::PublicRooms( int lang, int nPlayers, int* nNames, string& names )
     string_printf( query, fmt, lang, nPlayers );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     int nTuples = PQntuples( result );
     for ( int ii = 0; ii < nTuples; ++ii ) {
         names.append( PQgetvalue( result, ii, 0 ) );
@@ -662,7 +853,7 @@ DBMgr::TokenFor( const char* const connName, int hid, DevIDRelay* devid,
         " WHERE connName='%s'";
     string query;
     string_printf( query, fmt, hid, hid, connName );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     if ( 1 == PQntuples( result ) ) {
         AddrInfo::ClientToken token_tmp = atoi( PQgetvalue( result, 0, 0 ) );
         DevIDRelay devid_tmp = atoi( PQgetvalue( result, 0, 1 ) );
@@ -679,17 +870,6 @@ DBMgr::TokenFor( const char* const connName, int hid, DevIDRelay* devid,
     return found;
 }
 
-int
-DBMgr::PendingMsgCount( const char* connName, int hid )
-{
-    string test;
-    string_printf( test, "connName = '%s' AND hid = %d ", connName, hid );
-#ifdef HAVE_STIME
-    string_printf( test, " AND stime IS NULL" );
-#endif
-    return getCountWhere( MSGS_TABLE, test );
-}
-
 bool
 DBMgr::execSql( const string& query )
 {
@@ -699,7 +879,7 @@ DBMgr::execSql( const string& query )
 bool
 DBMgr::execSql( const char* const query )
 {
-    PGresult* result = PQexec( getThreadConn(), query );
+    PGresult* result = exec( query );
     bool ok = PGRES_COMMAND_OK == PQresultStatus(result);
     if ( !ok ) {
         logf( XW_LOGERROR, "PQexec=>%s;%s", PQresStatus(PQresultStatus(result)), PQresultErrorMessage(result) );
@@ -717,29 +897,13 @@ DBMgr::readArray( const char* const connName, int arr[]  ) /* len 4 */
     string_printf( query, fmt, connName );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     assert( 1 == PQntuples( result ) );
     const char* arrStr = PQgetvalue( result, 0, 0 );
     sscanf( arrStr, "{%d,%d,%d,%d}", &arr[0], &arr[1], &arr[2], &arr[3] );
     PQclear( result );
 }
 
-DevIDRelay 
-DBMgr::getDevID( const char* connName, int hid )
-{
-    DevIDRelay devID;
-    const char* fmt = "SELECT devids[%d] FROM " GAMES_TABLE " WHERE connName='%s'";
-    string query;
-    string_printf( query, fmt, hid, connName );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    assert( 1 == PQntuples( result ) );
-    devID = (DevIDRelay)strtoul( PQgetvalue( result, 0, 0 ), NULL, 10 );
-    PQclear( result );
-    return devID;
-}
-
 DevIDRelay 
 DBMgr::getDevID( const DevID* devID )
 {
@@ -761,7 +925,7 @@ DBMgr::getDevID( const DevID* devID )
 
     if ( 0 < query.size() ) {
         logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-        PGresult* result = PQexec( getThreadConn(), query.c_str() );
+        PGresult* result = exec( query.c_str() );
         assert( 1 >= PQntuples( result ) );
         if ( 1 == PQntuples( result ) ) {
             rDevID = (DevIDRelay)strtoul( PQgetvalue( result, 0, 0 ), NULL, 10 );
@@ -793,7 +957,18 @@ DBMgr::CountStoredMessages( const char* const connName, int hid )
         string_printf( test, " AND hid = %d", hid );
     }
 
-    return getCountWhere( MSGS_TABLE, test );
+    int count;
+    if ( NULL == m_msgCache ) {
+        count = getCountWhere( MSGS_TABLE, test );
+    } else {
+        RWReadLock rrl( &m_flushLock );
+        bool inDB;
+        count = m_msgCache->Count( connName, hid, &inDB );
+        if ( inDB ) {
+            count += getCountWhere( MSGS_TABLE, test );
+        }
+    }
+    return count;
 }
 
 int
@@ -811,73 +986,60 @@ DBMgr::CountStoredMessages( DevIDRelay relayID )
     string_printf( test, "AND stime IS NULL" );
 #endif
 
-    return getCountWhere( MSGS_TABLE, test );
-}
-
-void
-DBMgr::GetStoredMessageIDs( DevIDRelay relayID, vector<int>& ids )
-{
-    const char* fmt = "SELECT id FROM " MSGS_TABLE " WHERE devid=%d "
-        "AND connname IN (SELECT connname FROM " GAMES_TABLE 
-        " WHERE NOT " GAMES_TABLE ".dead)";
-    string query;
-    string_printf( query, fmt, relayID );
-    // logf( XW_LOGINFO, "%s: query=\"%s\"", __func__, query.c_str() );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    int nTuples = PQntuples( result );
-    for ( int ii = 0; ii < nTuples; ++ii ) {
-        int id = atoi( PQgetvalue( result, ii, 0 ) );
-        // logf( XW_LOGINFO, "%s: adding id %d", __func__, id );
-        ids.push_back( id );
+    int count;
+    if ( NULL == m_msgCache ) {
+        count = getCountWhere( MSGS_TABLE, test );
+    } else {
+        resolveAddrs();
+        RWReadLock rrl( &m_flushLock );
+        count = m_msgCache->CountForDevice( relayID )
+            + getCountWhere( MSGS_TABLE, test );
     }
-    PQclear( result );
-    logf( XW_LOGINFO, "%s(relayID=%d)=>%d ids", __func__, relayID, ids.size() );
+    return count;
 }
 
+/* The message goes in as a binary parameter: no escaping or base64, and
+   the game's devid and token are looked up by the same statement. */
 void
 DBMgr::StoreMessage( const char* const connName, int hid, 
                      const unsigned char* buf, int len )
 {
-    DevIDRelay devID = getDevID( connName, hid );
-
-    size_t newLen;
-    const char* fmt = "INSERT INTO " MSGS_TABLE 
-        " (connname, hid, devid, token, %s, msglen)"
-        " VALUES( '%s', %d, %d, "
-        "(SELECT tokens[%d] from " GAMES_TABLE " where connname='%s'), "
-        "%s'%s', %d)";
-    
-    string query;
-    if ( m_useB64 ) {
-        gchar* b64 = g_base64_encode( buf, len );
-        string_printf( query, fmt, "msg64", connName, hid, devID, hid, connName, 
-                       "", b64, len );
-        g_free( b64 );
-    } else {
-        unsigned char* bytes = PQescapeByteaConn( getThreadConn(), buf, 
-                                              len, &newLen );
-        assert( NULL != bytes );
-    
-        string_printf( query, fmt, "msg", connName, hid, devID, hid, connName, 
-                       "E", bytes, len );
-        PQfreemem( bytes );
+    if ( NULL != m_msgCache ) {
+        int id = m_msgCache->Store( connName, hid, buf, len );
+        logf( XW_LOGINFO, "%s(%s, %d, len=%d): cached as %d", __func__,
+              connName, hid, len, id );
+        return;
     }
 
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    execSql( query );
+    char hidBuf[16];
+    char lenBuf[16];
+    snprintf( hidBuf, sizeof(hidBuf), "%d", hid );
+    snprintf( lenBuf, sizeof(lenBuf), "%d", len );
+    const char* values[] = { connName, hidBuf, (const char*)buf, lenBuf };
+    const int lengths[] = { 0, 0, len, 0 };
+    const int formats[] = { 0, 0, 1, 0 };
+    logf( XW_LOGINFO, "%s(%s, %d, len=%d)", __func__, connName, hid, len );
+
+    PGresult* result = execPrepared( STMT_STORE_MSG, 4, values, lengths,
+                                     formats, 0 );
+    if ( PGRES_COMMAND_OK != PQresultStatus(result) ) {
+        logf( XW_LOGERROR, "PQexec=>%s;%s", PQresStatus(PQresultStatus(result)), 
+              PQresultErrorMessage(result) );
+    }
+    PQclear( result );
 }
 
 void
-DBMgr::decodeMessage( PGresult* result, bool useB64, int b64indx, int byteaIndex, 
-                      unsigned char* buf, size_t* buflen )
+DBMgr::decodeMessage( PGresult* result, int row, bool useB64, int b64indx,
+                      int byteaIndex, unsigned char* buf, size_t* buflen )
 {
     const char* from = NULL;
     if ( useB64 ) {
-        from = PQgetvalue( result, 0, b64indx );
+        from = PQgetvalue( result, row, b64indx );
     }
     if ( NULL == from || '\0' == from[0] ) {
         useB64 = false;
-        from = PQgetvalue( result, 0, byteaIndex );
+        from = PQgetvalue( result, row, byteaIndex );
     }
 
     size_t to_length;
@@ -888,6 +1050,11 @@ DBMgr::decodeMessage( PGresult* result, bool useB64, int b64indx, int byteaIndex
         assert( to_length <= *buflen );
         memcpy( buf, txt, to_length );
         g_free( txt );
+    } else if ( 1 == PQfformat( result, byteaIndex ) ) {
+        /* binary result: the bytes themselves */
+        to_length = PQgetlength( result, row, byteaIndex );
+        assert( to_length <= *buflen );
+        memcpy( buf, from, to_length );
     } else {
         unsigned char* bytes = PQunescapeBytea( (const unsigned char*)from, 
                                                 &to_length );
@@ -902,27 +1069,35 @@ bool
 DBMgr::GetNthStoredMessage( const char* const connName, int hid, int nn, 
                             unsigned char* buf, size_t* buflen, int* msgID )
 {
-    const char* fmt = "SELECT id, msg, msg64, msglen FROM " MSGS_TABLE
-        " WHERE connName = '%s' AND hid = %d "
-#ifdef HAVE_STIME
-        "AND stime IS NULL "
-#endif
-        "ORDER BY id LIMIT 1 OFFSET %d";
-    string query;
-    string_printf( query, fmt, connName, hid, nn );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
+    bool queryOK;
+    return getNthMsg( connName, hid, nn, buf, buflen, msgID, &queryOK );
+}
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+/* The msgs table's nth message for the game.  Ignores the cache. */
+bool
+DBMgr::getNthMsg( const char* const connName, int hid, int nn,
+                  unsigned char* buf, size_t* buflen, int* msgID,
+                  bool* queryOK )
+{
+    char hidBuf[16];
+    char nnBuf[16];
+    snprintf( hidBuf, sizeof(hidBuf), "%d", hid );
+    snprintf( nnBuf, sizeof(nnBuf), "%d", nn );
+    const char* values[] = { connName, hidBuf, nnBuf };
+    logf( XW_LOGINFO, "%s(%s, %d, %d)", __func__, connName, hid, nn );
+
+    PGresult* result = execPrepared( STMT_NTH_MSG, 3, values, NULL, NULL, 1 );
+    *queryOK = PGRES_TUPLES_OK == PQresultStatus( result );
     int nTuples = PQntuples( result );
     assert( nTuples <= 1 );
 
     bool found = nTuples == 1;
     if ( found ) {
         if ( NULL != msgID ) {
-            *msgID = atoi( PQgetvalue( result, 0, 0 ) );
+            *msgID = getBinaryInt( result, 0, 0 );
         }
-        size_t msglen = atoi( PQgetvalue( result, 0, 3 ) );
-        decodeMessage( result, m_useB64, 2, 1, buf, buflen );
+        size_t msglen = getBinaryInt( result, 0, 3 );
+        decodeMessage( result, 0, m_useB64, 2, 1, buf, buflen );
         assert( 0 == msglen || msglen == *buflen );
     }
     PQclear( result );
@@ -933,88 +1108,517 @@ bool
 DBMgr::GetStoredMessage( const char* const connName, int hid,
                          unsigned char* buf, size_t* buflen, int* msgID )
 {
-    return GetNthStoredMessage( connName, hid, 0, buf, buflen, msgID );
+    if ( NULL == m_msgCache ) {
+        return GetNthStoredMessage( connName, hid, 0, buf, buflen, msgID );
+    }
+
+    RWReadLock rrl( &m_flushLock );
+    bool found = false;
+    if ( m_msgCache->InDB( connName, hid ) ) {
+        bool queryOK;
+        found = getNthMsg( connName, hid, 0, buf, buflen, msgID, &queryOK );
+        if ( !found && queryOK ) {
+            m_msgCache->SetInDB( connName, hid, false );
+        }
+    }
+    if ( !found ) {
+        vector<MsgCache::Msg> msgs;
+        m_msgCache->Get( connName, hid, msgs, 1 );
+        found = 0 < msgs.size();
+        if ( found ) {
+            size_t len = msgs[0].bytes.size();
+            assert( len <= *buflen );
+            memcpy( buf, &msgs[0].bytes[0], len );
+            *buflen = len;
+            if ( NULL != msgID ) {
+                *msgID = msgs[0].id;
+            }
+        }
+    }
+    return found;
 }
 
-bool
-DBMgr::GetStoredMessage( int msgID, unsigned char* buf, size_t* buflen, 
-                         AddrInfo::ClientToken* token )
+void
+DBMgr::RemoveStoredMessages( const int* msgIDs, int nMsgIDs )
 {
-    const char* fmt = "SELECT token, msg, msg64, msglen FROM " MSGS_TABLE
-        " WHERE id = %d "
-#ifdef HAVE_STIME
-        "AND stime IS NULL "
-#endif
-        ;
-    string query;
-    string_printf( query, fmt, msgID );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
+    if ( NULL != m_msgCache ) {
+        vector<MsgCache::Sent> sent; /* send_with_length() recorded them */
+        m_msgCache->Remove( msgIDs, nMsgIDs, sent );
+    }
+    removeMsgs( STMT_REMOVE_MSGS, msgIDs, nMsgIDs );
+}
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    int nTuples = PQntuples( result );
-    assert( nTuples <= 1 );
+void 
+DBMgr::RemoveStoredMessages( vector<int>& idv )
+{
+    if ( 0 < idv.size() ) {
+        RemoveStoredMessages( &idv[0], idv.size() );
+    }
+}
 
-    bool found = nTuples == 1;
-    if ( found ) {
-        *token = atoi( PQgetvalue( result, 0, 0 ) );
-        size_t msglen = atoi( PQgetvalue( result, 0, 3 ) );
-        decodeMessage( result, m_useB64, 2, 1, buf, buflen );
-        assert( 0 == msglen || *buflen == msglen );
+/* Passes the cached messages of each game after any the msgs table has for
+   it, which are older */
+typedef struct _MergeState {
+    DBMgr::StoredMsgProc proc;
+    void* closure;
+    vector<vector<MsgCache::Msg> > cached; /* by game */
+    vector<bool> fromDB;                   /* by game */
+    int nDone;                  /* games whose cached messages are passed */
+} MergeState;
+
+/* Pass the cached messages of games before the indxth */
+static bool
+passCached( MergeState* ms, int indx )
+{
+    bool goOn = true;
+    for ( ; goOn && ms->nDone + 1 < indx; ++ms->nDone ) {
+        const vector<MsgCache::Msg>& msgs = ms->cached[ms->nDone];
+        vector<MsgCache::Msg>::const_iterator iter;
+        for ( iter = msgs.begin(); goOn && iter != msgs.end(); ++iter ) {
+            goOn = (*ms->proc)( ms->closure, ms->nDone + 1, iter->id,
+                                iter->token, &iter->bytes[0],
+                                iter->bytes.size() );
+        }
     }
-    PQclear( result );
-    return found;
+    return goOn;
 }
 
-void
-DBMgr::RemoveStoredMessages( string& msgids )
+static bool
+mergeMsg( void* closure, int indx, int msgID, AddrInfo::ClientToken token,
+          const unsigned char* buf, size_t len )
 {
-    const char* fmt = 
-#ifdef HAVE_STIME
-        "UPDATE " MSGS_TABLE " SET stime='now' "
-#else
-        "DELETE FROM " MSGS_TABLE 
-#endif
-        " WHERE id IN (%s)";
-    string query;
-    string_printf( query, fmt, msgids.c_str() );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    execSql( query );
+    MergeState* ms = (MergeState*)closure;
+    ms->fromDB[indx-1] = true;
+    return passCached( ms, indx )
+        && (*ms->proc)( ms->closure, indx, msgID, token, buf, len );
 }
 
 void
-DBMgr::RemoveStoredMessages( const int* msgIDs, int nMsgIDs )
+DBMgr::GetPendingMsgs( const char* const* connNames, const HostID* hids,
+                       int nGames, StoredMsgProc proc, void* closure )
 {
-    if ( nMsgIDs > 0 ) {
-        string ids;
-        size_t len = 0;
+    if ( 0 >= nGames ) {
+        /* nothing to do */
+    } else if ( NULL == m_msgCache ) {
+        string names;
+        string hidArray;
+        formatGames( connNames, hids, nGames, names, hidArray );
+        const char* values[] = { names.c_str(), hidArray.c_str() };
+        fetchMsgs( STMT_PENDING_MSGS, 2, values, proc, closure );
+    } else {
+        RWReadLock rrl( &m_flushLock );
+        MergeState ms;
+        ms.proc = proc;
+        ms.closure = closure;
+        ms.cached.resize( nGames );
+        ms.fromDB.resize( nGames );
+        ms.nDone = 0;
+
+        vector<bool> inDB( nGames );
+        bool anyInDB = false;
         int ii;
-        for ( ii = 0; ; ) {
-            string_printf( ids, "%d", msgIDs[ii] );
-            assert( len < sizeof(ids) );
-            if ( ++ii == nMsgIDs ) {
-                break;
-            } else {
-                ids.append( "," );
+        for ( ii = 0; ii < nGames; ++ii ) {
+            inDB[ii] = m_msgCache->Get( connNames[ii], hids[ii],
+                                        ms.cached[ii], -1 );
+            anyInDB = anyInDB || inDB[ii];
+        }
+
+        bool goOn = true;
+        if ( anyInDB ) {
+            string names;
+            string hidArray;
+            formatGames( connNames, hids, nGames, names, hidArray );
+            const char* values[] = { names.c_str(), hidArray.c_str() };
+            goOn = fetchMsgs( STMT_PENDING_MSGS, 2, values, mergeMsg, &ms );
+            if ( goOn ) {       /* the table's been read through */
+                for ( ii = 0; ii < nGames; ++ii ) {
+                    if ( inDB[ii] && !ms.fromDB[ii] ) {
+                        m_msgCache->SetInDB( connNames[ii], hids[ii], false );
+                    }
+                }
             }
         }
-        RemoveStoredMessages( ids );
+        if ( goOn ) {
+            passCached( &ms, nGames + 1 );
+        }
     }
 }
 
-void 
-DBMgr::RemoveStoredMessages( vector<int>& idv )
+void
+DBMgr::GetPendingMsgCounts( const char* const* connNames, const HostID* hids,
+                            int nGames, int counts[] )
 {
-    if ( 0 < idv.size() ) {
+    memset( counts, 0, nGames * sizeof(counts[0]) );
+    if ( 0 < nGames ) {
+        string names;
+        string hidArray;
+        formatGames( connNames, hids, nGames, names, hidArray );
+        const char* values[] = { names.c_str(), hidArray.c_str() };
+
+        RWReadLock rrl( &m_flushLock );
+        bool anyInDB = NULL == m_msgCache;
+        if ( NULL != m_msgCache ) {
+            for ( int ii = 0; ii < nGames; ++ii ) {
+                bool inDB;
+                counts[ii] = m_msgCache->Count( connNames[ii], hids[ii],
+                                                &inDB );
+                anyInDB = anyInDB || inDB;
+            }
+        }
+
+        if ( anyInDB ) {
+            PGresult* result = execPrepared( STMT_PENDING_COUNTS, 2, values,
+                                             NULL, NULL, 0 );
+            int nTuples = PQntuples( result );
+            for ( int ii = 0; ii < nTuples; ++ii ) {
+                int indx = atoi( PQgetvalue( result, ii, 0 ) );
+                assert( 1 <= indx && indx <= nGames );
+                counts[indx-1] += atoi( PQgetvalue( result, ii, 1 ) );
+            }
+            PQclear( result );
+        }
+    }
+}
+
+void
+DBMgr::GetDeviceMsgs( DevIDRelay relayID, StoredMsgProc proc, void* closure )
+{
+    char relayIDBuf[16];
+    snprintf( relayIDBuf, sizeof(relayIDBuf), "%d", relayID );
+    const char* values[] = { relayIDBuf };
+    if ( NULL == m_msgCache ) {
+        fetchMsgs( STMT_DEVICE_MSGS, 1, values, proc, closure );
+    } else {
+        resolveAddrs();
+        RWReadLock rrl( &m_flushLock );
+        vector<MsgCache::Msg> msgs;
+        m_msgCache->GetForDevice( relayID, msgs );
+        if ( fetchMsgs( STMT_DEVICE_MSGS, 1, values, proc, closure ) ) {
+            vector<MsgCache::Msg>::const_iterator iter;
+            for ( iter = msgs.begin(); iter != msgs.end(); ++iter ) {
+                if ( !(*proc)( closure, 0, iter->id, iter->token,
+                               &iter->bytes[0], iter->bytes.size() ) ) {
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void
+DBMgr::RecordSentAndRemove( const int* msgIDs, int nMsgIDs )
+{
+    if ( NULL != m_msgCache ) {
+        vector<MsgCache::Sent> sent;
+        m_msgCache->Remove( msgIDs, nMsgIDs, sent );
+        vector<MsgCache::Sent>::const_iterator iter;
+        for ( iter = sent.begin(); iter != sent.end(); ++iter ) {
+            RecordSent( iter->game.first.c_str(), iter->game.second,
+                        iter->nBytes );
+        }
+    }
+    removeMsgs( STMT_SENT_AND_REMOVE, msgIDs, nMsgIDs );
+}
+
+/* Run stmt on the ids that are the msgs table's.  Those from the cache are
+   negative. */
+void
+DBMgr::removeMsgs( const char* stmt, const int* msgIDs, int nMsgIDs )
+{
+    vector<int> tableIDs;
+    for ( int ii = 0; ii < nMsgIDs; ++ii ) {
+        if ( 0 < msgIDs[ii] ) {
+            tableIDs.push_back( msgIDs[ii] );
+        }
+    }
+
+    if ( 0 < tableIDs.size() ) {
         string ids;
-        vector<int>::const_iterator iter = idv.begin();
-        for ( ; ; ) {
-            string_printf( ids, "%d", *iter );
-            if ( ++iter == idv.end() ) {
+        formatIDArray( &tableIDs[0], tableIDs.size(), ids );
+        const char* values[] = { ids.c_str() };
+        logf( XW_LOGINFO, "%s(%s, %s)", __func__, stmt, ids.c_str() );
+
+        PGresult* result = execPrepared( stmt, 1, values, NULL, NULL, 0 );
+        if ( PGRES_COMMAND_OK != PQresultStatus(result) ) {
+            logf( XW_LOGERROR, "PQexec=>%s;%s",
+                  PQresStatus(PQresultStatus(result)), 
+                  PQresultErrorMessage(result) );
+        }
+        PQclear( result );
+    }
+}
+
+void
+DBMgr::formatGames( const char* const* connNames, const HostID* hids,
+                    int nGames, string& names, string& hidArray )
+{
+    formatNameArray( connNames, nGames, names );
+    hidArray.append( "{" );
+    for ( int ii = 0; ii < nGames; ++ii ) {
+        string_printf( hidArray, 0 == ii ? "%d" : ",%d", hids[ii] );
+    }
+    hidArray.append( "}" );
+}
+
+/* Run one of the statements whose columns are indx, id, token, msg, msg64,
+   msglen, with binary results, passing each row to proc until it returns
+   false.  Bodies stored as bytea are passed without a copy.  Returns true if
+   the query worked and proc saw every row. */
+bool
+DBMgr::fetchMsgs( const char* stmt, int nParams, const char* const* values,
+                  StoredMsgProc proc, void* closure )
+{
+    PGresult* result = execPrepared( stmt, nParams, values, NULL, NULL, 1 );
+    bool completed = PGRES_TUPLES_OK == PQresultStatus( result );
+    int nTuples = PQntuples( result );
+    logf( XW_LOGINFO, "%s(%s)=>%d msgs", __func__, stmt, nTuples );
+    for ( int ii = 0; ii < nTuples; ++ii ) {
+        unsigned char buf[MAX_MSG_LEN];
+        const unsigned char* msg;
+        size_t len;
+        if ( m_useB64 && !PQgetisnull( result, ii, 4 ) ) {
+            len = sizeof(buf);
+            decodeMessage( result, ii, true, 4, 3, buf, &len );
+            msg = buf;
+        } else {
+            msg = (const unsigned char*)PQgetvalue( result, ii, 3 );
+            len = PQgetlength( result, ii, 3 );
+        }
+        assert( 0 == getBinaryInt( result, ii, 5 )
+                || len == (size_t)getBinaryInt( result, ii, 5 ) );
+
+        if ( !(*proc)( closure, getBinaryInt( result, ii, 0 ),
+                       getBinaryInt( result, ii, 1 ),
+                       getBinaryInt( result, ii, 2 ), msg, len ) ) {
+            completed = false;
+            break;
+        }
+    }
+    PQclear( result );
+    return completed;
+}
+
+void
+DBMgr::startCache( void )
+{
+    /* Only these games need the table checked for their messages.  If we
+       can't tell, all do. */
+    PGresult* result = exec( "SELECT DISTINCT connname, hid FROM " MSGS_TABLE );
+    bool ok = PGRES_TUPLES_OK == PQresultStatus( result );
+    m_msgCache = new MsgCache( !ok );
+    int nTuples = ok ? PQntuples( result ) : 0;
+    for ( int ii = 0; ii < nTuples; ++ii ) {
+        m_msgCache->SetInDB( PQgetvalue( result, ii, 0 ),
+                             atoi( PQgetvalue( result, ii, 1 ) ), true );
+    }
+    PQclear( result );
+    logf( XW_LOGINFO, "%s: writing messages after %d ms; %d games in table",
+          __func__, m_msgCacheMS, nTuples );
+
+    pthread_t thread;
+    int err = pthread_create( &thread, NULL, flush_main, this );
+    assert( 0 == err );
+    pthread_detach( thread );
+}
+
+/* Messages are written when half of MSG_CACHE_MS old, every half of
+   MSG_CACHE_MS, so none is kept in memory only much longer than that.  One
+   being delivered waits, but never past twice MSG_CACHE_MS. */
+/* static */ void*
+DBMgr::flush_main( void* closure )
+{
+    blockSignals();
+
+    DBMgr* self = (DBMgr*)closure;
+    for ( ; ; ) {
+        usleep( self->m_msgCacheMS * 500 );
+        self->resolveAddrs();   /* so device lookups needn't wait */
+        self->FlushStoredMessages( false );
+    }
+    return NULL;
+}
+
+void
+DBMgr::FlushStoredMessages( bool all )
+{
+    if ( NULL != m_msgCache ) {
+        RWWriteLock rwl( &m_flushLock );
+        uint64_t now = now_ms();
+        uint64_t cutoff = all ? (uint64_t)-1 : now - (m_msgCacheMS / 2);
+        uint64_t hardCutoff = all ? (uint64_t)-1
+            : now > (uint64_t)(2 * m_msgCacheMS) ? now - (2 * m_msgCacheMS) : 0;
+        vector<MsgCache::Outgoing> msgs;
+        m_msgCache->TakeOldest( cutoff, cutoff, hardCutoff, msgs );
+
+        int nWritten = 0;
+        int nRejected = 0;
+        size_t first = 0;
+        while ( first < msgs.size() ) {
+            int nMsgs = msgs.size() - first;
+            if ( nMsgs > MAX_INSERT_ROWS ) {
+                nMsgs = MAX_INSERT_ROWS;
+            }
+            bool rejected;
+            int nRows = insertMsgs( &msgs[first], nMsgs, &rejected );
+            if ( 0 <= nRows ) {
+                nWritten += nRows;
+                first += nMsgs;
+                continue;
+            } else if ( !rejected ) {
+                break;          /* table unreachable: try again later */
+            }
+            /* Something in the batch can't be stored, ever.  Find it by
+               writing one at a time, and drop it rather than have it stop
+               every flush from here on. */
+            int ii;
+            for ( ii = 0; ii < nMsgs; ++ii ) {
+                const MsgCache::Outgoing& msg = msgs[first + ii];
+                nRows = insertMsgs( &msg, 1, &rejected );
+                if ( 0 <= nRows ) {
+                    nWritten += nRows;
+                } else if ( rejected ) {
+                    logf( XW_LOGERROR, "%s: dropping msg %d for %s/%d", 
+                          __func__, msg.id, msg.game.first.c_str(),
+                          msg.game.second );
+                    ++nRejected;
+                } else {
+                    break;
+                }
+            }
+            first += ii;
+            if ( ii < nMsgs ) {
                 break;
             }
-            string_printf( ids, "," );
         }
-        RemoveStoredMessages( ids );
+        if ( first < msgs.size() ) {
+            m_msgCache->PutBack( msgs, first ); /* try again later */
+        }
+        if ( 0 < msgs.size() ) {
+            logf( XW_LOGINFO, "%s: took %d; wrote %d, skipped %d (duplicate "
+                  "or no such game), dropped %d, put back %d", __func__,
+                  (int)msgs.size(), nWritten,
+                  (int)first - nWritten - nRejected, nRejected,
+                  (int)(msgs.size() - first) );
+        }
+        m_msgCache->LogCounts();
+    }
+}
+
+/* One INSERT for them all, each getting its game's devid and token as
+   StoreMessage() does.  The messages are binary parameters.  One the table
+   already has (or that's repeated in msgs) would break the table's
+   UNIQUE(connName, hid, msg), so is skipped, as is one for a game that's
+   gone.  Returns how many were written, or -1 on error, setting *rejected
+   if retrying wouldn't help. */
+int
+DBMgr::insertMsgs( const MsgCache::Outgoing* msgs, int nMsgs, bool* rejected )
+{
+    string query( "INSERT INTO " MSGS_TABLE
+                  " (connname, hid, devid, token, msg, msglen)"
+                  " SELECT v.c, v.h, devids[v.h], tokens[v.h], v.m, v.l"
+                  " FROM (SELECT DISTINCT ON (c, h, m) * FROM (VALUES " );
+    vector<string> ints( 2 * nMsgs );
+    vector<const char*> values;
+    vector<int> lengths;
+    vector<int> formats;
+    for ( int ii = 0; ii < nMsgs; ++ii ) {
+        const MsgCache::Outgoing& msg = msgs[ii];
+        int param = 1 + (4 * ii);
+        string_printf( query, "%s($%d::varchar,$%d::int,$%d::bytea,$%d::int,"
+                       "%d)", 0 == ii ? "" : ",", param, param + 1,
+                       param + 2, param + 3, ii );
+        string_printf( ints[2*ii], "%d", msg.game.second );
+        string_printf( ints[(2*ii)+1], "%d", (int)msg.bytes.size() );
+
+        values.push_back( msg.game.first.c_str() );
+        values.push_back( ints[2*ii].c_str() );
+        values.push_back( msg.bytes.empty() ? ""
+                          : (const char*)&msg.bytes[0] );
+        values.push_back( ints[(2*ii)+1].c_str() );
+        lengths.push_back( 0 );
+        lengths.push_back( 0 );
+        lengths.push_back( msg.bytes.size() );
+        lengths.push_back( 0 );
+        formats.push_back( 0 );
+        formats.push_back( 0 );
+        formats.push_back( 1 );
+        formats.push_back( 0 );
+    }
+    query.append( ") AS d(c, h, m, l, o) ORDER BY c, h, m, o) AS v, "
+                  GAMES_TABLE " WHERE connname = v.c AND NOT EXISTS"
+                  " (SELECT 1 FROM " MSGS_TABLE " WHERE " MSGS_TABLE
+                  ".connname = v.c AND " MSGS_TABLE ".hid = v.h AND "
+                  MSGS_TABLE ".msg = v.m) ORDER BY v.o" );
+
+    PGconn* conn = checkout();
+    PGresult* result = PQexecParams( conn, query.c_str(), values.size(), NULL,
+                                     &values[0], &lengths[0], &formats[0], 0 );
+    checkin( conn );
+    int nWritten = -1;
+    *rejected = false;
+    if ( PGRES_COMMAND_OK == PQresultStatus( result ) ) {
+        nWritten = atoi( PQcmdTuples( result ) );
+    } else {
+        /* Classes 22 and 23 are bad data and broken constraints; anything
+           else (a lost connection, say) might go away */
+        const char* state = PQresultErrorField( result, PG_DIAG_SQLSTATE );
+        *rejected = NULL != state && '2' == state[0]
+            && ( '2' == state[1] || '3' == state[1] );
+        logf( XW_LOGERROR, "%s: PQexec=>%s;%s", __func__,
+              PQresStatus(PQresultStatus(result)),
+              PQresultErrorMessage(result) );
+    }
+    PQclear( result );
+    return nWritten;
+}
+
+/* Look up in one query the devid and token, and whether it's dead, for each
+   cached game that doesn't have them */
+void
+DBMgr::resolveAddrs( void )
+{
+    vector<MsgCache::GameKey> games;
+    m_msgCache->Unresolved( games );
+    if ( 0 < games.size() ) {
+        vector<const char*> connNames;
+        vector<HostID> hids;
+        vector<MsgCache::GameKey>::const_iterator iter;
+        for ( iter = games.begin(); iter != games.end(); ++iter ) {
+            connNames.push_back( iter->first.c_str() );
+            hids.push_back( iter->second );
+        }
+        string names;
+        string hidArray;
+        formatGames( &connNames[0], &hids[0], games.size(), names, hidArray );
+        const char* values[] = { names.c_str(), hidArray.c_str() };
+
+        PGresult* result = execPrepared( STMT_GAME_ADDRS, 2, values, NULL,
+                                         NULL, 0 );
+        if ( PGRES_TUPLES_OK == PQresultStatus( result ) ) {
+            vector<bool> found( games.size() );
+            int nTuples = PQntuples( result );
+            for ( int ii = 0; ii < nTuples; ++ii ) {
+                int indx = atoi( PQgetvalue( result, ii, 0 ) );
+                assert( 1 <= indx && indx <= (int)games.size() );
+                found[indx-1] = true;
+                m_msgCache->SetAddr( games[indx-1],
+                                     atoi( PQgetvalue( result, ii, 1 ) ),
+                                     strtoul( PQgetvalue( result, ii, 2 ),
+                                              NULL, 10 ),
+                                     't' == PQgetvalue( result, ii, 3 )[0] );
+            }
+            /* No such game: there's no device to deliver to */
+            for ( size_t ii = 0; ii < games.size(); ++ii ) {
+                if ( !found[ii] ) {
+                    m_msgCache->SetAddr( games[ii], DEVID_NONE, 0, true );
+                }
+            }
+        } else {
+            logf( XW_LOGERROR, "%s: PQexec=>%s;%s", __func__,
+                  PQresStatus(PQresultStatus(result)),
+                  PQresultErrorMessage(result) );
+        }
+        PQclear( result );
     }
 }
 
@@ -1024,7 +1628,7 @@ DBMgr::getCountWhere( const char* table, string& test )
     string query;
     string_printf( query, "SELECT count(*) FROM %s WHERE %s", table, test.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     assert( 1 == PQntuples( result ) );
     int count = atoi( PQgetvalue( result, 0, 0 ) );
     PQclear( result );
@@ -1066,27 +1670,176 @@ here_less_seed( const char* seeds, int sumPerDevice, unsigned short seed )
 }
 
 static void
-destr_function( void* conn )
+formatIDArray( const int* msgIDs, int nMsgIDs, string& out )
 {
-    logf( XW_LOGINFO, "%s()", __func__ );
-    PGconn* pgconn = (PGconn*)conn;
-    PQfinish( pgconn );
+    out.append( "{" );
+    for ( int ii = 0; ii < nMsgIDs; ++ii ) {
+        string_printf( out, 0 == ii ? "%d" : ",%d", msgIDs[ii] );
+    }
+    out.append( "}" );
 }
 
-PGconn* 
-DBMgr::getThreadConn( void )
+/* As an array literal: quoted, with quotes and backslashes escaped */
+static void
+formatNameArray( const char* const* names, int nNames, string& out )
 {
-    PGconn* conn = (PGconn*)pthread_getspecific( m_conn_key );
+    out.append( "{" );
+    for ( int ii = 0; ii < nNames; ++ii ) {
+        out.append( 0 == ii ? "\"" : ",\"" );
+        for ( const char* cp = names[ii]; '\0' != *cp; ++cp ) {
+            if ( '"' == *cp || '\\' == *cp ) {
+                out.append( 1, '\\' );
+            }
+            out.append( 1, *cp );
+        }
+        out.append( "\"" );
+    }
+    out.append( "}" );
+}
+
+/* For binary-format results only, where an int4 is four bytes in network
+   order */
+static int
+getBinaryInt( const PGresult* result, int row, int col )
+{
+    uint32_t val = 0;
+    if ( !PQgetisnull( result, row, col ) ) {
+        assert( sizeof(val) == PQgetlength( result, row, col ) );
+        memcpy( &val, PQgetvalue( result, row, col ), sizeof(val) );
+        val = ntohl( val );
+    }
+    return (int)val;
+}
 
-    if ( NULL == conn ) {
-        char buf[128];
-        int len = snprintf( buf, sizeof(buf), "dbname = " );
-        if ( !RelayConfigs::GetConfigs()->
-             GetValueFor( "DB_NAME", &buf[len], sizeof(buf)-len ) ) {
-            assert( 0 );
+static void
+prepare_statements( PGconn* conn )
+{
+    for ( size_t ii = 0; ii < sizeof(s_stmts)/sizeof(s_stmts[0]); ++ii ) {
+        PGresult* result = PQprepare( conn, s_stmts[ii].name,
+                                      s_stmts[ii].sql, 0, NULL );
+        if ( PGRES_COMMAND_OK != PQresultStatus(result) ) {
+            logf( XW_LOGERROR, "%s(%s)=>%s;%s", __func__, s_stmts[ii].name,
+                  PQresStatus(PQresultStatus(result)), 
+                  PQresultErrorMessage(result) );
         }
-        conn = PQconnectdb( buf );
-        pthread_setspecific( m_conn_key, conn );
+        PQclear( result );
+    }
+}
+
+PGconn*
+DBMgr::openConn( void )
+{
+    char buf[128];
+    int len = snprintf( buf, sizeof(buf), "dbname = " );
+    if ( !RelayConfigs::GetConfigs()->
+         GetValueFor( "DB_NAME", &buf[len], sizeof(buf)-len ) ) {
+        assert( 0 );
+    }
+    PGconn* conn = PQconnectdb( buf );
+    if ( CONNECTION_OK == PQstatus( conn ) ) {
+        prepare_statements( conn );
+    } else {
+        logf( XW_LOGERROR, "%s: PQconnectdb=>%s", __func__,
+              PQerrorMessage( conn ) );
     }
     return conn;
 }
+
+/* Take an idle connection, open one if the pool isn't full yet, or wait
+   for somebody to check one in */
+PGconn*
+DBMgr::checkout( void )
+{
+    PGconn* conn = NULL;
+    bool doOpen = false;
+    {
+        MutexLock ml( &m_poolMutex );
+        ++m_nCheckouts;
+        if ( m_idleConns.empty() && m_nConns >= m_poolSize ) {
+            ++m_nWaits;
+            struct timeval start, end;
+            gettimeofday( &start, NULL );
+            while ( m_idleConns.empty() && m_nConns >= m_poolSize ) {
+                pthread_cond_wait( &m_poolCondVar, &m_poolMutex );
+            }
+            gettimeofday( &end, NULL );
+            m_waitMillis += ((end.tv_sec - start.tv_sec) * 1000)
+                + ((end.tv_usec - start.tv_usec) / 1000);
+        }
+
+        if ( !m_idleConns.empty() ) {
+            conn = m_idleConns.back();
+            m_idleConns.pop_back();
+        } else {
+            ++m_nConns;
+            doOpen = true;
+        }
+
+        int nBusy = m_nConns - m_idleConns.size();
+        if ( nBusy > m_maxBusy ) {
+            m_maxBusy = nBusy;
+        }
+        if ( 0 == m_nCheckouts % METRICS_INTERVAL ) {
+            logf( XW_LOGINFO, "%s: %d checkouts; %d waited, %lld ms total; "
+                  "max %d of %d connections busy", __func__, m_nCheckouts,
+                  m_nWaits, (long long)m_waitMillis, m_maxBusy, m_poolSize );
+        }
+    }
+
+    if ( doOpen ) {
+        conn = openConn();
+    }
+    return conn;
+}
+
+void
+DBMgr::checkin( PGconn* conn )
+{
+    if ( NULL == conn ) {       /* PQconnectdb failed to allocate */
+        MutexLock ml( &m_poolMutex );
+        --m_nConns;
+        pthread_cond_signal( &m_poolCondVar );
+    } else {
+        if ( CONNECTION_BAD == PQstatus( conn ) ) {
+            logf( XW_LOGERROR, "%s: resetting bad connection", __func__ );
+            PQreset( conn );
+            if ( CONNECTION_OK == PQstatus( conn ) ) {
+                prepare_statements( conn );
+            }
+        }
+        MutexLock ml( &m_poolMutex );
+        m_idleConns.push_back( conn );
+        pthread_cond_signal( &m_poolCondVar );
+    }
+}
+
+PGresult*
+DBMgr::exec( const char* query )
+{
+    PGconn* conn = checkout();
+    PGresult* result = PQexec( conn, query );
+    checkin( conn );
+    return result;
+}
+
+PGresult*
+DBMgr::execParams( const char* command, int nParams,
+                   const char* const* values )
+{
+    PGconn* conn = checkout();
+    PGresult* result = PQexecParams( conn, command, nParams, NULL, values,
+                                     NULL, NULL, 0 );
+    checkin( conn );
+    return result;
+}
+
+PGresult*
+DBMgr::execPrepared( const char* stmt, int nParams, const char* const* values,
+                     const int* lengths, const int* formats, int resultFormat )
+{
+    PGconn* conn = checkout();
+    PGresult* result = PQexecPrepared( conn, stmt, nParams, values, lengths,
+                                       formats, resultFormat );
+    checkin( conn );
+    return result;
+}
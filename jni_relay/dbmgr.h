@@ -23,10 +23,15 @@
 #define _DBMGR_H_
 
 #include <string>
+#include <vector>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
 
 #include "xwrelay.h"
 #include "xwrelay_priv.h"
 #include "devid.h"
+#include "msgcache.h"
 #include <libpq-fe.h>
 
 using namespace std;
@@ -77,8 +82,10 @@ class DBMgr {
     bool HaveDevice( const char* const connName, HostID id, int seed );
     bool AddCID( const char* const connName, CookieID cid );
     void ClearCID( const char* connName );
+    /* Totals are kept in memory and written every SENT_FLUSH_MS by another
+       thread, or by FlushSent() */
     void RecordSent( const char* const connName, HostID hid, int nBytes );
-    void RecordSent( const int* msgID, int nMsgIDs );
+    void FlushSent( void );
     void RecordAddress( const char* const connName, HostID hid, 
                         const AddrInfo* addr );
     void GetPlayerCounts( const char* const connName, int* nTotal,
@@ -96,45 +103,122 @@ class DBMgr {
     bool TokenFor( const char* const connName, int hid, DevIDRelay* devid,
                    AddrInfo::ClientToken* token );
 
-    /* Return number of messages pending for connName:hostid pair passed in */
-    int PendingMsgCount( const char* const connName, int hid );
-
     /* message storage -- different DB */
     int CountStoredMessages( const char* const connName );
     int CountStoredMessages( const char* const connName, int hid );
     int CountStoredMessages( DevIDRelay relayID );
     void StoreMessage( const char* const connName, int hid, 
                        const unsigned char* const buf, int len );
-    void GetStoredMessageIDs( DevIDRelay relayID, vector<int>& ids );
 
     bool GetStoredMessage( const char* const connName, int hid, 
                            unsigned char* buf, size_t* buflen, int* msgID );
     bool GetNthStoredMessage( const char* const connName, int hid, int nn,
                               unsigned char* buf, size_t* buflen, int* msgID );
-    bool GetStoredMessage( int msgID, unsigned char* buf, size_t* buflen, 
-                           AddrInfo::ClientToken* token );
 
     void RemoveStoredMessages( const int* msgID, int nMsgIDs );
     void RemoveStoredMessages( vector<int>& ids );
 
+    /* Bulk fetches of stored messages, each a single query.  proc gets
+       them oldest first for each game, the games in the order passed in,
+       and indx is the 1-based position of the message's game (always 0 for
+       GetDeviceMsgs).  buf is only good until proc returns, and proc
+       returns false to stop early. */
+    typedef bool (*StoredMsgProc)( void* closure, int indx, int msgID,
+                                   AddrInfo::ClientToken token,
+                                   const unsigned char* buf, size_t len );
+    void GetPendingMsgs( const char* const* connNames, const HostID* hids,
+                         int nGames, StoredMsgProc proc, void* closure );
+    void GetDeviceMsgs( DevIDRelay relayID, StoredMsgProc proc,
+                        void* closure );
+    /* Number pending for each connName/hid pair */
+    void GetPendingMsgCounts( const char* const* connNames,
+                              const HostID* hids, int nGames, int counts[] );
+
+    /* RecordSent() and RemoveStoredMessages() in one statement */
+    void RecordSentAndRemove( const int* msgIDs, int nMsgIDs );
+
+    /* With MSG_CACHE_MS set, StoreMessage() keeps messages in memory and
+       they're written to the msgs table MSG_CACHE_MS or so later unless
+       delivered first.  This writes out the due ones now, or all of them,
+       as before exiting. */
+    void FlushStoredMessages( bool all );
+
  private:
     DBMgr();
     bool execSql( const string& query );
     bool execSql( const char* const query ); /* no-results query */
     void readArray( const char* const connName, int arr[] );
-    DevIDRelay getDevID( const char* connName, int hid );
     DevIDRelay getDevID( const DevID* devID );
     int getCountWhere( const char* table, string& test );
-    void RemoveStoredMessages( string& msgIDs );
-    void decodeMessage( PGresult* result, bool useB64, int b64indx, 
+    void decodeMessage( PGresult* result, int row, bool useB64, int b64indx,
                         int byteaIndex, unsigned char* buf, size_t* buflen );
+    void formatGames( const char* const* connNames, const HostID* hids,
+                      int nGames, string& names, string& hidArray );
+    bool fetchMsgs( const char* stmt, int nParams, const char* const* values,
+                    StoredMsgProc proc, void* closure );
+    bool getNthMsg( const char* const connName, int hid, int nn,
+                    unsigned char* buf, size_t* buflen, int* msgID,
+                    bool* queryOK );
+    void removeMsgs( const char* stmt, const int* msgIDs, int nMsgIDs );
+
+    bool writeSent( const char* const* connNames, const HostID* hids,
+                    const int* nBytes, int nGames );
+    static void* sent_main( void* closure );
+
+    void startCache( void );
+    static void* flush_main( void* closure );
+    int insertMsgs( const MsgCache::Outgoing* msgs, int nMsgs,
+                    bool* rejected );
+    void resolveAddrs( void );
+
+    /* Each runs on a connection checked out for just that call, so don't
+       hold one while calling another */
+    PGresult* exec( const char* query );
+    PGresult* execParams( const char* command, int nParams,
+                          const char* const* values );
+    PGresult* execPrepared( const char* stmt, int nParams,
+                            const char* const* values, const int* lengths,
+                            const int* formats, int resultFormat );
+
+    PGconn* openConn( void );
+    PGconn* checkout( void );
+    void checkin( PGconn* conn );
 
-    PGconn* getThreadConn( void );
-
-    void conn_key_alloc();
-    pthread_key_t m_conn_key;
     bool m_useB64;
 
+    /* RecordSent() totals not yet written, by game */
+    typedef struct {
+        int nBytes;
+        int nMsgs;
+    } SentCounts;
+    typedef pair<string, HostID> SentKey;
+    typedef map<SentKey, SentCounts> SentMap;
+    SentMap m_sent;
+    pthread_mutex_t m_sentMutex;
+    int m_sentFlushMS;
+
+    /* NULL unless MSG_CACHE_MS is set.  Readers that consult both the cache
+       and the msgs table hold m_flushLock's read lock so that messages
+       aren't moving between them meanwhile. */
+    MsgCache* m_msgCache;
+    int m_msgCacheMS;
+    pthread_rwlock_t m_flushLock;
+
+    /* Connections shared by all threads, opened as needed up to
+       DB_POOL_SIZE, each with the hot statements prepared.  A thread that
+       finds none idle waits. */
+    vector<PGconn*> m_idleConns;
+    int m_poolSize;
+    int m_nConns;               /* idle or checked out */
+    pthread_mutex_t m_poolMutex;
+    pthread_cond_t m_poolCondVar;
+
+    /* checkout metrics, logged every so often */
+    int m_nCheckouts;
+    int m_nWaits;
+    uint64_t m_waitMillis;
+    int m_maxBusy;
+
 }; /* DBMgr */
 
 
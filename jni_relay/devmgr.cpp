@@ -18,9 +18,17 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
+#include <stdlib.h>
+#include <sched.h>
+
 #include "devmgr.h"
+#include "configs.h"
 #include "mlock.h"
 
+#define MIN_SLOTS 1024
+#define DEFAULT_MAX_AGE (24 * 60 * 60)
+#define SWEEP_SECONDS 60
+
 static DevMgr* s_instance = NULL;
 
 /* static */ DevMgr*
@@ -32,24 +40,224 @@ DevMgr::Get()
     return s_instance;
 } /* Get */
 
+DevMgr::DevMgr()
+    : m_table(newTable(MIN_SLOTS))
+    , m_readers(NULL)
+    , m_epoch(1)
+    , m_sweptAt(time(NULL))
+{
+    pthread_mutex_init( &m_writeMutex, NULL );
+    int maxAge;
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "DEVADDR_MAX_AGE",
+                                                   &maxAge )
+         || 0 >= maxAge ) {
+        maxAge = DEFAULT_MAX_AGE;
+    }
+    m_maxAge = maxAge;
+}
+
+static unsigned int
+hash_devid( DevIDRelay devid )
+{
+    /* ids are random, but may not be while testing */
+    uint32_t hash = devid;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/* Big enough to be at most a quarter full */
+static int
+size_for( int nLive )
+{
+    int nSlots = MIN_SLOTS;
+    while ( nSlots < 4 * nLive ) {
+        nSlots *= 2;
+    }
+    return nSlots;
+}
+
+/* static */ DevMgr::Table*
+DevMgr::newTable( int nSlots )
+{
+    Table* table = new Table;
+    table->nSlots = nSlots;
+    table->nUsed = 0;
+    table->nLive = 0;
+    table->slots = (Slot*)calloc( nSlots, sizeof(table->slots[0]) );
+    assert( SLOT_EMPTY == 0 );
+    return table;
+}
+
+/* The live slot for devid, else (if forAdd) the first it could go in, else
+   -1.  Writers only. */
+/* static */ int
+DevMgr::findSlot( const Table* table, DevIDRelay devid, bool forAdd )
+{
+    int found = -1;
+    int mask = table->nSlots - 1;
+    int indx = hash_devid( devid ) & mask;
+    for ( int ii = 0; ii < table->nSlots; ++ii, indx = (indx + 1) & mask ) {
+        const Slot* slot = &table->slots[indx];
+        if ( SLOT_LIVE == slot->state ) {
+            if ( devid == slot->devid ) {
+                found = indx;
+                break;
+            }
+        } else if ( !forAdd ) {
+            if ( SLOT_EMPTY == slot->state ) {
+                break;
+            }
+        } else if ( SLOT_DEAD == slot->state ) {
+            if ( -1 == found ) {
+                found = indx;   /* unless devid's further on */
+            }
+        } else {                /* SLOT_EMPTY */
+            if ( -1 == found ) {
+                found = indx;
+            }
+            break;
+        }
+    }
+    return found;
+}
+
+/* static */ void
+DevMgr::writeSlot( Slot* slot, int state, DevIDRelay devid,
+                   const AddrInfo::AddrUnion* addr, time_t added )
+{
+    ++slot->seq;                /* odd: readers will wait */
+    __sync_synchronize();
+    slot->state = state;
+    slot->devid = devid;
+    slot->addr = *addr;
+    slot->added = added;
+    __sync_synchronize();
+    ++slot->seq;
+}
+
+static __thread void* t_reader = NULL;
+
+DevMgr::Reader*
+DevMgr::getReader()
+{
+    Reader* reader = (Reader*)t_reader;
+    if ( NULL == reader ) {
+        reader = new Reader;
+        reader->epoch = 0;
+        do {
+            reader->next = m_readers;
+        } while ( !__sync_bool_compare_and_swap( &m_readers, reader->next,
+                                                 reader ) );
+        t_reader = reader;
+    }
+    return reader;
+}
+
+/* Wait until no reader can still be using a table that's been replaced.
+   Call with m_writeMutex held, after m_table's changed. */
+void
+DevMgr::waitForReaders()
+{
+    __sync_synchronize();
+    unsigned int epoch = __sync_add_and_fetch( &m_epoch, 1 );
+    for ( Reader* reader = m_readers; !!reader; reader = reader->next ) {
+        for ( ; ; ) {
+            unsigned int readerEpoch = reader->epoch;
+            if ( 0 == readerEpoch || readerEpoch >= epoch ) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+/* Move the live entries to a new table of nSlots.  Call with m_writeMutex
+   held. */
+void
+DevMgr::resize( int nSlots )
+{
+    Table* oldTable = m_table;
+    Table* table = newTable( nSlots );
+    for ( int ii = 0; ii < oldTable->nSlots; ++ii ) {
+        const Slot* slot = &oldTable->slots[ii];
+        if ( SLOT_LIVE == slot->state ) {
+            int indx = findSlot( table, slot->devid, true );
+            table->slots[indx] = *slot;
+            table->slots[indx].seq = 0;
+            ++table->nUsed;
+            ++table->nLive;
+        }
+    }
+    logf( XW_LOGINFO, "%s: %d slots (%d used) => %d slots for %d entries",
+          __func__, oldTable->nSlots, oldTable->nUsed, nSlots,
+          table->nLive );
+
+    __sync_synchronize();       /* table's filled before it's seen */
+    m_table = table;
+    waitForReaders();
+    free( oldTable->slots );
+    delete oldTable;
+}
+
+/* Drop addresses not refreshed in m_maxAge, shrinking the table if that
+   leaves it mostly empty.  Call with m_writeMutex held. */
+void
+DevMgr::sweep( time_t now )
+{
+    m_sweptAt = now;
+    Table* table = m_table;
+    int nDropped = 0;
+    for ( int ii = 0; ii < table->nSlots; ++ii ) {
+        Slot* slot = &table->slots[ii];
+        if ( SLOT_LIVE == slot->state && now - slot->added > m_maxAge ) {
+            writeSlot( slot, SLOT_DEAD, slot->devid, &slot->addr,
+                       slot->added );
+            --table->nLive;
+            ++nDropped;
+        }
+    }
+    if ( 0 < nDropped ) {
+        logf( XW_LOGINFO, "%s: dropped %d addresses older than %d seconds; "
+              "%d remain", __func__, nDropped, (int)m_maxAge, table->nLive );
+        int nSlots = size_for( table->nLive );
+        if ( nSlots < table->nSlots
+             || 4 * (table->nUsed - table->nLive) > table->nSlots ) {
+            resize( nSlots );
+        }
+    }
+}
+
 void
 DevMgr::Remember( DevIDRelay devid, const AddrInfo::AddrUnion* saddr )
 {
     logf( XW_LOGINFO, "%s(devid=%d)", __func__, devid );
     time_t now = time( NULL );
-    UDPAddrRec rec( saddr, now );
 
-    MutexLock ml( &m_mapLock );
+    MutexLock ml( &m_writeMutex );
+    if ( now - m_sweptAt >= SWEEP_SECONDS ) {
+        sweep( now );
+    }
 
-    // C++'s insert doesn't replace, but the result tells whether the key was
-    // already there and provides an iterator via which it can be updated
-    pair<map<DevIDRelay,UDPAddrRec>::iterator, bool> result = 
-        m_devAddrMap.insert( pair<DevIDRelay,UDPAddrRec>( devid, rec ) );
-    if ( !result.second ) {
-        result.first->second = rec;
+    Table* table = m_table;
+    int indx = findSlot( table, devid, true );
+    assert( 0 <= indx );        /* never more than half used */
+    Slot* slot = &table->slots[indx];
+    if ( SLOT_LIVE != slot->state ) {
+        if ( SLOT_EMPTY == slot->state ) {
+            ++table->nUsed;
+        }
+        ++table->nLive;
     }
+    writeSlot( slot, SLOT_LIVE, devid, saddr, now );
 
-    logf( XW_LOGINFO, "dev->addr map now contains %d entries", m_devAddrMap.size() );
+    if ( 2 * table->nUsed > table->nSlots ) {
+        resize( size_for( table->nLive ) );
+    }
+
+    logf( XW_LOGINFO, "dev->addr table now contains %d entries",
+          m_table->nLive );
 }
 
 void
@@ -58,19 +266,51 @@ DevMgr::Remember( DevIDRelay devid, const AddrInfo* addr )
     Remember( devid, addr->saddr() );
 }
 
-const AddrInfo::AddrUnion* 
-DevMgr::get( DevIDRelay devid )
+bool
+DevMgr::get( DevIDRelay devid, AddrInfo::AddrUnion* saddr )
 {
-    const AddrInfo::AddrUnion* result = NULL;
-    MutexLock ml( &m_mapLock );
-    map<DevIDRelay,UDPAddrRec>::const_iterator iter;
-    iter = m_devAddrMap.find( devid );
-    if ( m_devAddrMap.end() != iter ) {
-        result = &iter->second.m_addr;
-        logf( XW_LOGINFO, "%s: found addr for %.8x; is %d seconds old", __func__,
-              devid, time(NULL) - iter->second.m_added );
+    bool found = false;
+    time_t added = 0;
+    Reader* reader = getReader();
+    reader->epoch = m_epoch;
+    __sync_synchronize();       /* announce before looking at m_table */
+
+    const Table* table = m_table;
+    int mask = table->nSlots - 1;
+    int indx = hash_devid( devid ) & mask;
+    for ( int ii = 0; ii < table->nSlots; ++ii, indx = (indx + 1) & mask ) {
+        const Slot* slot = &table->slots[indx];
+        int state;
+        for ( ; ; ) {
+            uint32_t seq = slot->seq;
+            if ( 0 != (seq & 1) ) {
+                continue;       /* being written */
+            }
+            __sync_synchronize();
+            state = slot->state;
+            found = SLOT_LIVE == state && devid == slot->devid;
+            if ( found ) {
+                *saddr = slot->addr;
+                added = slot->added;
+            }
+            __sync_synchronize();
+            if ( seq == slot->seq ) {
+                break;
+            }
+        }
+        if ( found || SLOT_EMPTY == state ) {
+            break;
+        }
     }
-    logf( XW_LOGINFO, "%s(devid=%d)=>%p", __func__, devid, result );
-    return result;
-}
 
+    __sync_synchronize();
+    reader->epoch = 0;
+
+    if ( found ) {
+        logf( XW_LOGINFO, "%s: found addr for %.8x; is %d seconds old",
+              __func__, devid, (int)(time(NULL) - added) );
+    }
+    logf( XW_LOGINFO, "%s(devid=%d)=>%s", __func__, devid,
+          found ? "true" : "false" );
+    return found;
+}
@@ -22,36 +22,70 @@
 #define _DEVMGR_H_
 
 #include <pthread.h>
+#include <time.h>
 
 #include "xwrelay_priv.h"
 #include "addrinfo.h"
 
 using namespace std;
 
+/* Where each device was last heard from, for sending it UDP.  Lookups take
+ * no lock: the table's open-addressed, each slot a seqlock readers retry
+ * on, and a table replaced when it fills is freed only once no reader can
+ * still be in it.  Writers take m_writeMutex.  Addresses not refreshed for
+ * DEVADDR_MAX_AGE seconds are dropped.
+ */
 class DevMgr {
  public:
     static DevMgr* Get();
     void Remember( DevIDRelay devid, const AddrInfo::AddrUnion* saddr );
     void Remember( DevIDRelay devid, const AddrInfo* addr );
-    const AddrInfo::AddrUnion* get( DevIDRelay devid );
+    bool get( DevIDRelay devid, AddrInfo::AddrUnion* saddr );
 
  private:
-    DevMgr() { pthread_mutex_init( &m_mapLock, NULL ); }
+    DevMgr();
     /* destructor's never called.... 
-    ~DevMgr() { pthread_mutex_destroy( &m_mapLock ); }
+    ~DevMgr() { pthread_mutex_destroy( &m_writeMutex ); }
     */
 
-    class UDPAddrRec {
-    public:
-        UDPAddrRec( const AddrInfo::AddrUnion* addr, time_t tim ) {
-            m_addr = *addr; m_added = tim;
-        }
-        AddrInfo::AddrUnion m_addr;
-        time_t m_added;
-    };
-
-    map<DevIDRelay,UDPAddrRec> m_devAddrMap;
-    pthread_mutex_t m_mapLock;
+    typedef enum { SLOT_EMPTY, SLOT_LIVE, SLOT_DEAD } SlotState;
+
+    typedef struct {
+        volatile uint32_t seq;  /* odd while being written */
+        volatile int state;     /* SlotState */
+        DevIDRelay devid;
+        AddrInfo::AddrUnion addr;
+        time_t added;
+    } Slot;
+
+    typedef struct {
+        int nSlots;             /* a power of two */
+        int nUsed;              /* live and dead */
+        int nLive;
+        Slot* slots;
+    } Table;
+
+    /* One per thread that's looked up, never freed */
+    typedef struct _Reader {
+        struct _Reader* next;
+        volatile unsigned int epoch; /* 0 when not reading */
+    } Reader;
+
+    static Table* newTable( int nSlots );
+    static int findSlot( const Table* table, DevIDRelay devid, bool forAdd );
+    static void writeSlot( Slot* slot, int state, DevIDRelay devid,
+                           const AddrInfo::AddrUnion* addr, time_t added );
+    Reader* getReader();
+    void resize( int nSlots );
+    void waitForReaders();
+    void sweep( time_t now );
+
+    Table* volatile m_table;
+    Reader* volatile m_readers;
+    volatile unsigned int m_epoch;
+    pthread_mutex_t m_writeMutex;
+    time_t m_maxAge;
+    time_t m_sweptAt;
 };
 
 #endif
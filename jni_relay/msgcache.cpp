@@ -0,0 +1,337 @@
+/* -*- compile-command: "make -k -j3"; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <time.h>
+
+#include "msgcache.h"
+#include "mlock.h"
+
+MsgCache::MsgCache( bool inDB )
+    : m_nextID(-1)
+    , m_inDB(inDB)
+    , m_nStored(0)
+    , m_nDelivered(0)
+    , m_nWritten(0)
+{
+    pthread_mutex_init( &m_mutex, NULL );
+}
+
+MsgCache::~MsgCache()
+{
+    pthread_mutex_destroy( &m_mutex );
+}
+
+/* Call with m_mutex held */
+MsgCache::GameMap::iterator
+MsgCache::getGame( const GameKey& key )
+{
+    GameMap::iterator iter = m_games.find( key );
+    if ( m_games.end() == iter ) {
+        Game game;
+        game.inDB = m_inDB;
+        game.haveAddr = false;
+        game.devid = 0;
+        game.token = 0;
+        game.dead = false;
+        iter = m_games.insert( GameMap::value_type( key, game ) ).first;
+    }
+    return iter;
+}
+
+/* Forget a game once there's nothing to know about it.  Call with m_mutex
+   held */
+void
+MsgCache::dropIfIdle( GameMap::iterator iter )
+{
+    if ( iter->second.entries.empty() && !iter->second.inDB ) {
+        m_games.erase( iter );
+    }
+}
+
+int
+MsgCache::Store( const char* connName, HostID hid, const unsigned char* buf,
+                 size_t len )
+{
+    MutexLock ml( &m_mutex );
+    GameKey key( connName, hid );
+    Game& game = getGame( key )->second;
+
+    Entry entry;
+    entry.id = m_nextID;
+    entry.storedAt = now_ms();
+    entry.claimedAt = 0;
+    game.entries.push_back( entry );
+    game.entries.back().bytes.assign( buf, buf + len );
+
+    m_ids[entry.id] = key;
+    m_nextID = INT_MIN == m_nextID ? -1 : m_nextID - 1;
+    ++m_nStored;
+    return entry.id;
+}
+
+bool
+MsgCache::Get( const char* connName, HostID hid, vector<Msg>& out,
+               int maxMsgs )
+{
+    MutexLock ml( &m_mutex );
+    bool inDB = m_inDB;
+    GameMap::iterator iter = m_games.find( GameKey( connName, hid ) );
+    if ( m_games.end() != iter ) {
+        Game& game = iter->second;
+        inDB = game.inDB;
+        uint64_t claimedAt = now_ms();
+        deque<Entry>::iterator entry;
+        for ( entry = game.entries.begin();
+              entry != game.entries.end() && 0 != maxMsgs--; ++entry ) {
+            Msg msg;
+            msg.id = entry->id;
+            msg.token = 0;
+            out.push_back( msg );
+            out.back().bytes = entry->bytes;
+            entry->claimedAt = claimedAt;
+        }
+    }
+    return inDB;
+}
+
+bool
+MsgCache::InDB( const char* connName, HostID hid )
+{
+    MutexLock ml( &m_mutex );
+    GameMap::iterator iter = m_games.find( GameKey( connName, hid ) );
+    return m_games.end() == iter ? m_inDB : iter->second.inDB;
+}
+
+void
+MsgCache::SetInDB( const char* connName, HostID hid, bool inDB )
+{
+    MutexLock ml( &m_mutex );
+    GameMap::iterator iter = getGame( GameKey( connName, hid ) );
+    iter->second.inDB = inDB;
+    dropIfIdle( iter );
+}
+
+int
+MsgCache::Count( const char* connName, int hid, bool* inDB )
+{
+    int count = 0;
+    MutexLock ml( &m_mutex );
+    if ( -1 == hid ) {
+        /* Games not seen here don't count for anything but being in the
+           table, so be conservative unless all such are known */
+        *inDB = m_inDB;
+        GameMap::iterator iter = m_games.lower_bound( GameKey( connName, 0 ) );
+        for ( ; m_games.end() != iter && iter->first.first == connName;
+              ++iter ) {
+            count += iter->second.entries.size();
+            *inDB = *inDB || iter->second.inDB;
+        }
+    } else {
+        GameMap::iterator iter = m_games.find( GameKey( connName, hid ) );
+        if ( m_games.end() == iter ) {
+            *inDB = m_inDB;
+        } else {
+            count = iter->second.entries.size();
+            *inDB = iter->second.inDB;
+        }
+    }
+    return count;
+}
+
+void
+MsgCache::GetForDevice( DevIDRelay devid, vector<Msg>& out )
+{
+    MutexLock ml( &m_mutex );
+    uint64_t claimedAt = now_ms();
+    GameMap::iterator iter;
+    for ( iter = m_games.begin(); m_games.end() != iter; ++iter ) {
+        Game& game = iter->second;
+        if ( game.haveAddr && !game.dead && devid == game.devid ) {
+            deque<Entry>::iterator entry;
+            for ( entry = game.entries.begin(); entry != game.entries.end();
+                  ++entry ) {
+                Msg msg;
+                msg.id = entry->id;
+                msg.token = game.token;
+                out.push_back( msg );
+                out.back().bytes = entry->bytes;
+                entry->claimedAt = claimedAt;
+            }
+        }
+    }
+}
+
+int
+MsgCache::CountForDevice( DevIDRelay devid )
+{
+    int count = 0;
+    MutexLock ml( &m_mutex );
+    GameMap::iterator iter;
+    for ( iter = m_games.begin(); m_games.end() != iter; ++iter ) {
+        if ( iter->second.haveAddr && devid == iter->second.devid ) {
+            count += iter->second.entries.size();
+        }
+    }
+    return count;
+}
+
+void
+MsgCache::Unresolved( vector<GameKey>& games )
+{
+    MutexLock ml( &m_mutex );
+    GameMap::const_iterator iter;
+    for ( iter = m_games.begin(); m_games.end() != iter; ++iter ) {
+        if ( !iter->second.haveAddr && !iter->second.entries.empty() ) {
+            games.push_back( iter->first );
+        }
+    }
+}
+
+void
+MsgCache::SetAddr( const GameKey& key, DevIDRelay devid,
+                   AddrInfo::ClientToken token, bool dead )
+{
+    MutexLock ml( &m_mutex );
+    GameMap::iterator iter = m_games.find( key );
+    if ( m_games.end() != iter ) {
+        iter->second.haveAddr = true;
+        iter->second.devid = devid;
+        iter->second.token = token;
+        iter->second.dead = dead;
+    }
+}
+
+void
+MsgCache::ForgetAddrs( const char* connName )
+{
+    MutexLock ml( &m_mutex );
+    GameMap::iterator iter = m_games.lower_bound( GameKey( connName, 0 ) );
+    for ( ; m_games.end() != iter && iter->first.first == connName; ++iter ) {
+        iter->second.haveAddr = false;
+    }
+}
+
+void
+MsgCache::Remove( const int* ids, int nIDs, vector<Sent>& sent )
+{
+    MutexLock ml( &m_mutex );
+    for ( int ii = 0; ii < nIDs; ++ii ) {
+        int id = ids[ii];
+        map<int, GameKey>::iterator where = m_ids.find( id );
+        if ( 0 <= id || m_ids.end() == where ) {
+            continue;           /* the table's, or already gone */
+        }
+        GameMap::iterator iter = m_games.find( where->second );
+        assert( m_games.end() != iter );
+        m_ids.erase( where );
+
+        deque<Entry>& entries = iter->second.entries;
+        deque<Entry>::iterator entry;
+        for ( entry = entries.begin(); entry != entries.end(); ++entry ) {
+            if ( id == entry->id ) {
+                break;
+            }
+        }
+        assert( entry != entries.end() );
+        int nBytes = entry->bytes.size();
+        entries.erase( entry );
+        ++m_nDelivered;
+
+        if ( sent.empty() || sent.back().game != iter->first ) {
+            Sent one;
+            one.game = iter->first;
+            one.nBytes = 0;
+            sent.push_back( one );
+        }
+        sent.back().nBytes += nBytes;
+
+        dropIfIdle( iter );
+    }
+}
+
+void
+MsgCache::TakeOldest( uint64_t storedBefore, uint64_t claimedSince,
+                      uint64_t mustBefore, vector<Outgoing>& out )
+{
+    MutexLock ml( &m_mutex );
+    GameMap::iterator iter;
+    for ( iter = m_games.begin(); m_games.end() != iter; ++iter ) {
+        deque<Entry>& entries = iter->second.entries;
+        while ( !entries.empty() ) {
+            Entry& entry = entries.front();
+            if ( entry.storedAt >= storedBefore ) {
+                break;
+            }
+            /* One being delivered is left for Remove(), but not forever:
+               a message read again and again but never removed must still
+               reach the table.  Should its delivery succeed after all the
+               device sees it twice, which is better than never. */
+            if ( entry.claimedAt > claimedSince
+                 && entry.storedAt >= mustBefore ) {
+                break;
+            }
+            Outgoing msg;
+            msg.game = iter->first;
+            msg.id = entry.id;
+            msg.storedAt = entry.storedAt;
+            out.push_back( msg );
+            out.back().bytes.swap( entry.bytes );
+
+            m_ids.erase( entry.id );
+            entries.pop_front();
+            iter->second.inDB = true;
+            ++m_nWritten;
+        }
+    }
+}
+
+void
+MsgCache::PutBack( const vector<Outgoing>& msgs, size_t first )
+{
+    MutexLock ml( &m_mutex );
+    /* Last first, so each goes back in front of those that followed it */
+    for ( size_t ii = msgs.size(); ii > first; ) {
+        const Outgoing& msg = msgs[--ii];
+        Entry entry;
+        entry.id = msg.id;
+        entry.storedAt = msg.storedAt;
+        entry.claimedAt = 0;
+        Game& game = getGame( msg.game )->second;
+        game.entries.push_front( entry );
+        game.entries.front().bytes = msg.bytes;
+        m_ids[msg.id] = msg.game;
+        --m_nWritten;
+    }
+}
+
+void
+MsgCache::LogCounts()
+{
+    MutexLock ml( &m_mutex );
+    if ( 0 != m_nStored || 0 != m_nDelivered || 0 != m_nWritten ) {
+        logf( XW_LOGINFO, "%s: %d stored, %d delivered from memory and %d "
+              "written to the table since last; %d games cached", __func__,
+              m_nStored, m_nDelivered, m_nWritten, (int)m_games.size() );
+        m_nStored = 0;
+        m_nDelivered = 0;
+        m_nWritten = 0;
+    }
+}
@@ -0,0 +1,144 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _MSGCACHE_H_
+#define _MSGCACHE_H_
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "xwrelay_priv.h"
+#include "addrinfo.h"
+#include "devid.h"
+
+using namespace std;
+
+/* Undelivered messages that haven't been written to the msgs table yet, by
+ * game (connName and hid), oldest first.  Ids handed out here are negative
+ * so they can't be confused with the table's.  DBMgr moves the oldest to the
+ * table every so often, and the table is only consulted for games it might
+ * hold messages for.  A game's messages in the table are always older than
+ * its messages here.  Nothing in this class touches the database.
+ */
+class MsgCache {
+ public:
+    typedef pair<string, HostID> GameKey;
+
+    /* A copy of a message, for delivery */
+    typedef struct {
+        int id;
+        AddrInfo::ClientToken token; /* only set by GetForDevice() */
+        vector<unsigned char> bytes;
+    } Msg;
+
+    /* A message leaving for (or, if that fails, returning from) the table */
+    typedef struct {
+        GameKey game;
+        int id;
+        uint64_t storedAt;
+        vector<unsigned char> bytes;
+    } Outgoing;
+
+    /* A game credited with delivered messages */
+    typedef struct {
+        GameKey game;
+        int nBytes;
+    } Sent;
+
+    /* inDB: whether a game first seen here might already have messages in
+       the table.  Pass false only when every game that does will be named
+       via SetInDB() */
+    MsgCache( bool inDB );
+    ~MsgCache();
+
+    int Store( const char* connName, HostID hid, const unsigned char* buf,
+               size_t len );
+
+    /* Copy up to maxMsgs (-1 for all) of the game's messages to out and
+       mark them as being delivered, which keeps them here for a while.
+       Returns whether the table might have older ones. */
+    bool Get( const char* connName, HostID hid, vector<Msg>& out,
+              int maxMsgs );
+    bool InDB( const char* connName, HostID hid );
+    void SetInDB( const char* connName, HostID hid, bool inDB );
+    /* hid of -1 counts all the game's devices */
+    int Count( const char* connName, int hid, bool* inDB );
+
+    /* Messages for a device can't be found until their games' devids and
+       tokens are known: DBMgr looks up those Unresolved() returns. */
+    void GetForDevice( DevIDRelay devid, vector<Msg>& out );
+    int CountForDevice( DevIDRelay devid );
+    void Unresolved( vector<GameKey>& games );
+    void SetAddr( const GameKey& game, DevIDRelay devid,
+                  AddrInfo::ClientToken token, bool dead );
+    void ForgetAddrs( const char* connName );
+
+    /* Drop the messages with these ids, ignoring the table's, and say how
+       many bytes each game had delivered */
+    void Remove( const int* ids, int nIDs, vector<Sent>& sent );
+
+    /* Move out each game's messages stored before storedBefore, stopping
+       at any being delivered since claimedSince unless it was stored before
+       mustBefore.  The games are marked InDB(). */
+    void TakeOldest( uint64_t storedBefore, uint64_t claimedSince,
+                     uint64_t mustBefore, vector<Outgoing>& out );
+    /* Undo TakeOldest() for msgs[first] on */
+    void PutBack( const vector<Outgoing>& msgs, size_t first );
+    /* Log what's been stored, delivered and written since last time */
+    void LogCounts();
+
+ private:
+    typedef struct {
+        int id;
+        uint64_t storedAt;
+        uint64_t claimedAt;     /* 0 until read for delivery */
+        vector<unsigned char> bytes;
+    } Entry;
+
+    typedef struct {
+        deque<Entry> entries;
+        bool inDB;
+        bool haveAddr;
+        DevIDRelay devid;
+        AddrInfo::ClientToken token;
+        bool dead;
+    } Game;
+
+    typedef map<GameKey, Game> GameMap;
+
+    GameMap::iterator getGame( const GameKey& key );
+    void dropIfIdle( GameMap::iterator iter );
+
+    pthread_mutex_t m_mutex;
+    GameMap m_games;
+    map<int, GameKey> m_ids;    /* where each cached message is */
+    int m_nextID;               /* counts down from -1 */
+    bool m_inDB;
+
+    /* since last logged */
+    int m_nStored;
+    int m_nDelivered;
+    int m_nWritten;
+};
+
+#endif
@@ -0,0 +1,132 @@
+/* -*- compile-command: "make -k -j3"; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pktslab.h"
+#include "xwrelay_priv.h"
+
+typedef unsigned char SlabBuf[PKTSLAB_BUF_LEN];
+
+static SlabBuf* s_bufs = NULL;
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+
+/* The free list.  Each entry is a 1-based index into s_bufs, 0 ending the
+   list.  The head's top half counts pops and pushes so that a thread whose
+   CAS raced with another's pop-then-push of the same buffer fails and
+   retries rather than installing a stale next. */
+static volatile uint32_t* s_next = NULL;
+static volatile uint64_t s_head = 0;
+
+/* counters */
+static volatile int s_inUse = 0;
+static volatile int s_peak = 0;
+static volatile unsigned int s_nAllocs = 0;
+static volatile unsigned int s_nFallbacks = 0;
+
+static void
+init_slab( void )
+{
+    s_bufs = (SlabBuf*)malloc( PKTSLAB_COUNT * sizeof(SlabBuf) );
+    s_next = (uint32_t*)malloc( PKTSLAB_COUNT * sizeof(s_next[0]) );
+    if ( NULL == s_bufs || NULL == s_next ) {
+        logf( XW_LOGERROR, "%s: no memory; using heap for packets", __func__ );
+        free( s_bufs );
+        free( (void*)s_next );
+        s_bufs = NULL;
+        s_next = NULL;
+    } else {
+        for ( int ii = 0; ii < PKTSLAB_COUNT; ++ii ) {
+            s_next[ii] = ii + 1 < PKTSLAB_COUNT ? ii + 2 : 0;
+        }
+        __sync_synchronize();
+        s_head = 1;
+    }
+}
+
+static void
+note_alloc( bool fromSlab )
+{
+    if ( fromSlab ) {
+        int inUse = __sync_add_and_fetch( &s_inUse, 1 );
+        for ( int peak = s_peak; inUse > peak; peak = s_peak ) {
+            if ( __sync_bool_compare_and_swap( &s_peak, peak, inUse ) ) {
+                break;
+            }
+        }
+    } else if ( 1 == __sync_add_and_fetch( &s_nFallbacks, 1 ) ) {
+        logf( XW_LOGERROR, "%s: slab of %d exhausted; using heap", __func__,
+              PKTSLAB_COUNT );
+    }
+
+    if ( 0 == __sync_add_and_fetch( &s_nAllocs, 1 ) % PKTSLAB_LOG_INTERVAL ) {
+        logf( XW_LOGINFO, "%s: %d of %d buffers in use, %d at most; "
+              "%d of %d allocations from heap", __func__, s_inUse,
+              PKTSLAB_COUNT, s_peak, s_nFallbacks, s_nAllocs );
+    }
+}
+
+/* static */ unsigned char*
+PacketSlab::alloc()
+{
+    pthread_once( &s_once, init_slab );
+
+    unsigned char* buf = NULL;
+    for ( ; ; ) {
+        uint64_t head = s_head;
+        uint32_t indx = (uint32_t)head;
+        if ( 0 == indx ) {
+            break;
+        }
+        uint64_t newHead = ((head >> 32) + 1) << 32 | s_next[indx-1];
+        if ( __sync_bool_compare_and_swap( &s_head, head, newHead ) ) {
+            buf = s_bufs[indx-1];
+            break;
+        }
+    }
+
+    note_alloc( NULL != buf );
+    if ( NULL == buf ) {
+        buf = new unsigned char[PKTSLAB_BUF_LEN];
+    }
+    return buf;
+}
+
+/* static */ void
+PacketSlab::release( unsigned char* buf )
+{
+    if ( NULL != s_bufs && buf >= s_bufs[0]
+         && buf < s_bufs[PKTSLAB_COUNT] ) {
+        int indx = (SlabBuf*)buf - s_bufs;
+        assert( buf == s_bufs[indx] );
+        __sync_sub_and_fetch( &s_inUse, 1 ); /* before another can pop it */
+        for ( ; ; ) {
+            uint64_t head = s_head;
+            s_next[indx] = (uint32_t)head;
+            uint64_t newHead = ((head >> 32) + 1) << 32 | (indx + 1);
+            if ( __sync_bool_compare_and_swap( &s_head, head, newHead ) ) {
+                break;
+            }
+        }
+    } else {
+        delete[] buf;
+    }
+}
@@ -0,0 +1,43 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _PKTSLAB_H_
+#define _PKTSLAB_H_
+
+#include "xwrelay.h"
+
+#define PKTSLAB_BUF_LEN (MAX_MSG_LEN + 1) /* room for proxy's terminator */
+#define PKTSLAB_COUNT 4096      /* buffers in the slab: 8M */
+#define PKTSLAB_LOG_INTERVAL 10000 /* allocations between occupancy logs */
+
+/* Buffers for incoming packets, PKTSLAB_BUF_LEN bytes each.  Packets are
+ * read straight into one and it goes with the packet to whichever worker
+ * handles it, which releases it.  The buffers come from one slab allocated
+ * at first use, and a free list that's a lock-free stack, so no allocator
+ * lock is taken on the way.  When the slab's empty buffers come from the
+ * heap instead, and how often that happens is logged along with occupancy.
+ */
+class PacketSlab {
+ public:
+    static unsigned char* alloc();
+    /* buf must have come from alloc() */
+    static void release( unsigned char* buf );
+};
+
+#endif
@@ -6,7 +6,7 @@
 #
 # Depends on the gcm module
 
-import getpass, sys, psycopg2, time, signal, shelve, json, urllib2
+import getpass, sys, psycopg2, time, signal, shelve, json, urllib2, base64
 from time import gmtime, strftime
 from os import path
 
@@ -32,7 +32,7 @@ g_con = None
 g_sent = None
 g_debug = False
 g_skipSend = False               # for debugging
-g_columns = [ 'id', 'devid', 'connname', 'hid', 'msg64' ]
+g_columns = [ 'id', 'devid', 'connname', 'hid', 'msg64', 'msg' ]
 DEVTYPE_GCM = 3                     # 3 == GCM
 LINE_LEN = 76
 
@@ -114,7 +114,11 @@ def notifyGCM( devids, typ, target ):
     if typ == DEVTYPE_GCM:
         if 3 <= target['clntVers']:
             connname = "%s/%d" % (target['connname'], target['hid'])
-            data = { 'msgs64': [ target['msg64'] ],
+            # The relay stores msg as bytea now; msg64 is only set on
+            # rows older relays wrote
+            msg64 = target['msg64']
+            if not msg64: msg64 = base64.b64encode( str(target['msg']) )
+            data = { 'msgs64': [ msg64 ],
                      'connname': connname,
                      }
         else:
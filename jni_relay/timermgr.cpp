@@ -20,17 +20,27 @@
 
 #include <signal.h>
 #include <sys/time.h>
+#include <time.h>
 #include <errno.h>
 #include <assert.h>
+#include <string.h>
 #include "timermgr.h"
 #include "xwrelay_priv.h"
 #include "configs.h"
 #include "mlock.h"
 
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define NEVER ((uint64_t)-1)
+#define MAX_POLL_TIMEOUT 0x7FFFFFFF
+
 TimerMgr::TimerMgr()
-    : m_nextFireTime(0)
+    : m_nextFireTime(NEVER)
+    , m_wakeProc(NULL)
+    , m_wakeClosure(NULL)
 {
     pthread_mutex_init( &m_timersMutex, NULL );
+    memset( m_wheel, 0, sizeof(m_wheel) );
+    m_curTick = now_ms();
 }
 
 /* static */TimerMgr* 
@@ -45,91 +55,198 @@ TimerMgr::GetTimerMgr()
 
 void
 TimerMgr::SetTimer( time_t inMillis, TimerProc proc, void* closure,
-                    int interval )
+                    int intervalMillis )
 {
-    logf( XW_LOGINFO, "%s: uptime = %ld", __func__, uptime() );
-    TimerInfo ti;
-    ti.proc = proc;
-    ti.closure = closure;
-    ti.when = uptime() + inMillis;
-    ti.interval = interval;
-
-    MutexLock ml( &m_timersMutex );
+    logf( XW_LOGINFO, "%s(inMillis=%ld)", __func__, inMillis );
+    uint64_t when = now_ms() + inMillis;
+    bool wake;
+    {
+        MutexLock ml( &m_timersMutex );
+        uint64_t nextFireTime = m_nextFireTime;
 
-    if ( getTimer( proc, closure ) ) {
-        logf( XW_LOGINFO, "%s: clearing old timer", __func__ );
-        clearTimerImpl( proc, closure );
+        TimerInfo* tip;
+        TimerKey key( proc, closure );
+        TimerMap::iterator iter = m_timers.find( key );
+        if ( iter != m_timers.end() ) {
+            logf( XW_LOGINFO, "%s: clearing old timer", __func__ );
+            tip = iter->second;
+            unlink( tip );
+        } else {
+            tip = new TimerInfo;
+            tip->proc = proc;
+            tip->closure = closure;
+            m_timers.insert( TimerMap::value_type( key, tip ) );
+        }
+        tip->when = when;
+        tip->interval = intervalMillis;
+        insert( tip );
+        wake = m_nextFireTime < nextFireTime && NULL != m_wakeProc;
     }
 
-    m_timers.push_back( ti );
-
-    figureNextFire();
+    if ( wake ) {
+        (*m_wakeProc)( m_wakeClosure );
+    }
     logf( XW_LOGINFO, "setTimer done" );
 }
 
+void
+TimerMgr::SetWakeProc( TimerWakeProc proc, void* closure )
+{
+    MutexLock ml( &m_timersMutex );
+    m_wakeProc = proc;
+    m_wakeClosure = closure;
+}
+
 time_t 
 TimerMgr::GetPollTimeout()
 {
     MutexLock ml( &m_timersMutex );
 
-    time_t tout = m_nextFireTime;
-    if ( tout == 0 ) {
-        tout = -1;
-    } else {
-        tout -= uptime();
-        if ( tout < 0 ) {
+    time_t tout = -1;
+    if ( NEVER != m_nextFireTime ) {
+        uint64_t now = now_ms();
+        if ( m_nextFireTime <= now ) {
             tout = 0;
+        } else if ( m_nextFireTime - now > MAX_POLL_TIMEOUT ) {
+            tout = MAX_POLL_TIMEOUT;
+        } else {
+            tout = m_nextFireTime - now;
         }
-        tout *= 1000;
     }
     return tout;
 } /* GetPollTimeout */
 
-bool
-TimerMgr::getTimer( TimerProc proc, void* closure )
+/* The first tick, from m_curTick on, when the wheel will process the slot:
+   when timers in it fire (level 0) or move down a level. */
+uint64_t
+TimerMgr::slotTick( int level, int slot )
+{
+    int bits = TIMER_LEVEL_BITS * level;
+    uint64_t mask = ((uint64_t)1 << bits) - 1;
+    uint64_t start = (m_curTick + mask) >> bits;
+    return (start + (((uint64_t)slot - start) & SLOT_MASK)) << bits;
+}
+
+void
+TimerMgr::insert( TimerInfo* tip )
 {
     /* Don't call this unless have the lock!!! */
-    list<TimerInfo>::iterator iter;
-    for ( iter = m_timers.begin(); iter != m_timers.end(); ++iter ) {
-        if ( (*iter).proc == proc
-             && (*iter).closure == closure ) {
-            return true;
+    uint64_t when = tip->when < m_curTick ? m_curTick : tip->when;
+    uint64_t delta = when - m_curTick;
+
+    int level;
+    for ( level = 0; level < TIMER_LEVELS - 1; ++level ) {
+        if ( delta < ((uint64_t)1 << (TIMER_LEVEL_BITS * (level + 1))) ) {
+            break;
         }
     }
+    uint64_t maxDelta = ((uint64_t)1 << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1;
+    if ( delta > maxDelta ) {
+        /* park it in the farthest slot; it'll be placed again from there */
+        when = m_curTick + maxDelta;
+    }
 
-    return false;
-} /* getTimer */
+    tip->level = level;
+    tip->slot = (when >> (TIMER_LEVEL_BITS * level)) & SLOT_MASK;
+    TimerInfo** head = &m_wheel[level][tip->slot];
+    tip->prev = NULL;
+    tip->next = *head;
+    if ( NULL != *head ) {
+        (*head)->prev = tip;
+    }
+    *head = tip;
+
+    uint64_t tick = slotTick( level, tip->slot );
+    if ( tick < m_nextFireTime ) {
+        m_nextFireTime = tick;
+    }
+} /* insert */
 
 void
-TimerMgr::figureNextFire()
+TimerMgr::unlink( TimerInfo* tip )
 {
     /* Don't call this unless have the lock!!! */
-    time_t t = 0x7FFFFFFF;
-    time_t cur = uptime();
-
-    list<TimerInfo>::iterator iter = m_timers.begin();
-
-    while ( iter != m_timers.end() ) {
-        time_t when = iter->when;
+    if ( NULL != tip->prev ) {
+        tip->prev->next = tip->next;
+    } else {
+        assert( m_wheel[tip->level][tip->slot] == tip );
+        m_wheel[tip->level][tip->slot] = tip->next;
+    }
+    if ( NULL != tip->next ) {
+        tip->next->prev = tip->prev;
+    }
+}
 
-        if ( when == 0 ) {
-            if ( iter->interval ) {
-                when = iter->when = cur + iter->interval;
-            } else {
-                m_timers.erase(iter);
-                iter = m_timers.begin();
-                continue;
+void
+TimerMgr::figureNextFire()
+{
+    /* Don't call this unless have the lock!!! */
+    m_nextFireTime = NEVER;
+    if ( 0 < m_timers.size() ) {
+        for ( int level = 0; level < TIMER_LEVELS; ++level ) {
+            int bits = TIMER_LEVEL_BITS * level;
+            uint64_t mask = ((uint64_t)1 << bits) - 1;
+            uint64_t start = (m_curTick + mask) >> bits;
+            for ( int ii = 0; ii < TIMER_SLOTS; ++ii ) {
+                if ( NULL != m_wheel[level][(start + ii) & SLOT_MASK] ) {
+                    uint64_t tick = (start + ii) << bits;
+                    if ( tick < m_nextFireTime ) {
+                        m_nextFireTime = tick;
+                    }
+                    break;
+                }
             }
         }
+    }
+} /* figureNextFire */
+
+/* Move everything in a slot down to where it now belongs */
+void
+TimerMgr::cascade( int level, int slot )
+{
+    TimerInfo* tip = m_wheel[level][slot];
+    m_wheel[level][slot] = NULL;
+    while ( NULL != tip ) {
+        TimerInfo* next = tip->next;
+        insert( tip );
+        tip = next;
+    }
+}
 
-        if ( when < t ) {
-            t = when;
+/* Process m_curTick: cascade whatever's due, then collect the timers in its
+   level-0 slot, rescheduling recurring ones and freeing the rest. */
+void
+TimerMgr::fireTick( vector<TimerInfo>& fired )
+{
+    uint64_t tick = m_curTick;
+    for ( int level = 1; level < TIMER_LEVELS; ++level ) {
+        int bits = TIMER_LEVEL_BITS * level;
+        if ( 0 != (tick & (((uint64_t)1 << bits) - 1)) ) {
+            break;
         }
-        ++iter;
+        cascade( level, (tick >> bits) & SLOT_MASK );
     }
 
-    m_nextFireTime = t == 0x7FFFFFFF? 0 : t;
-} /* figureNextFire */
+    int slot = tick & SLOT_MASK;
+    TimerInfo* tip = m_wheel[0][slot];
+    m_wheel[0][slot] = NULL;
+    while ( NULL != tip ) {
+        TimerInfo* next = tip->next;
+        fired.push_back( *tip );
+        if ( tip->interval > 0 ) {
+            tip->when += tip->interval;
+            if ( tip->when <= tick ) {
+                tip->when = tick + tip->interval;
+            }
+            insert( tip );
+        } else {
+            m_timers.erase( TimerKey( tip->proc, tip->closure ) );
+            delete tip;
+        }
+        tip = next;
+    }
+    ++m_curTick;
+} /* fireTick */
 
 void
 TimerMgr::ClearTimer( TimerProc proc, void* closure )
@@ -141,51 +258,41 @@ TimerMgr::ClearTimer( TimerProc proc, void* closure )
 void
 TimerMgr::FireElapsedTimers()
 {
-    time_t curTime = uptime();
-
-    vector<TimerProc> procs;
-    vector<void*> closures;
+    vector<TimerInfo> fired;
     {
         MutexLock ml( &m_timersMutex );
-        /* loop until we get through without firing a single one.  Only fire one
-           per run, though, since calling erase invalidates the iterator.
-           PENDING: all this needs a mutex!!!! */
-        list<TimerInfo>::iterator iter;
-        for ( iter = m_timers.begin(); iter != m_timers.end(); ++iter ) {
-            TimerInfo* tip = &(*iter);
-            if ( tip->when <= curTime ) {
-
-                procs.push_back(tip->proc);
-                closures.push_back(tip->closure);
-
-                if ( tip->interval ) {
-                    tip->when += tip->interval;
-                } else {
-                    tip->when = 0;      /* flag for removal */
-                }
+        uint64_t now = now_ms();
+        while ( m_curTick <= now ) {
+            if ( m_nextFireTime > now ) {
+                m_curTick = now; /* nothing due in between */
+                break;
+            }
+            if ( m_nextFireTime > m_curTick ) {
+                m_curTick = m_nextFireTime;
             }
+            fireTick( fired );
+            figureNextFire();
         }
     }
 
-    vector<TimerProc>::iterator iter1 = procs.begin();
-    vector<void*>::iterator iter2 = closures.begin();
-    while ( iter1 != procs.end() ) {
-        (*iter1++)(*iter2++);
+    /* call outside the lock: procs may set timers */
+    vector<TimerInfo>::const_iterator iter;
+    for ( iter = fired.begin(); iter != fired.end(); ++iter ) {
+        (*iter->proc)( iter->closure );
     }
-
-    MutexLock ml( &m_timersMutex );
-    figureNextFire();
 } /* fireElapsedTimers */
 
 void
 TimerMgr::clearTimerImpl( TimerProc proc, void* closure )
 {
-    list<TimerInfo>::iterator iter;
-    for ( iter = m_timers.begin(); iter != m_timers.end(); ++iter ) {
-        TimerInfo* tip = &(*iter);
-        if ( tip->proc == proc && tip->closure == closure ) {
-            m_timers.erase(iter);
-            break;
+    TimerMap::iterator iter = m_timers.find( TimerKey( proc, closure ) );
+    if ( iter != m_timers.end() ) {
+        TimerInfo* tip = iter->second;
+        unlink( tip );
+        m_timers.erase( iter );
+        delete tip;
+        if ( 0 == m_timers.size() ) {
+            m_nextFireTime = NEVER;
         }
     }
 }
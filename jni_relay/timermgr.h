@@ -21,16 +21,30 @@
 #ifndef _TIMERMGR_H_
 #define _TIMERMGR_H_
 
-#include "list"
+#include <tr1/unordered_map>
+#include <vector>
 
 #include <pthread.h>
+#include <stdint.h>
 
 #include "xwrelay_priv.h"
 
 using namespace std;
 
 typedef void (*TimerProc)( void* closure );
-
+typedef void (*TimerWakeProc)( void* closure );
+
+/* Timers live in a hierarchical timing wheel: TIMER_LEVELS wheels of
+ * TIMER_SLOTS slots each, where a slot at level 0 is one millisecond and a
+ * slot at each higher level spans a whole turn of the level below.  A timer
+ * goes in the lowest level whose span covers its delay, and moves down a
+ * level each time the wheel below comes round to its slot, so setting,
+ * clearing and firing are O(1) however many timers are pending.  A hash on
+ * (proc, closure) finds the timer to replace or clear.
+ */
+#define TIMER_LEVEL_BITS 8
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS 4          /* 2^32 ms: 49 days */
 
 class TimerMgr {
 
@@ -38,33 +52,56 @@ class TimerMgr {
     static TimerMgr* GetTimerMgr();
 
     void SetTimer( time_t inMillis, TimerProc proc, void* closure,
-                   int interval ); /* 0 means non-recurring */
+                   int intervalMillis ); /* 0 means non-recurring */
     void ClearTimer( TimerProc proc, void* closure );
+    /* Called, without the lock, when SetTimer() makes the next firing
+       earlier than GetPollTimeout() may have said, so whoever's waiting
+       can ask again */
+    void SetWakeProc( TimerWakeProc proc, void* closure );
   
     time_t GetPollTimeout();
     void FireElapsedTimers();
 
  private:
 
-    typedef struct {
+    typedef struct _TimerInfo {
         TimerProc proc;
         void* closure;
-        time_t when;
+        uint64_t when;          /* in ms, from now_ms() */
         int interval;
+        int level;
+        int slot;
+        struct _TimerInfo* prev;
+        struct _TimerInfo* next;
     } TimerInfo;
-  
+
+    typedef pair<TimerProc, void*> TimerKey;
+    struct TimerKeyHash {
+        size_t operator()( const TimerKey& key ) const {
+            return ((size_t)key.first * 31) ^ (size_t)key.second;
+        }
+    };
+    typedef tr1::unordered_map<TimerKey, TimerInfo*, TimerKeyHash> TimerMap;
 
     TimerMgr();
 
     /* run once we have the mutex */
     void clearTimerImpl( TimerProc proc, void* closure );
-    bool getTimer( TimerProc proc, void* closure );
+    void insert( TimerInfo* tip );
+    void unlink( TimerInfo* tip );
+    uint64_t slotTick( int level, int slot );
     void figureNextFire();
+    void cascade( int level, int slot );
+    void fireTick( vector<TimerInfo>& fired );
   
     pthread_mutex_t m_timersMutex;
-    list<TimerInfo> m_timers;
+    TimerInfo* m_wheel[TIMER_LEVELS][TIMER_SLOTS];
+    TimerMap m_timers;
 
-    time_t m_nextFireTime;
+    uint64_t m_curTick;         /* next ms the wheel will process */
+    uint64_t m_nextFireTime;    /* no event in the wheel before this */
+    TimerWakeProc m_wakeProc;
+    void* m_wakeClosure;
 };
 
 #endif
@@ -26,7 +26,12 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <sys/poll.h>
+#ifdef USE_EPOLL
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+#else
+# include <sys/poll.h>
+#endif
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
@@ -39,6 +44,14 @@
 
 XWThreadPool* XWThreadPool::g_instance = NULL;
 
+#ifdef USE_EPOLL
+/* events handled per epoll_wait() */
+# define EPOLL_BATCH 256
+/* data.u64 for m_eventFD; a socket's always has a non-0 m_gen in the high
+   32 bits */
+# define EVENTFD_KEY 0
+#endif
+
 /* static */ XWThreadPool*
 XWThreadPool::GetTPool()
 {
@@ -59,6 +72,25 @@ XWThreadPool::XWThreadPool()
 
     pthread_cond_init( &m_queueCondVar, NULL );
 
+#ifdef USE_EPOLL
+    m_nextGen = 0;
+    m_epollFD = epoll_create1( EPOLL_CLOEXEC );
+    if ( m_epollFD < 0 ) {
+        logf( XW_LOGERROR, "epoll_create1 failed: %s", strerror(errno) );
+    }
+    m_eventFD = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if ( m_eventFD < 0 ) {
+        logf( XW_LOGERROR, "eventfd failed: %s", strerror(errno) );
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = EVENTFD_KEY;
+    if ( 0 != epoll_ctl( m_epollFD, EPOLL_CTL_ADD, m_eventFD, &event ) ) {
+        logf( XW_LOGERROR, "epoll_ctl(eventfd) failed: %s", strerror(errno) );
+    }
+    logf( XW_LOGINFO, "m_epollFD: %d; m_eventFD: %d", m_epollFD, m_eventFD );
+#else
     int fd[2];
     if ( pipe( fd ) ) {
         logf( XW_LOGERROR, "pipe failed" );
@@ -67,6 +99,7 @@ XWThreadPool::XWThreadPool()
     m_pipeWrite = fd[1];
     logf( XW_LOGINFO, "pipes: m_pipeRead: %d; m_pipeWrite: %d",
           m_pipeRead, m_pipeWrite );
+#endif
 }
 
 XWThreadPool::~XWThreadPool()
@@ -75,6 +108,11 @@ XWThreadPool::~XWThreadPool()
 
     pthread_rwlock_destroy( &m_activeSocketsRWLock );
     pthread_mutex_destroy ( &m_queueMutex );
+
+#ifdef USE_EPOLL
+    close( m_eventFD );
+    close( m_epollFD );
+#endif
 } /* ~XWThreadPool */
 
 void
@@ -92,6 +130,9 @@ XWThreadPool::Setup( int nThreads, kill_func kFunc )
         pthread_detach( tip->thread );
     }
 
+    /* A timer set while the listener's waiting may be due before it'd wake */
+    TimerMgr::GetTimerMgr()->SetWakeProc( timer_wake, this );
+
     pthread_t thread;
     int result = pthread_create( &thread, NULL, listener_main, this );
     assert( result == 0 );
@@ -123,11 +164,37 @@ XWThreadPool::AddSocket( SockType stype, QueueCallback proc, const AddrInfo* fro
         si.m_type = stype;
         si.m_proc = proc;
         si.m_addr = *from;
+#ifdef USE_EPOLL
+        int socket = from->socket();
+        if ( 0 == ++m_nextGen ) { /* wrapped; 0 is EVENTFD_KEY's */
+            ++m_nextGen;
+        }
+        Registration reg = { si, m_nextGen };
+        /* In the map before it's armed: the listener may see it fire before
+           epoll_ctl() returns, and blocks on our lock to look it up. */
+        m_activeSockets[socket] = reg;
+
+        /* Re-arm if it's been here before, which is almost always */
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.u64 = ((uint64_t)reg.m_gen << 32) | (uint32_t)socket;
+        if ( 0 != epoll_ctl( m_epollFD, EPOLL_CTL_MOD, socket, &event )
+             && ( ENOENT != errno 
+                  || 0 != epoll_ctl( m_epollFD, EPOLL_CTL_ADD, socket, 
+                                     &event ) ) ) {
+            logf( XW_LOGERROR, "%s: epoll_ctl(%d) failed: %s", __func__, 
+                  socket, strerror(errno) );
+            m_activeSockets.erase( socket );
+        }
+#else
         m_activeSockets.push_back( si );
+#endif
         logf( XW_LOGINFO, "%s: %d sockets active", __func__, 
               m_activeSockets.size() );
     }
+#ifndef USE_EPOLL
     interrupt_poll();
+#endif
 }
 
 bool
@@ -141,6 +208,15 @@ XWThreadPool::RemoveSocket( const AddrInfo* addr )
         logf( XW_LOGINFO, "%s: START: %d sockets active", __func__, 
               m_activeSockets.size() );
 
+#ifdef USE_EPOLL
+        map<int, Registration>::iterator iter = 
+            m_activeSockets.find( addr->socket() );
+        if ( iter != m_activeSockets.end()
+             && iter->second.m_info.m_addr.equals( *addr ) ) {
+            m_activeSockets.erase( iter );
+            found = true;
+        }
+#else
         vector<SockInfo>::iterator iter;
         for ( iter = m_activeSockets.begin(); 
               iter != m_activeSockets.end(); ++iter ) {
@@ -150,6 +226,7 @@ XWThreadPool::RemoveSocket( const AddrInfo* addr )
                 break;
             }
         }
+#endif
         logf( XW_LOGINFO, "%s: AFTER: %d sockets active", __func__, 
               m_activeSockets.size() );
     }
@@ -174,6 +251,12 @@ XWThreadPool::CloseSocket( const AddrInfo* addr )
         }
     }
     logf( XW_LOGINFO, "CLOSING socket %d", addr->socket() );
+#ifdef USE_EPOLL
+    /* Nothing to interrupt: once it's out of the interest list epoll_wait()
+       won't report it, and m_gen catches any event already returned. */
+    (void)epoll_ctl( m_epollFD, EPOLL_CTL_DEL, addr->socket(), NULL );
+    close( addr->socket() );
+#else
     close( addr->socket() );
 /*     if ( do_interrupt ) { */
     /* We always need to interrupt the poll because the socket we're closing
@@ -182,6 +265,7 @@ XWThreadPool::CloseSocket( const AddrInfo* addr )
        blocking.*/
     interrupt_poll();
 /*     } */
+#endif
 }
 
 void
@@ -203,10 +287,11 @@ XWThreadPool::get_process_packet( SockType stype, QueueCallback proc, const Addr
     short packetSize;
     assert( sizeof(packetSize) == 2 );
 
-    // Fix this to return an allocated buffer
-    unsigned char buf[MAX_MSG_LEN+1];
-    int nRead = read_packet( addr->socket(), buf, sizeof(buf) );
+    /* The queue takes buf when it takes the packet */
+    unsigned char* buf = PacketSlab::alloc();
+    int nRead = read_packet( addr->socket(), buf, PKTSLAB_BUF_LEN );
     if ( nRead < 0 ) {
+        PacketSlab::release( buf );
         EnqueueKill( addr, "bad packet" );
     } else if ( STYPE_PROXY == stype && NULL != proc ) {
         buf[nRead] = '\0';
@@ -215,6 +300,7 @@ XWThreadPool::get_process_packet( SockType stype, QueueCallback proc, const Addr
         UdpQueue::get()->handle( addr, buf, nRead, proc );
         success = true;
     } else {
+        PacketSlab::release( buf );
         assert(0);
     }
     return success;
@@ -285,13 +371,100 @@ XWThreadPool::interrupt_poll()
 #ifdef LOG_POLL
     logf( XW_LOGINFO, __func__ );
 #endif
+#ifdef USE_EPOLL
+    uint64_t one = 1;
+    int nSent = write( m_eventFD, &one, sizeof(one) );
+    if ( nSent != sizeof(one) ) {
+        logf( XW_LOGERROR, "errno = %s (%d)", strerror(errno), errno );
+    }
+#else
     unsigned char byt = 0;
     int nSent = write( m_pipeWrite, &byt, 1 );
     if ( nSent != 1 ) {
         logf( XW_LOGERROR, "errno = %s (%d)", strerror(errno), errno );
     }
+#endif
 }
 
+/* static */ void
+XWThreadPool::timer_wake( void* closure )
+{
+    ((XWThreadPool*)closure)->interrupt_poll();
+}
+
+#ifdef USE_EPOLL
+void*
+XWThreadPool::real_listener()
+{
+    TimerMgr* tmgr = TimerMgr::GetTimerMgr();
+    struct epoll_event events[EPOLL_BATCH];
+
+    for ( ; ; ) {
+        int nMillis = tmgr->GetPollTimeout();
+#ifdef LOG_POLL
+        logf( XW_LOGINFO, "epoll_wait nmillis=%d", nMillis );
+#endif
+        int nEvents = epoll_wait( m_epollFD, events, 
+                                  sizeof(events)/sizeof(events[0]), nMillis );
+#ifdef LOG_POLL
+        logf( XW_LOGINFO, "back from epoll_wait: %d", nEvents );
+#endif
+        if ( m_timeToDie ) {
+            break;
+        }
+
+        if ( nEvents == 0 ) {
+            tmgr->FireElapsedTimers();
+        } else if ( nEvents < 0 && EINTR != errno ) {
+            logf( XW_LOGERROR, "epoll_wait failed: errno: %s (%d)", 
+                  strerror(errno), errno );
+        }
+
+        for ( int ii = 0; ii < nEvents; ++ii ) {
+            uint64_t key = events[ii].data.u64;
+            if ( EVENTFD_KEY == key ) {
+#ifdef LOG_POLL
+                logf( XW_LOGINFO, "epoll_wait interrupted" );
+#endif
+                uint64_t count;
+                (void)read( m_eventFD, &count, sizeof(count) );
+                continue;
+            }
+
+            int socket = (int)(key & 0xFFFFFFFF);
+            uint32_t gen = (uint32_t)(key >> 32);
+            SockInfo si;
+            bool found = false;
+            {
+                RWWriteLock ml( &m_activeSocketsRWLock );
+                map<int, Registration>::iterator iter = 
+                    m_activeSockets.find( socket );
+                if ( iter != m_activeSockets.end() 
+                     && iter->second.m_gen == gen ) {
+                    si = iter->second.m_info;
+                    m_activeSockets.erase( iter );
+                    found = true;
+                }
+            }
+            if ( !found ) {
+                /* no further processing if it's been removed while we've
+                   been sleeping in epoll_wait */
+                continue;
+            }
+
+            if ( 0 != (events[ii].events & (EPOLLIN | EPOLLPRI)) ) {
+                enqueue( si );
+            } else {
+                logf( XW_LOGERROR, "odd events: %x", events[ii].events );
+                EnqueueKill( &si.m_addr, "error/hup in epoll_wait()" );
+            }
+        }
+    }
+
+    logf( XW_LOGINFO, "real_listener returning" );
+    return NULL;
+} /* real_listener */
+#else
 void*
 XWThreadPool::real_listener()
 {
@@ -421,6 +594,7 @@ XWThreadPool::real_listener()
     logf( XW_LOGINFO, "real_listener returning" );
     return NULL;
 } /* real_listener */
+#endif
 
 /* static */ void*
 XWThreadPool::listener_main( void* closure )
@@ -25,11 +25,21 @@
  * waiting on that queue.  When a new socket appears, a thread grabs the
  * socket, reads from it, passes the buffer on, and puts the socket back in
  * the list being read from in our main thread.
+ *
+ * With USE_EPOLL the list lives in the kernel too.  Each socket is
+ * registered once, EPOLLONESHOT, so firing disarms it the way removing it
+ * from the poll() list does, and putting it back just re-arms it.  Adding
+ * and removing sockets no longer wakes the listener, and a wakeup costs the
+ * same however many sockets are idle.
  */
 
 #include <vector>
 #include <deque>
 #include <set>
+#ifdef USE_EPOLL
+# include <map>
+# include <stdint.h>
+#endif
 
 #include "addrinfo.h" 
 #include "udpqueue.h"
@@ -84,6 +94,7 @@ class XWThreadPool {
 
     bool get_process_packet( SockType stype, QueueCallback proc, const AddrInfo* from );
     void interrupt_poll();
+    static void timer_wake( void* closure );
 
     void* real_tpool_main( ThreadInfo* tsp );
     static void* tpool_main( void* closure );
@@ -92,7 +103,17 @@ class XWThreadPool {
     static void* listener_main( void* closure );
 
     /* Sockets main thread listens on */
+#ifdef USE_EPOLL
+    /* m_gen goes in the epoll event too, so an event for a socket that's
+       been closed, and its fd reused, since epoll_wait() returned is
+       ignored */
+    typedef struct { SockInfo m_info; uint32_t m_gen; } Registration;
+    map<int, Registration> m_activeSockets;
+    uint32_t m_nextGen;
+    int m_epollFD;
+#else
     vector<SockInfo>m_activeSockets;
+#endif
     pthread_rwlock_t m_activeSocketsRWLock;
 
     /* Sockets waiting for a thread to read 'em */
@@ -101,9 +122,13 @@ class XWThreadPool {
     pthread_mutex_t m_queueMutex;
     pthread_cond_t m_queueCondVar;
 
+#ifdef USE_EPOLL
+    int m_eventFD;              /* for interrupt_poll() */
+#else
     /* for self-write pipe hack */
     int m_pipeRead;
     int m_pipeWrite;
+#endif
 
     bool m_timeToDie;
     int m_nThreads;
@@ -17,10 +17,17 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+
 #include "udpack.h"
 #include "mlock.h" 
 
 UDPAckTrack* UDPAckTrack::s_self = NULL;
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
 
 
 /* static*/ bool
@@ -30,13 +37,17 @@ UDPAckTrack::shouldAck( XWRelayReg cmd )
 }
 
 /* static*/ uint32_t
-UDPAckTrack::nextPacketID( XWRelayReg cmd )
+UDPAckTrack::nextPacketIDs( int count )
 {
-    uint32_t result = 0;
-    if ( shouldAck( cmd ) ) {
-        result = get()->nextPacketIDImpl();
-    }
-    return result;
+    UDPAckTrack* self = get();
+    return __sync_add_and_fetch( &self->m_nextID, count ) - count + 1;
+}
+
+/* static*/ bool
+UDPAckTrack::track( int sock, const struct sockaddr* dest, uint32_t packetID,
+                    const unsigned char* buf, size_t len )
+{
+    return get()->trackImpl( sock, dest, packetID, buf, len );
 }
 
 /* static*/ void
@@ -48,15 +59,36 @@ UDPAckTrack::recordAck( uint32_t packetID )
 /* static */ UDPAckTrack*
 UDPAckTrack::get()
 {
-    if ( NULL == s_self ) {
-        s_self = new UDPAckTrack();
-    }
+    pthread_once( &s_once, make_instance );
     return s_self;
 }
 
+/* static */ void
+UDPAckTrack::make_instance()
+{
+    s_self = new UDPAckTrack();
+}
+
+/* static */ void
+UDPAckTrack::sendAll( const vector<Resend>& resends )
+{
+    vector<Resend>::const_iterator iter;
+    for ( iter = resends.begin(); resends.end() != iter; ++iter ) {
+        ssize_t nSent = sendto( iter->sock, &iter->bytes[0],
+                                iter->bytes.size(), 0, &iter->dest.addr,
+                                sizeof(iter->dest.addr) );
+        if ( 0 > nSent ) {
+            logf( XW_LOGERROR, "%s: sendto->errno %d (%s)", __func__, errno,
+                  strerror(errno) );
+        }
+    }
+}
+
 UDPAckTrack::UDPAckTrack()
 {
     m_nextID = 0;
+    m_tick = now_ms() / UDP_TICK_MS;
+    m_nTracked = m_nAcked = m_nResent = m_nWaited = m_nUntracked = 0;
     pthread_mutex_init( &m_mutex, NULL );
 
     pthread_t thread;
@@ -64,66 +96,282 @@ UDPAckTrack::UDPAckTrack()
     pthread_detach( thread );
 }
 
-uint32_t
-UDPAckTrack::nextPacketIDImpl()
+/* Call with m_mutex held */
+UDPAckTrack::Peer&
+UDPAckTrack::getPeer( uint64_t key )
 {
-    MutexLock ml( &m_mutex );
-    AckRecord record;
-    uint32_t result = ++m_nextID;
-    m_pendings.insert( pair<uint32_t,AckRecord>(result, record) );
-    return result;
+    map<uint64_t, Peer>::iterator iter = m_peers.find( key );
+    if ( m_peers.end() == iter ) {
+        Peer peer;
+        peer.srtt = 0;
+        peer.rttvar = 0;
+        peer.rto = UDP_INITIAL_RTO_MS;
+        peer.inFlight = 0;
+        peer.lastUsed = time( NULL );
+        iter = m_peers.insert( pair<uint64_t, Peer>( key, peer ) ).first;
+    }
+    return iter->second;
 }
 
+/* Put packetID on the wheel pending.rto from now.  Call with m_mutex held */
 void
-UDPAckTrack::recordAckImpl( uint32_t packetID )
+UDPAckTrack::schedule( uint32_t packetID, Pending& pending, uint64_t nowMS )
+{
+    uint64_t due = (nowMS + pending.rto + UDP_TICK_MS - 1) / UDP_TICK_MS;
+    if ( due <= m_tick ) {
+        due = m_tick + 1;
+    } else if ( due >= m_tick + UDP_WHEEL_SLOTS ) {
+        due = m_tick + UDP_WHEEL_SLOTS - 1;
+    }
+    pending.dueTick = due;
+    m_wheel[due % UDP_WHEEL_SLOTS].push_back( packetID );
+}
+
+/* The packet's about to be sent for the first time.  Call with m_mutex
+   held */
+void
+UDPAckTrack::launch( uint32_t packetID, Pending& pending, Peer& peer,
+                     uint64_t nowMS )
+{
+    ++peer.inFlight;
+    pending.sentAt = nowMS;
+    pending.nSends = 1;
+    pending.rto = peer.rto;
+    schedule( packetID, pending, nowMS );
+}
+
+/* Send what's waiting for peer as far as its window now allows.  Call with
+   m_mutex held */
+void
+UDPAckTrack::retire( Peer& peer, uint64_t nowMS, vector<Resend>& resends )
+{
+    while ( peer.inFlight < UDP_WINDOW && !peer.waiting.empty() ) {
+        uint32_t packetID = peer.waiting.front();
+        peer.waiting.pop_front();
+        map<uint32_t, Pending>::iterator iter = m_pendings.find( packetID );
+        assert( m_pendings.end() != iter );
+        Pending& pending = iter->second;
+        launch( packetID, pending, peer, nowMS );
+
+        Resend resend;
+        resend.sock = pending.sock;
+        resend.dest = pending.dest;
+        resends.push_back( resend );
+        resends.back().bytes = pending.bytes;
+    }
+}
+
+/* RFC 6298's estimator, in ms.  Call with m_mutex held */
+void
+UDPAckTrack::sampleRTT( Peer& peer, int rtt )
 {
-    map<uint32_t, AckRecord>::iterator iter;
+    if ( 0 >= rtt ) {
+        rtt = 1;
+    }
+    if ( 0 == peer.srtt ) {
+        peer.srtt = rtt;
+        peer.rttvar = rtt / 2;
+    } else {
+        int delta = peer.srtt - rtt;
+        peer.rttvar = (3 * peer.rttvar + (0 > delta ? -delta : delta)) / 4;
+        peer.srtt = (7 * peer.srtt + rtt) / 8;
+    }
+    int rto = peer.srtt + (4 * peer.rttvar > UDP_TICK_MS
+                           ? 4 * peer.rttvar : UDP_TICK_MS);
+    if ( rto < UDP_MIN_RTO_MS ) {
+        rto = UDP_MIN_RTO_MS;
+    } else if ( rto > UDP_MAX_RTO_MS ) {
+        rto = UDP_MAX_RTO_MS;
+    }
+    peer.rto = rto;
+}
+
+bool
+UDPAckTrack::trackImpl( int sock, const struct sockaddr* dest,
+                        uint32_t packetID, const unsigned char* buf,
+                        size_t len )
+{
+    AddrInfo::AddrUnion saddr;
+    memset( &saddr, 0, sizeof(saddr) );
+    memcpy( &saddr.addr, dest, sizeof(*dest) );
+    uint64_t key = ((uint64_t)saddr.addr_in.sin_addr.s_addr << 16)
+        | saddr.addr_in.sin_port;
+    uint64_t nowMS = now_ms();
+
     MutexLock ml( &m_mutex );
-    iter = m_pendings.find( packetID );
-    if ( m_pendings.end() == iter ) {
-        logf( XW_LOGERROR, "%s: packet ID %d not found", __func__, packetID );
+    Peer& peer = getPeer( key );
+    peer.lastUsed = time( NULL );
+    bool sendNow = peer.inFlight < UDP_WINDOW && peer.waiting.empty();
+    if ( !sendNow && UDP_MAX_WAITING <= peer.waiting.size() ) {
+        ++m_nUntracked;         /* better late and unreliable than never */
+        return true;
+    }
+
+    Pending& pending = m_pendings[packetID];
+    pending.peerKey = key;
+    pending.sock = sock;
+    pending.dest = saddr;
+    pending.bytes.assign( buf, buf + len );
+    pending.sentAt = 0;
+    pending.nSends = 0;
+    ++m_nTracked;
+
+    if ( sendNow ) {
+        launch( packetID, pending, peer, nowMS );
     } else {
-        time_t took = time( NULL ) - iter->second.m_createTime;
-        if ( 5 < took  ) {
-            logf( XW_LOGERROR, "%s: packet ID %d took %d seconds to get acked", __func__, packetID );
+        peer.waiting.push_back( packetID );
+        ++m_nWaited;
+    }
+    return sendNow;
+}
+
+void
+UDPAckTrack::recordAckImpl( uint32_t packetID )
+{
+    uint64_t nowMS = now_ms();
+    vector<Resend> resends;
+    {
+        MutexLock ml( &m_mutex );
+        map<uint32_t, Pending>::iterator iter = m_pendings.find( packetID );
+        if ( m_pendings.end() == iter ) {
+            /* a resent packet's acked more than once */
+            logf( XW_LOGINFO, "%s: packet ID %d not pending", __func__,
+                  packetID );
+            return;
+        }
+
+        Pending& pending = iter->second;
+        Peer& peer = getPeer( pending.peerKey );
+        if ( 0 == pending.sentAt ) {
+            logf( XW_LOGERROR, "%s: packet ID %d acked before it was sent",
+                  __func__, packetID );
+            deque<uint32_t>::iterator waiting;
+            for ( waiting = peer.waiting.begin();
+                  peer.waiting.end() != waiting; ++waiting ) {
+                if ( packetID == *waiting ) {
+                    peer.waiting.erase( waiting );
+                    break;
+                }
+            }
+        } else {
+            uint64_t took = nowMS - pending.sentAt;
+            if ( 1 == pending.nSends ) {
+                sampleRTT( peer, took ); /* Karn: resends are ambiguous */
+            }
+            if ( 5000 < took ) {
+                logf( XW_LOGERROR, "%s: packet ID %d took %d ms and %d sends "
+                      "to get acked", __func__, packetID, (int)took,
+                      pending.nSends );
+            }
+            --peer.inFlight;
         }
         m_pendings.erase( iter );
+        ++m_nAcked;
+
+        retire( peer, nowMS, resends );
+    }
+    sendAll( resends );
+}
+
+/* Resend, or give up on, what's due at tickNum.  Call with m_mutex held */
+void
+UDPAckTrack::tick( uint64_t tickNum, uint64_t nowMS, vector<Resend>& resends )
+{
+    m_tick = tickNum;
+    vector<uint32_t> due;
+    due.swap( m_wheel[tickNum % UDP_WHEEL_SLOTS] );
+
+    vector<uint32_t>::const_iterator id;
+    for ( id = due.begin(); due.end() != id; ++id ) {
+        map<uint32_t, Pending>::iterator iter = m_pendings.find( *id );
+        if ( m_pendings.end() == iter || tickNum != iter->second.dueTick ) {
+            continue;           /* acked already */
+        }
+        Pending& pending = iter->second;
+        Peer& peer = getPeer( pending.peerKey );
+        if ( UDP_MAX_SENDS <= pending.nSends ) {
+            m_gaveUp.push_back( *id );
+            m_pendings.erase( iter );
+            --peer.inFlight;
+            retire( peer, nowMS, resends );
+        } else {
+            ++pending.nSends;
+            pending.rto = 2 * pending.rto < UDP_MAX_RTO_MS
+                ? 2 * pending.rto : UDP_MAX_RTO_MS;
+            schedule( *id, pending, nowMS );
+
+            Resend resend;
+            resend.sock = pending.sock;
+            resend.dest = pending.dest;
+            resends.push_back( resend );
+            resends.back().bytes = pending.bytes;
+            ++m_nResent;
+        }
+    }
+}
+
+/* Log what's happened since last time and forget devices that have gone
+   quiet.  Call with m_mutex held */
+void
+UDPAckTrack::logStats( time_t nowSecs )
+{
+    map<uint64_t, Peer>::iterator iter = m_peers.begin();
+    while ( m_peers.end() != iter ) {
+        const Peer& peer = iter->second;
+        if ( 0 == peer.inFlight && peer.waiting.empty()
+             && nowSecs - peer.lastUsed > UDP_PEER_IDLE_SECS ) {
+            m_peers.erase( iter++ );
+        } else {
+            ++iter;
+        }
+    }
+
+    if ( 0 < m_gaveUp.size() ) {
+        string leaked;
+        vector<uint32_t>::const_iterator iter = m_gaveUp.begin();
+        for ( ; ; ) {
+            string_printf( leaked, "%d", *iter );
+            if ( ++iter == m_gaveUp.end() ) {
+                break;
+            }
+            string_printf( leaked, ", " );
+        }
+        logf( XW_LOGERROR, "%s: gave up after %d sends on these packets: %s",
+              __func__, UDP_MAX_SENDS, leaked.c_str() );
+        m_gaveUp.clear();
+    }
+    if ( 0 < m_nTracked || 0 < m_nAcked || 0 < m_nResent
+         || 0 < m_nUntracked ) {
+        logf( XW_LOGINFO, "%s: %d tracked (%d waited for window, %d didn't "
+              "fit), %d acked, %d resent; %d pending for %d devices",
+              __func__, m_nTracked, m_nWaited, m_nUntracked, m_nAcked,
+              m_nResent, (int)m_pendings.size(), (int)m_peers.size() );
+        m_nTracked = m_nAcked = m_nResent = m_nWaited = m_nUntracked = 0;
     }
 }
 
 void*
 UDPAckTrack::threadProc()
 {
+    time_t loggedAt = time( NULL );
     for ( ; ; ) {
-        sleep( 30 );
-        time_t now = time( NULL );
-        vector<uint32_t> older;
+        usleep( UDP_TICK_MS * 1000 );
+        uint64_t nowMS = now_ms();
+        vector<Resend> resends;
         {
             MutexLock ml( &m_mutex );
-            map<uint32_t, AckRecord>::iterator iter;
-            for ( iter = m_pendings.begin(); iter != m_pendings.end(); ++iter ) {
-                time_t took = now - iter->second.m_createTime;
-                if ( 60 < took ) {
-                    older.push_back( iter->first );
-                    m_pendings.erase( iter );
-                }
+            uint64_t target = nowMS / UDP_TICK_MS;
+            while ( m_tick < target ) {
+                tick( m_tick + 1, nowMS, resends );
             }
-        }
-        if ( 0 < older.size() ) {
-            string leaked;
-            vector<uint32_t>::const_iterator iter = older.begin();
-            for ( ; ; ) {
-                string_printf( leaked, "%d", *iter );
-                if ( ++iter == older.end() ) {
-                    break;
-                }
-                string_printf( leaked, ", " );
+
+            time_t nowSecs = time( NULL );
+            if ( nowSecs - loggedAt >= UDP_STATS_SECS ) {
+                loggedAt = nowSecs;
+                logStats( nowSecs );
             }
-            logf( XW_LOGERROR, "%s: these packets leaked: %s", __func__, 
-                  leaked.c_str() );
-        } else {
-            logf( XW_LOGINFO, "%s: no packets leaked", __func__ );
         }
+        sendAll( resends );
     }
     return NULL;
 }
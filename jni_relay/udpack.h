@@ -20,33 +20,114 @@
 #ifndef _UDPACK_H_
 #define _UDPACK_H_
 
+#include <map>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
 #include "xwrelay_priv.h"
 #include "xwrelay.h"
+#include "addrinfo.h"
 
-class AckRecord {
- public: 
-    AckRecord() { m_createTime = time( NULL ); }
-    time_t m_createTime;
-};
+using namespace std;
+
+#define UDP_TICK_MS 100           /* timer wheel resolution */
+#define UDP_WHEEL_SLOTS 512       /* so it spans 51.2 seconds */
+#define UDP_INITIAL_RTO_MS 2000   /* before a device's RTT is known */
+#define UDP_MIN_RTO_MS 500
+#define UDP_MAX_RTO_MS 30000      /* must be less than the wheel's span */
+#define UDP_MAX_SENDS 5           /* sends of a packet before giving up */
+#define UDP_WINDOW 16             /* unacked packets per device */
+#define UDP_MAX_WAITING 256       /* beyond which packets go untracked */
+#define UDP_PEER_IDLE_SECS 600    /* forget a quiet device's RTT after */
+#define UDP_STATS_SECS 30
 
+/* Packets sent to devices that expect acks are kept until acked, and resent
+ * if they aren't, each time waiting twice as long, until UDP_MAX_SENDS have
+ * gone.  The first wait is from the device's round trip time, estimated
+ * per RFC 6298 from acks of packets that were only sent once.  Resends are
+ * driven by a timer wheel ticking every UDP_TICK_MS.  At most UDP_WINDOW
+ * packets to a device are unacked at once: the rest wait, in order, for
+ * acks to make room.  Devices are told apart by address and port, since
+ * that's all a sender has.
+ */
 class UDPAckTrack {
  public:
-    static uint32_t nextPacketID( XWRelayReg cmd );
+    /* First of count consecutive IDs, for packets that should be acked */
+    static uint32_t nextPacketIDs( int count );
+    /* Keep a copy of the packet, whose header carries packetID, for
+       resending.  Returns whether to send it now; if not it'll be sent
+       from here once the window allows. */
+    static bool track( int sock, const struct sockaddr* dest,
+                       uint32_t packetID, const unsigned char* buf,
+                       size_t len );
     static void recordAck( uint32_t packetID ); 
     static bool shouldAck( XWRelayReg cmd );
 
  private:
+    typedef struct {
+        int sock;
+        AddrInfo::AddrUnion dest;
+        vector<unsigned char> bytes;
+    } Resend;
+
+    typedef struct {
+        uint64_t peerKey;
+        int sock;
+        AddrInfo::AddrUnion dest;
+        vector<unsigned char> bytes;
+        uint64_t sentAt;        /* ms, first send; 0 while waiting */
+        uint64_t dueTick;       /* when to resend if not acked */
+        int rto;                /* ms to wait this time */
+        int nSends;
+    } Pending;
+
+    typedef struct {
+        int srtt;               /* ms; 0 until there's a sample */
+        int rttvar;
+        int rto;
+        int inFlight;
+        deque<uint32_t> waiting;
+        time_t lastUsed;
+    } Peer;
+
     static UDPAckTrack* get();
+    static void make_instance();
     static void* thread_main( void* arg );
+    static void sendAll( const vector<Resend>& resends );
+
     UDPAckTrack();
-    uint32_t nextPacketIDImpl();
+    bool trackImpl( int sock, const struct sockaddr* dest, uint32_t packetID,
+                    const unsigned char* buf, size_t len );
     void recordAckImpl( uint32_t packetID ); 
     void* threadProc();
 
+    Peer& getPeer( uint64_t key );
+    void launch( uint32_t packetID, Pending& pending, Peer& peer,
+                 uint64_t nowMS );
+    void schedule( uint32_t packetID, Pending& pending, uint64_t nowMS );
+    void retire( Peer& peer, uint64_t nowMS, vector<Resend>& resends );
+    void tick( uint64_t tickNum, uint64_t nowMS, vector<Resend>& resends );
+    void sampleRTT( Peer& peer, int rtt );
+    void logStats( time_t nowSecs );
+
     static UDPAckTrack* s_self;
-    uint32_t m_nextID;
+    volatile uint32_t m_nextID;
     pthread_mutex_t m_mutex;
-    map<uint32_t, AckRecord> m_pendings;
+    map<uint32_t, Pending> m_pendings;
+    map<uint64_t, Peer> m_peers;
+    vector<uint32_t> m_wheel[UDP_WHEEL_SLOTS];
+    uint64_t m_tick;            /* last tick processed */
+
+    /* since last logged */
+    int m_nTracked;
+    int m_nAcked;
+    int m_nResent;
+    int m_nWaited;
+    int m_nUntracked;
+    vector<uint32_t> m_gaveUp;
 };
 
 #endif
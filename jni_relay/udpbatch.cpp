@@ -0,0 +1,279 @@
+/* -*- compile-command: "make -k -j3"; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "udpbatch.h"
+#include "udpack.h"
+#include "pktslab.h"
+
+#define MAX_BATCHES_PER_READ 4  /* so TCP listeners get a turn */
+
+static Pow2Hist s_recvHist( "recvmmsg", "packets", UDP_HIST_INTERVAL );
+static Pow2Hist s_sendHist( "sendmmsg", "packets", UDP_HIST_INTERVAL );
+
+static __thread UdpSendBatch* t_batch = NULL;
+
+static void
+fill_header( unsigned char* header, uint32_t packetNum, XWRelayReg cmd )
+{
+    header[0] = XWPDEV_PROTO_VERSION;
+    packetNum = htonl( packetNum );
+    memcpy( &header[1], &packetNum, sizeof(packetNum) );
+    header[5] = cmd;
+}
+
+UdpRecvRing::UdpRecvRing()
+{
+    memset( m_msgs, 0, sizeof(m_msgs) );
+    for ( int ii = 0; ii < UDP_BATCH_SIZE; ++ii ) {
+        setBuf( ii );
+        m_msgs[ii].msg_hdr.msg_iov = &m_iovecs[ii];
+        m_msgs[ii].msg_hdr.msg_iovlen = 1;
+        m_msgs[ii].msg_hdr.msg_name = &m_addrs[ii];
+    }
+}
+
+UdpRecvRing::~UdpRecvRing()
+{
+    for ( int ii = 0; ii < UDP_BATCH_SIZE; ++ii ) {
+        PacketSlab::release( m_bufs[ii] );
+    }
+}
+
+void
+UdpRecvRing::setBuf( int indx )
+{
+    m_bufs[indx] = PacketSlab::alloc();
+    m_iovecs[indx].iov_base = m_bufs[indx];
+    m_iovecs[indx].iov_len = MAX_MSG_LEN;
+}
+
+int
+UdpRecvRing::receive( int sock, UdpRecvProc proc )
+{
+    int total = 0;
+    for ( int nBatches = 0; nBatches < MAX_BATCHES_PER_READ; ++nBatches ) {
+        for ( int ii = 0; ii < UDP_BATCH_SIZE; ++ii ) {
+            memset( &m_addrs[ii], 0, sizeof(m_addrs[ii]) );
+            m_msgs[ii].msg_hdr.msg_namelen = sizeof(m_addrs[ii].addr_in);
+        }
+
+        int nRead = recvmmsg( sock, m_msgs, UDP_BATCH_SIZE, MSG_DONTWAIT,
+                              NULL );
+        if ( 0 > nRead ) {
+            if ( EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno ) {
+                logf( XW_LOGERROR, "%s: recvmmsg->errno %d (%s)", __func__,
+                      errno, strerror(errno) );
+            }
+            break;
+        } else if ( 0 == nRead ) {
+            break;
+        }
+
+        s_recvHist.note( nRead );
+        logf( XW_LOGVERBOSE0, "%s: recvmmsg=>%d", __func__, nRead );
+        for ( int ii = 0; ii < nRead; ++ii ) {
+            int len = m_msgs[ii].msg_len;
+            if ( 0 < len ) {
+                (*proc)( sock, &m_addrs[ii], m_bufs[ii], len );
+                setBuf( ii );
+            }
+        }
+        total += nRead;
+
+        if ( nRead < UDP_BATCH_SIZE ) {
+            break;              /* that's all there is */
+        }
+    }
+    return total;
+}
+
+UdpSendBatch::UdpSendBatch()
+    : m_count(0)
+    , m_sock(-1)
+    , m_firstAt(0)
+{
+    assert( NULL == t_batch );
+    m_packets = new Packet[UDP_BATCH_SIZE];
+    t_batch = this;
+}
+
+UdpSendBatch::~UdpSendBatch()
+{
+    flush();
+    t_batch = NULL;
+    delete[] m_packets;
+}
+
+void
+UdpSendBatch::flush()
+{
+    if ( 0 < m_count ) {
+        int nAcked = 0;
+        int ii;
+        for ( ii = 0; ii < m_count; ++ii ) {
+            if ( UDPAckTrack::shouldAck( m_packets[ii].cmd ) ) {
+                ++nAcked;
+            }
+        }
+        uint32_t packetID = 0 < nAcked ? UDPAckTrack::nextPacketIDs( nAcked )
+            : 0;
+
+        struct iovec vecs[UDP_BATCH_SIZE];
+        struct mmsghdr msgs[UDP_BATCH_SIZE];
+        memset( msgs, 0, sizeof(msgs) );
+        int nMsgs = 0;
+        for ( ii = 0; ii < m_count; ++ii ) {
+            Packet* packet = &m_packets[ii];
+            uint32_t thisID = UDPAckTrack::shouldAck( packet->cmd )
+                ? packetID++ : 0;
+            fill_header( packet->buf, thisID, packet->cmd );
+            if ( 0 != thisID
+                 && !UDPAckTrack::track( m_sock, &packet->dest.addr, thisID,
+                                         packet->buf, packet->len ) ) {
+                continue;       /* it'll go when the window opens */
+            }
+            vecs[nMsgs].iov_base = packet->buf;
+            vecs[nMsgs].iov_len = packet->len;
+            msgs[nMsgs].msg_hdr.msg_iov = &vecs[nMsgs];
+            msgs[nMsgs].msg_hdr.msg_iovlen = 1;
+            msgs[nMsgs].msg_hdr.msg_name = &packet->dest;
+            msgs[nMsgs].msg_hdr.msg_namelen = sizeof(packet->dest.addr);
+            ++nMsgs;
+        }
+
+        for ( int nSent = 0; nSent < nMsgs; ) {
+            int result = sendmmsg( m_sock, &msgs[nSent], nMsgs - nSent, 0 );
+            if ( 0 > result && EINTR == errno ) {
+                continue;
+            } else if ( 0 >= result ) {
+                logf( XW_LOGERROR, "%s: sendmmsg->errno %d (%s); dropped %d",
+                      __func__, errno, strerror(errno), nMsgs - nSent );
+                break;
+            }
+            nSent += result;
+        }
+        logf( XW_LOGVERBOSE0, "%s()=>%d packets", __func__, nMsgs );
+        if ( 0 < nMsgs ) {
+            s_sendHist.note( nMsgs );
+        }
+        m_count = 0;
+    }
+}
+
+void
+UdpSendBatch::flushIfOlder( int ms )
+{
+    if ( 0 < m_count && now_ms() - m_firstAt >= (uint64_t)ms ) {
+        flush();
+    }
+}
+
+ssize_t
+UdpSendBatch::add( int sock, const struct sockaddr* dest, XWRelayReg cmd,
+                   const struct iovec* vec, int iocount, size_t len )
+{
+    if ( 0 < m_count && sock != m_sock ) {
+        flush();
+    }
+    if ( 0 == m_count ) {
+        m_sock = sock;
+        m_firstAt = now_ms();
+    }
+
+    Packet* packet = &m_packets[m_count];
+    memset( &packet->dest, 0, sizeof(packet->dest) );
+    memcpy( &packet->dest.addr, dest, sizeof(*dest) );
+    packet->cmd = cmd;
+    packet->len = len;
+    unsigned char* ptr = packet->buf + vec[0].iov_len; /* header's later */
+    for ( int ii = 1; ii < iocount; ++ii ) {
+        memcpy( ptr, vec[ii].iov_base, vec[ii].iov_len );
+        ptr += vec[ii].iov_len;
+    }
+
+    if ( ++m_count == UDP_BATCH_SIZE ) {
+        flush();
+    }
+    return len;
+}
+
+/* static */ ssize_t
+UdpSendBatch::send( int sock, const struct sockaddr* dest, XWRelayReg cmd,
+                    const struct iovec* payload, int nPayload )
+{
+    struct iovec vec[10];
+    assert( nPayload < (int)(sizeof(vec)/sizeof(vec[0])) );
+    unsigned char header[1 + 1 + sizeof(uint32_t)];
+    vec[0].iov_base = header;
+    vec[0].iov_len = sizeof(header);
+    size_t len = sizeof(header);
+    for ( int ii = 0; ii < nPayload; ++ii ) {
+        vec[ii+1] = payload[ii];
+        len += payload[ii].iov_len;
+    }
+
+    ssize_t nSent;
+    UdpSendBatch* batch = t_batch;
+    if ( NULL != batch && len <= sizeof(batch->m_packets[0].buf) ) {
+        nSent = batch->add( sock, dest, cmd, vec, 1 + nPayload, len );
+    } else {
+        if ( NULL != batch ) {
+            batch->flush();     /* keep packets in order */
+        }
+        uint32_t packetID = UDPAckTrack::shouldAck( cmd )
+            ? UDPAckTrack::nextPacketIDs( 1 ) : 0;
+        fill_header( header, packetID, cmd );
+
+        bool sendNow = true;
+        if ( 0 != packetID ) {
+            vector<unsigned char> bytes;
+            bytes.reserve( len );
+            for ( int ii = 0; ii <= nPayload; ++ii ) {
+                const unsigned char* base =
+                    (const unsigned char*)vec[ii].iov_base;
+                bytes.insert( bytes.end(), base, base + vec[ii].iov_len );
+            }
+            sendNow = UDPAckTrack::track( sock, dest, packetID, &bytes[0],
+                                          len );
+        }
+
+        if ( !sendNow ) {
+            nSent = len;
+        } else {
+            struct msghdr mhdr = {0};
+            mhdr.msg_iov = vec;
+            mhdr.msg_iovlen = 1 + nPayload;
+            mhdr.msg_name = (void*)dest;
+            mhdr.msg_namelen = sizeof(*dest);
+
+            nSent = sendmsg( sock, &mhdr, 0 /* flags */);
+            if ( 0 > nSent ) {
+                logf( XW_LOGERROR, "sendmsg->errno %d (%s)", errno,
+                      strerror(errno) );
+            }
+        }
+    }
+    return nSent;
+}
@@ -0,0 +1,104 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _UDPBATCH_H_
+#define _UDPBATCH_H_
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "xwrelay_priv.h"
+#include "xwrelay.h"
+#include "addrinfo.h"
+
+#define UDP_BATCH_SIZE 32       /* most packets per recvmmsg()/sendmmsg() */
+#define UDP_BATCH_MAX_MS 5      /* longest a queued outgoing packet waits */
+
+/* How many packets each recvmmsg() and sendmmsg() moved are counted by
+ * power of two, and the counts logged every UDP_HIST_INTERVAL batches, for
+ * tuning UDP_BATCH_SIZE.
+ */
+#define UDP_HIST_INTERVAL 1000
+
+/* proc owns buf, which came from PacketSlab::alloc(), and must see that it's
+   released */
+typedef void (*UdpRecvProc)( int sock, const AddrInfo::AddrUnion* saddr,
+                             unsigned char* buf, int len );
+
+/* PacketSlab buffers to read UDP_BATCH_SIZE packets at a time into.  Each
+   filled buffer is handed off with its packet and replaced.  Each thread that
+   reads needs its own ring. */
+class UdpRecvRing {
+ public:
+    UdpRecvRing();
+    ~UdpRecvRing();
+
+    /* Read what's waiting on sock, which must be non-blocking, and pass each
+       packet to proc.  Returns the number of packets read. */
+    int receive( int sock, UdpRecvProc proc );
+
+ private:
+    void setBuf( int indx );
+
+    unsigned char* m_bufs[UDP_BATCH_SIZE];
+    AddrInfo::AddrUnion m_addrs[UDP_BATCH_SIZE];
+    struct iovec m_iovecs[UDP_BATCH_SIZE];
+    struct mmsghdr m_msgs[UDP_BATCH_SIZE];
+};
+
+/* While one exists, UDP packets the thread that made it sends are queued,
+ * and go out together with one sendmmsg() when it's flushed: by flush(), by
+ * flushIfOlder(), when it fills, or when it's destroyed.  The packet IDs of
+ * a batch are assigned at flush with one trip into UDPAckTrack, which keeps
+ * each packet that wants an ack and may hold it back.  Threads without one
+ * send each packet as it comes.
+ */
+class UdpSendBatch {
+ public:
+    UdpSendBatch();
+    ~UdpSendBatch();
+
+    void flush();
+    void flushIfOlder( int ms );
+
+    /* Prefix the header for cmd to payload, then send it or add it to the
+       calling thread's batch */
+    static ssize_t send( int sock, const struct sockaddr* dest,
+                         XWRelayReg cmd, const struct iovec* payload,
+                         int nPayload );
+
+ private:
+    ssize_t add( int sock, const struct sockaddr* dest, XWRelayReg cmd,
+                 const struct iovec* vec, int iocount, size_t len );
+
+    typedef struct _Packet {
+        AddrInfo::AddrUnion dest;
+        XWRelayReg cmd;
+        size_t len;
+        /* header, then a client token or the like, then the message */
+        unsigned char buf[MAX_MSG_LEN + 16];
+    } Packet;
+
+    Packet* m_packets;          /* UDP_BATCH_SIZE of them */
+    int m_count;
+    int m_sock;
+    uint64_t m_firstAt;         /* ms when m_packets[0] was added */
+};
+
+#endif
@@ -20,23 +20,39 @@
  */
 
 #include "udpqueue.h"
+#include "udpbatch.h"
 #include "mlock.h"
 
 
+#define METRICS_INTERVAL 1000   /* packets between logs */
+
 static UdpQueue* s_instance = NULL;
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+
+/* Reader threads may all want it at once, and there must be only one
+   consumer */
+static void
+make_instance( void )
+{
+    s_instance = new UdpQueue();
+}
 
 
 void 
 UdpThreadClosure::logStats()
 {
-    time_t now = time( NULL );
-    if ( 1 < now - m_created ) {
-        logf( XW_LOGERROR, "packet waited %d s for processing which then took %d s",
-              m_dequed - m_created, now - m_dequed );
+    uint64_t took = now_ms() - m_dequed;
+    if ( 1000 < waited() + took ) {
+        logf( XW_LOGERROR, "packet waited %d ms for processing which then "
+              "took %d ms", (int)waited(), (int)took );
     }
 }
 
 UdpQueue::UdpQueue() 
+    : m_nHandled(0)
+    , m_totalWait(0)
+    , m_maxWait(0)
+    , m_maxDepth(0)
 {
     pthread_mutex_init ( &m_queueMutex, NULL );
     pthread_cond_init( &m_queueCondVar, NULL );
@@ -57,9 +73,7 @@ UdpQueue::~UdpQueue()
 UdpQueue* 
 UdpQueue::get()
 {
-    if ( s_instance == NULL ) {
-        s_instance = new UdpQueue();
-    }
+    pthread_once( &s_once, make_instance );
     return s_instance;
 }
 
@@ -70,23 +84,56 @@ UdpQueue::handle( const AddrInfo* addr, unsigned char* buf, int len,
     UdpThreadClosure* utc = new UdpThreadClosure( addr, buf, len, cb );
     MutexLock ml( &m_queueMutex );
     m_queue.push_back( utc );
+    if ( m_queue.size() > m_maxDepth ) {
+        m_maxDepth = m_queue.size();
+    }
     pthread_cond_signal( &m_queueCondVar );
 }
 
+/* Call with m_queueMutex held */
+void
+UdpQueue::noteHandled( const UdpThreadClosure* utc )
+{
+    uint64_t waited = utc->waited();
+    m_totalWait += waited;
+    if ( waited > m_maxWait ) {
+        m_maxWait = waited;
+    }
+    if ( ++m_nHandled == METRICS_INTERVAL ) {
+        logf( XW_LOGINFO, "%s: %d packets waited %d ms on average, %d at "
+              "most; queue depth %d at most, %d now", __func__, m_nHandled, (int)(m_totalWait / m_nHandled), (int)m_maxWait,
+              (int)m_maxDepth, (int)m_queue.size() );
+        m_nHandled = 0;
+        m_totalWait = 0;
+        m_maxWait = 0;
+        m_maxDepth = m_queue.size();
+    }
+}
+
 void* 
 UdpQueue::thread_main()
 {
+    /* Replies to packets that arrive together go out together */
+    UdpSendBatch batch;
+
     for ( ; ; ) {
         pthread_mutex_lock( &m_queueMutex );
+        if ( m_queue.size() == 0 ) {
+            pthread_mutex_unlock( &m_queueMutex );
+            batch.flush();
+            pthread_mutex_lock( &m_queueMutex );
+        }
         while ( m_queue.size() == 0 ) {
             pthread_cond_wait( &m_queueCondVar, &m_queueMutex );
         }
         UdpThreadClosure* utc = m_queue.front();
         m_queue.pop_front();
+        utc->noteDequeued();
+        noteHandled( utc );
         pthread_mutex_unlock( &m_queueMutex );
 
-        utc->noteDequeued();
         (*utc->cb())( utc );
+        batch.flushIfOlder( UDP_BATCH_MAX_MS );
         utc->logStats();
         delete utc;
     }
@@ -101,4 +148,3 @@ UdpQueue::thread_main_static( void* closure )
     UdpQueue* me = (UdpQueue*)closure;
     return me->thread_main();
 }
-
@@ -26,6 +26,7 @@
 
 #include "xwrelay_priv.h"
 #include "addrinfo.h"
+#include "pktslab.h"
 
 using namespace std;
 
@@ -35,24 +36,24 @@ typedef void (*QueueCallback)( UdpThreadClosure* closure );
 
 class UdpThreadClosure {
 public:
+    /* Takes ownership of buf, which must come from PacketSlab::alloc() */
     UdpThreadClosure( const AddrInfo* addr, unsigned char* buf, 
                       int len, QueueCallback cb )
-        : m_buf(new unsigned char[len])
+        : m_buf(buf)
         , m_len(len)
         , m_addr(*addr)
         , m_cb(cb)
-        , m_created(time( NULL ))
-        { 
-            memcpy( m_buf, buf, len ); 
-        }
+        , m_created(now_ms())
+        {}
 
-    ~UdpThreadClosure() { delete m_buf; }
+    ~UdpThreadClosure() { PacketSlab::release( m_buf ); }
 
     const unsigned char* buf() const { return m_buf; } 
     int len() const { return m_len; }
     const AddrInfo::AddrUnion* saddr() const { return m_addr.saddr(); }
     const AddrInfo* addr() const { return &m_addr; }
-    void noteDequeued() { m_dequed = time( NULL ); }
+    void noteDequeued() { m_dequed = now_ms(); }
+    uint64_t waited() const { return m_dequed - m_created; } /* ms */
     void logStats();
     const QueueCallback cb() const { return m_cb; }
 
@@ -61,8 +62,8 @@ public:
     int m_len;
     AddrInfo m_addr;
     QueueCallback m_cb;
-    time_t m_created;
-    time_t m_dequed;
+    uint64_t m_created;
+    uint64_t m_dequed;
 };
 
 class UdpQueue {
@@ -70,17 +71,24 @@ class UdpQueue {
     static UdpQueue* get();
     UdpQueue();
     ~UdpQueue();
+    /* buf must come from PacketSlab::alloc(); the queue releases it */
     void handle( const AddrInfo* addr, unsigned char* buf, int len,
                  QueueCallback cb );
 
  private:
     static void* thread_main_static( void* closure );
     void* thread_main();
+    void noteHandled( const UdpThreadClosure* utc );
 
     pthread_mutex_t m_queueMutex;
     pthread_cond_t m_queueCondVar;
     deque<UdpThreadClosure*> m_queue;
 
+    /* metrics, since last logged; guarded by m_queueMutex */
+    int m_nHandled;
+    uint64_t m_totalWait;       /* ms between enqueue and dequeue */
+    uint64_t m_maxWait;
+    size_t m_maxDepth;
 };
 
 #endif
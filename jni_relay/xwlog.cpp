@@ -0,0 +1,379 @@
+/* -*- compile-command: "make MEMDEBUG=TRUE -j3"; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <syslog.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#include "xwlog.h"
+#include "configs.h"
+
+#define LINE_LEN 512            /* longer lines are truncated */
+#define RING_SIZE 128           /* lines per thread */
+#define REOPEN_SECONDS 1        /* how often to check for logrotate */
+
+typedef struct _LogLine {
+    struct timeval tv;
+    pthread_t thread;
+    char text[LINE_LEN];
+} LogLine;
+
+/* One per thread that's logged.  tail is written only by the owning thread
+   and head only by whoever holds s_drainMutex.  Rings are never freed: when
+   a thread exits its ring goes to the next new thread that logs. */
+typedef struct _LogRing {
+    struct _LogRing* next;
+    volatile int inUse;
+    volatile unsigned int head; /* next line to write out */
+    volatile unsigned int tail; /* next line to fill */
+    LogLine lines[RING_SIZE];
+} LogRing;
+
+/* Everything, until RelayConfigs has been read */
+static volatile int s_logLevel = XW_LOGVERBOSE1;
+
+static pthread_mutex_t s_configMutex = PTHREAD_MUTEX_INITIALIZER;
+static char s_logPath[256];     /* empty for stderr */
+
+static LogRing* volatile s_rings = NULL;
+static __thread LogRing* t_ring = NULL;
+static pthread_key_t s_ringKey;
+static pthread_once_t s_ringKeyOnce = PTHREAD_ONCE_INIT;
+
+static bool s_started = false;
+static sem_t s_linesSem;
+static volatile unsigned int s_nDropped = 0;
+
+/* The rest belong to the writer */
+static pthread_mutex_t s_drainMutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE* s_where = NULL;
+static char s_openPath[256];
+static ino_t s_openInode = 0;
+static time_t s_checkedAt = 0;
+static unsigned int s_nReported = 0;
+
+static int s_tm_yday = 0;
+
+static void
+write_line( FILE* where, const LogLine* line )
+{
+    struct tm result;
+    struct tm* timp = localtime_r( &line->tv.tv_sec, &result );
+
+    /* log the date once/day.  This isn't threadsafe before xwlog_start() so
+       may be repeated but that's harmless. */
+    if ( s_tm_yday != timp->tm_yday ) {
+        s_tm_yday = timp->tm_yday;
+        fprintf( where, "It's a new day: %.2d/%.2d/%d\n", timp->tm_mday,
+                 1 + timp->tm_mon, /* 0-based */
+                 1900 + timp->tm_year ); /* 1900-based */
+    }
+
+    fprintf( where, "<%p>%.2d:%.2d:%.2d: %s\n", (void*)line->thread,
+             timp->tm_hour, timp->tm_min, timp->tm_sec, line->text );
+}
+
+static void
+get_path( char* buf, size_t len )
+{
+    pthread_mutex_lock( &s_configMutex );
+    snprintf( buf, len, "%s", s_logPath );
+    pthread_mutex_unlock( &s_configMutex );
+}
+
+/* The old way: open, write and close for each line */
+static void
+write_now( const LogLine* line )
+{
+    char path[sizeof(s_logPath)];
+    get_path( path, sizeof(path) );
+
+    bool useFile = '\0' != path[0];
+    FILE* where = useFile ? fopen( path, "a" ) : stderr;
+    if ( !!where ) {
+        write_line( where, line );
+        if ( useFile ) {
+            fclose( where );
+        }
+    }
+}
+
+/* Make sure s_where is the file LOGFILE_PATH names now.  Reopening when the
+   inode changes lets logrotate work as it did when every line reopened. */
+static void
+check_file( void )
+{
+    time_t now = time( NULL );
+    if ( !!s_where && now < s_checkedAt + REOPEN_SECONDS ) {
+        return;
+    }
+    s_checkedAt = now;
+
+    char path[sizeof(s_logPath)];
+    get_path( path, sizeof(path) );
+
+    bool reopen;
+    struct stat sbuf;
+    if ( '\0' == path[0] ) {
+        reopen = stderr != s_where;
+    } else {
+        reopen = NULL == s_where || stderr == s_where
+            || 0 != strcmp( path, s_openPath )
+            || 0 != stat( path, &sbuf ) || sbuf.st_ino != s_openInode;
+    }
+
+    if ( reopen ) {
+        if ( !!s_where && stderr != s_where ) {
+            fclose( s_where );
+        }
+        if ( '\0' == path[0] ) {
+            s_where = stderr;
+        } else {
+            s_where = fopen( path, "a" );
+            if ( !!s_where && 0 == fstat( fileno(s_where), &sbuf ) ) {
+                s_openInode = sbuf.st_ino;
+            }
+        }
+        snprintf( s_openPath, sizeof(s_openPath), "%s", path );
+    }
+}
+
+/* Write out everything in every ring, merging by time.  Call with
+   s_drainMutex held. */
+static void
+drain_rings( void )
+{
+    check_file();
+
+    for ( ; ; ) {
+        LogRing* oldest = NULL;
+        const LogLine* oldestLine = NULL;
+        LogRing* ring;
+        for ( ring = s_rings; !!ring; ring = ring->next ) {
+            unsigned int head = ring->head;
+            if ( head != ring->tail ) {
+                __sync_synchronize(); /* see the line before the tail */
+                const LogLine* line = &ring->lines[head % RING_SIZE];
+                if ( NULL == oldestLine
+                     || timercmp( &line->tv, &oldestLine->tv, < ) ) {
+                    oldest = ring;
+                    oldestLine = line;
+                }
+            }
+        }
+        if ( NULL == oldest ) {
+            break;
+        }
+
+        if ( !!s_where ) {
+            write_line( s_where, oldestLine );
+        }
+        __sync_synchronize(); /* done with the line before freeing it */
+        ++oldest->head;
+    }
+
+    unsigned int nDropped = s_nDropped;
+    if ( nDropped != s_nReported && !!s_where ) {
+        LogLine line;
+        gettimeofday( &line.tv, NULL );
+        line.thread = pthread_self();
+        snprintf( line.text, sizeof(line.text),
+                  "%s: %d log lines dropped (%d total)", __func__,
+                  nDropped - s_nReported, nDropped );
+        write_line( s_where, &line );
+        s_nReported = nDropped;
+    }
+
+    if ( !!s_where ) {
+        fflush( s_where );
+    }
+} /* drain_rings */
+
+static void*
+writer_main( void* closure )
+{
+    blockSignals();
+
+    for ( ; ; ) {
+        struct timespec ts;
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts.tv_sec += REOPEN_SECONDS;
+        (void)sem_timedwait( &s_linesSem, &ts );
+        /* one pass handles all that have been posted */
+        while ( 0 == sem_trywait( &s_linesSem ) ) {
+        }
+
+        pthread_mutex_lock( &s_drainMutex );
+        drain_rings();
+        pthread_mutex_unlock( &s_drainMutex );
+    }
+    return NULL;
+}
+
+static void
+flush_at_exit( void )
+{
+    pthread_mutex_lock( &s_drainMutex );
+    drain_rings();
+    pthread_mutex_unlock( &s_drainMutex );
+}
+
+static void
+release_ring( void* closure )
+{
+    LogRing* ring = (LogRing*)closure;
+    __sync_lock_release( &ring->inUse );
+}
+
+static void
+make_ring_key( void )
+{
+    pthread_key_create( &s_ringKey, release_ring );
+}
+
+static LogRing*
+get_ring( void )
+{
+    LogRing* ring = t_ring;
+    if ( NULL == ring ) {
+        /* Use one whose thread has exited if there is one */
+        for ( ring = s_rings; !!ring; ring = ring->next ) {
+            if ( __sync_bool_compare_and_swap( &ring->inUse, 0, 1 ) ) {
+                break;
+            }
+        }
+        if ( NULL == ring ) {
+            ring = (LogRing*)calloc( 1, sizeof(*ring) );
+            if ( NULL != ring ) {
+                ring->inUse = 1;
+                LogRing* head;
+                do {
+                    head = s_rings;
+                    ring->next = head;
+                } while ( !__sync_bool_compare_and_swap( &s_rings, head,
+                                                         ring ) );
+            }
+        }
+        if ( NULL != ring ) {
+            pthread_once( &s_ringKeyOnce, make_ring_key );
+            pthread_setspecific( s_ringKey, ring );
+            t_ring = ring;
+        }
+    }
+    return ring;
+}
+
+void
+logf( XW_LogLevel level, const char* format, ... )
+{
+    if ( __builtin_expect( level > s_logLevel, 1 ) ) {
+        return;
+    }
+
+#ifdef USE_SYSLOG
+    char buf[256];
+    va_list ap;
+    va_start( ap, format );
+    vsnprintf( buf, sizeof(buf), format, ap );
+    syslog( LOG_LOCAL0 | LOG_INFO, "%s", buf );
+    va_end(ap);
+#else
+    if ( !s_started ) {
+        LogLine line;
+        gettimeofday( &line.tv, NULL );
+        line.thread = pthread_self();
+        va_list ap;
+        va_start( ap, format );
+        vsnprintf( line.text, sizeof(line.text), format, ap );
+        va_end(ap);
+        write_now( &line );
+    } else {
+        LogRing* ring = get_ring();
+        unsigned int tail;
+        if ( NULL == ring
+             || ((tail = ring->tail) - ring->head) >= RING_SIZE ) {
+            __sync_fetch_and_add( &s_nDropped, 1 );
+        } else {
+            __sync_synchronize(); /* writer's done with the slot */
+            LogLine* line = &ring->lines[tail % RING_SIZE];
+            gettimeofday( &line->tv, NULL );
+            line->thread = pthread_self();
+            va_list ap;
+            va_start( ap, format );
+            vsnprintf( line->text, sizeof(line->text), format, ap );
+            va_end(ap);
+
+            __sync_synchronize(); /* line's complete before it's visible */
+            ring->tail = tail + 1;
+            sem_post( &s_linesSem );
+        }
+    }
+#endif
+} /* logf */
+
+void
+xwlog_start( void )
+{
+#ifndef USE_SYSLOG
+    if ( !s_started ) {
+        sem_init( &s_linesSem, 0, 0 );
+        atexit( flush_at_exit );
+
+        pthread_t thread;
+        int result = pthread_create( &thread, NULL, writer_main, NULL );
+        if ( 0 == result ) {
+            pthread_detach( thread );
+            s_started = true;
+        } else {
+            logf( XW_LOGERROR, "%s: pthread_create=>%s", __func__,
+                  strerror(result) );
+        }
+    }
+#endif
+}
+
+void
+xwlog_reloadConfigs( void )
+{
+    RelayConfigs* rc = RelayConfigs::GetConfigs();
+    if ( NULL != rc ) {
+        int level;
+        if ( ! rc->GetValueFor( "LOGLEVEL", &level ) ) {
+            level = -1;         /* drop everything */
+        }
+
+        pthread_mutex_lock( &s_configMutex );
+        if ( !rc->GetValueFor( "LOGFILE_PATH", s_logPath,
+                               sizeof(s_logPath) ) ) {
+            s_logPath[0] = '\0';
+        }
+        pthread_mutex_unlock( &s_configMutex );
+
+        s_logLevel = level;
+        s_checkedAt = 0;        /* writer: check path on next pass */
+    }
+}
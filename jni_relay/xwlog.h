@@ -0,0 +1,42 @@
+/* -*- compile-command: "make MEMDEBUG=TRUE -j3"; -*- */
+/*
+ * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _XWLOG_H_
+#define _XWLOG_H_
+
+#include "xwrelay_priv.h"
+
+/* logf() (declared in xwrelay_priv.h) formats each line into a ring buffer
+ * belonging to the calling thread and returns without taking any lock.  A
+ * single writer thread moves lines from all the rings to the log file, which
+ * it keeps open, oldest first.  A thread whose ring is full loses the line,
+ * and the writer says how many were lost.
+ *
+ * Until xwlog_start() is called lines are written as they come, which is
+ * all the parent process of SPAWN_SELF ever does.
+ */
+
+/* Call once, in the process that'll do the work (i.e. after any fork()) */
+void xwlog_start( void );
+
+/* Re-read LOGLEVEL and LOGFILE_PATH from RelayConfigs, which logf() never
+   consults itself.  Call whenever either's changed. */
+void xwlog_reloadConfigs( void );
+
+#endif
@@ -47,10 +47,12 @@
 #include <pthread.h>
 #include <assert.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 #include <stdarg.h>
 #include <syslog.h>
 #include <sys/wait.h>
 #include <sys/prctl.h>
+#include <poll.h>
 
 #if defined(__FreeBSD__)
 # if (OSVERSION > 500000)
@@ -78,7 +80,9 @@
 #include "addrinfo.h"
 #include "devmgr.h"
 #include "udpqueue.h"
+#include "udpbatch.h"
 #include "udpack.h"
+#include "xwlog.h"
 
 typedef struct _UDPHeader {
     uint32_t packetID;
@@ -88,77 +92,24 @@ typedef struct _UDPHeader {
 
 static int s_nSpawns = 0;
 static int g_maxsocks = -1;
-static int g_udpsock = -1;
+static int g_udpsock = -1;     /* the first of g_udpsocks */
 
-void
-logf( XW_LogLevel level, const char* format, ... )
-{
-    RelayConfigs* rc = RelayConfigs::GetConfigs();
-    int configLevel = level;
-
-    if ( NULL != rc ) {
-
-        if ( ! rc->GetValueFor( "LOGLEVEL", &configLevel ) ) {
-            configLevel = level - 1; /* drop it */
-        }
-    }
-
-    if ( level <= configLevel ) {
-#ifdef USE_SYSLOG
-        char buf[256];
-        va_list ap;
-        va_start( ap, format );
-        vsnprintf( buf, sizeof(buf), format, ap );
-        syslog( LOG_LOCAL0 | LOG_INFO, buf );
-        va_end(ap);
-#else
-        FILE* where = NULL;
-        struct tm* timp;
-        struct timeval tv;
-        bool useFile;
-        char logFile[256];
-
-        useFile = rc->GetValueFor( "LOGFILE_PATH", logFile, sizeof(logFile) );
-
-        if ( useFile ) {
-            where = fopen( logFile, "a" );
-        } else  {
-            where = stderr;
-        }
+#define MAX_UDP_SOCKETS 32
+/* All bound to the UDP port.  If there's more than one each is read by its
+   own thread rather than the main loop */
+static int g_udpsocks[MAX_UDP_SOCKETS];
+static int g_nUdpSocks = 0;
 
-        if ( !!where ) {
-            static int tm_yday = 0;
-            gettimeofday( &tv, NULL );
-            struct tm result;
-            timp = localtime_r( &tv.tv_sec, &result );
-
-            /* log the date once/day.  This isn't threadsafe so may be
-               repeated but that's harmless. */
-            if ( tm_yday != timp->tm_yday ) {
-                tm_yday = timp->tm_yday;
-                fprintf( where, "It's a new day: %.2d/%.2d/%d\n", timp->tm_mday,
-                         1 + timp->tm_mon, /* 0-based */
-                         1900 + timp->tm_year ); /* 1900-based */
-            }
-
-            pthread_t me = pthread_self();
-
-            fprintf( where, "<%p>%.2d:%.2d:%.2d: ", (void*)me, timp->tm_hour, 
-                     timp->tm_min, timp->tm_sec );
-
-            va_list ap;
-            va_start( ap, format );
-            vfprintf( where, format, ap );
-            va_end(ap);
-            fprintf( where, "\n" );
-
-            if ( useFile && !!where ) {
-                fclose( where );
-            }
+static bool
+is_udp_socket( int socket )
+{
+    for ( int ii = 0; ii < g_nUdpSocks; ++ii ) {
+        if ( g_udpsocks[ii] == socket ) {
+            return true;
         }
-#endif
     }
-} /* logf */
+    return false;
+}
 
 const char*
 cmdToStr( XWRELAY_Cmd cmd )
@@ -400,19 +351,9 @@ static ssize_t
 send_via_udp( int socket, const struct sockaddr *dest_addr, 
               XWRelayReg cmd, ... )
 {
-    uint32_t packetNum = UDPAckTrack::nextPacketID( cmd );
     struct iovec vec[10];
     int iocount = 0;
 
-    unsigned char header[1 + 1 + sizeof(packetNum)];
-    header[0] = XWPDEV_PROTO_VERSION;
-    packetNum = htonl( packetNum );
-    memcpy( &header[1], &packetNum, sizeof(packetNum) );
-    header[5] = cmd;
-    vec[iocount].iov_base = header;
-    vec[iocount].iov_len = sizeof(header);
-    ++iocount;
-
     va_list ap;
     va_start( ap, cmd );
     for ( ; ; ) {
@@ -426,16 +367,7 @@ send_via_udp( int socket, const struct sockaddr *dest_addr,
     }
     va_end( ap );
 
-    struct msghdr mhdr = {0};
-    mhdr.msg_iov = vec;
-    mhdr.msg_iovlen = iocount;
-    mhdr.msg_name = (void*)dest_addr;
-    mhdr.msg_namelen = sizeof(*dest_addr);
-
-    ssize_t nSent = sendmsg( socket, &mhdr, 0 /* flags */);
-    if ( 0 > nSent ) {
-        logf( XW_LOGERROR, "sendmsg->errno %d (%s)", errno, strerror(errno) );
-    }
+    ssize_t nSent = UdpSendBatch::send( socket, dest_addr, cmd, vec, iocount );
     logf( XW_LOGINFO, "%s()=>%d", __func__, nSent );
     return nSent;
 }
@@ -465,7 +397,7 @@ send_with_length_unsafe( const AddrInfo* addr, const unsigned char* buf,
         assert( 0 != clientToken );
         clientToken = htonl(clientToken);
         const struct sockaddr* saddr = addr->sockaddr();
-        assert( g_udpsock == socket || socket == -1 );
+        assert( is_udp_socket( socket ) || socket == -1 );
         if ( -1 == socket ) {
             socket = g_udpsock;
         }
@@ -482,6 +414,74 @@ send_with_length_unsafe( const AddrInfo* addr, const unsigned char* buf,
     return ok;
 } /* send_with_length_unsafe */
 
+#define MSGS_PER_WRITEV 256     /* two iovecs each; IOV_MAX is 1024 */
+
+int
+send_msgs_unsafe( const AddrInfo* addr, const unsigned char* const* bufs,
+                  const size_t* lens, int nMsgs )
+{
+    int nSent = 0;
+    if ( !addr->isTCP() ) {
+        /* On a UdpQueue worker these go out with one sendmmsg() */
+        for ( ; nSent < nMsgs; ++nSent ) {
+            if ( !send_with_length_unsafe( addr, bufs[nSent], lens[nSent] ) ) {
+                break;
+            }
+        }
+        return nSent;
+    }
+
+    int socket = addr->socket();
+    while ( nSent < nMsgs ) {
+        int nThis = nMsgs - nSent;
+        if ( nThis > MSGS_PER_WRITEV ) {
+            nThis = MSGS_PER_WRITEV;
+        }
+        unsigned short lenNBO[MSGS_PER_WRITEV];
+        struct iovec vecs[2 * MSGS_PER_WRITEV];
+        for ( int ii = 0; ii < nThis; ++ii ) {
+            lenNBO[ii] = htons( lens[nSent + ii] );
+            vecs[2*ii].iov_base = &lenNBO[ii];
+            vecs[2*ii].iov_len = sizeof(lenNBO[ii]);
+            vecs[(2*ii)+1].iov_base = (void*)bufs[nSent + ii];
+            vecs[(2*ii)+1].iov_len = lens[nSent + ii];
+        }
+
+        /* Keep going after short writes, counting the messages that are
+           wholly out */
+        struct iovec* vec = vecs;
+        int nVecs = 2 * nThis;
+        while ( 0 < nVecs ) {
+            ssize_t nWritten = writev( socket, vec, nVecs );
+            if ( 0 > nWritten && EINTR == errno ) {
+                continue;
+            } else if ( 0 >= nWritten ) {
+                logf( XW_LOGERROR, "%s: writev(socket=%d)=>%d (%s)",
+                      __func__, socket, errno, strerror(errno) );
+                break;
+            }
+            while ( 0 < nVecs && (size_t)nWritten >= vec->iov_len ) {
+                nWritten -= vec->iov_len;
+                ++vec;
+                --nVecs;
+                if ( 0 == nVecs % 2 ) {
+                    ++nSent;    /* a message's second iovec */
+                }
+            }
+            if ( 0 < nWritten ) {
+                vec->iov_base = (unsigned char*)vec->iov_base + nWritten;
+                vec->iov_len -= nWritten;
+            }
+        }
+        if ( 0 < nVecs ) {
+            break;
+        }
+    }
+    logf( XW_LOGINFO, "%s: sent %d of %d msgs on socket %d", __func__,
+          nSent, nMsgs, socket );
+    return nSent;
+}
+
 void
 send_havemsgs( const AddrInfo* addr )
 {
@@ -664,6 +664,47 @@ uptime( void )
     return time(NULL) - startTime;
 }
 
+uint64_t
+now_ms( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+Pow2Hist::Pow2Hist( const char* name, const char* units,
+                    unsigned int interval )
+    : m_name(name)
+    , m_units(units)
+    , m_interval(interval)
+    , m_nNoted(0)
+{
+    memset( (void*)m_counts, 0, sizeof(m_counts) );
+}
+
+void
+Pow2Hist::note( int val )
+{
+    int indx = 0;
+    while ( 0 < val && indx < POW2HIST_BUCKETS - 1 ) {
+        val >>= 1;
+        ++indx;
+    }
+    __sync_fetch_and_add( &m_counts[indx], 1 );
+    unsigned int nNoted = __sync_add_and_fetch( &m_nNoted, 1 );
+    if ( 0 == nNoted % m_interval ) {
+        string counts;
+        for ( int ii = 0; ii < POW2HIST_BUCKETS; ++ii ) {
+            if ( 0 != m_counts[ii] ) {
+                string_printf( counts, " %d:%d", 0 == ii ? 0 : 1 << (ii-1),
+                               m_counts[ii] );
+            }
+        }
+        logf( XW_LOGINFO, "%s: %d; %s(>=):count%s", m_name, nNoted,
+              m_units, counts.c_str() );
+    }
+}
+
 void
 blockSignals( void )
 {
@@ -840,6 +881,9 @@ shutdown()
 
     delete tPool;
 
+    DBMgr::Get()->FlushStoredMessages( true );
+    DBMgr::Get()->FlushSent();
+
     //stop_ctrl_threads();
 
     g_listeners.RemoveAll();
@@ -925,26 +969,69 @@ pushShort( vector<unsigned char>& out, unsigned short num )
     out.insert( out.end(), (unsigned char*)&num, ((unsigned char*)&num) + 2 );
 }
 
+/* Builds the getmsgs reply: for each game a count followed by that many
+   messages.  Messages arrive grouped by game, so each game's count is
+   patched in once the next game's (or the last) starts. */
+typedef struct _PushState {
+    vector<unsigned char>* out;
+    vector<int>* msgIDs;
+    int nGames;
+    int curIndx;                /* 1-based; 0 before the first game */
+    size_t countAt;             /* where the current game's count goes */
+    unsigned short count;
+} PushState;
+
+/* Finish the current game and start those up to and including indx */
 static void
-pushMsgs( vector<unsigned char>& out, DBMgr* dbmgr, const char* connName, 
-          HostID hid, int msgCount, vector<int>& msgIDs )
+advanceTo( PushState* ps, int indx )
 {
-    int ii;
-    for ( ii = 0; ii < msgCount; ++ii ) {
-        unsigned char buf[1024];
-        size_t buflen = sizeof(buf);
-        int msgID;
-        if ( !dbmgr->GetNthStoredMessage( connName, hid, ii, buf, 
-                                          &buflen, &msgID ) ) {
-            logf( XW_LOGERROR, "%s: %dth message not there", __func__, ii );
-            break;
+    while ( ps->curIndx < indx ) {
+        if ( 0 < ps->curIndx ) {
+            unsigned short tmp = htons( ps->count );
+            memcpy( &(*ps->out)[ps->countAt], &tmp, sizeof(tmp) );
+        }
+        if ( ++ps->curIndx <= ps->nGames ) {
+            ps->countAt = ps->out->size();
+            ps->count = 0;
+            pushShort( *ps->out, 0 );
         }
-        pushShort( out, buflen );
-        out.insert( out.end(), buf, buf + buflen );
-        msgIDs.push_back( msgID );
     }
 }
 
+static bool
+pushMsg( void* closure, int indx, int msgID, AddrInfo::ClientToken token,
+         const unsigned char* buf, size_t len )
+{
+    PushState* ps = (PushState*)closure;
+    advanceTo( ps, indx );
+    ++ps->count;
+    pushShort( *ps->out, len );
+    ps->out->insert( ps->out->end(), buf, buf + len );
+    ps->msgIDs->push_back( msgID );
+    return true;
+}
+
+static void
+pushMsgs( vector<unsigned char>& out, DBMgr* dbmgr, 
+          const vector<const char*>& connNames, const vector<HostID>& hids,
+          vector<int>& msgIDs )
+{
+    PushState ps;
+    ps.out = &out;
+    ps.msgIDs = &msgIDs;
+    ps.nGames = connNames.size();
+    ps.curIndx = 0;
+    ps.countAt = 0;
+    ps.count = 0;
+
+    if ( 0 < ps.nGames ) {
+        dbmgr->GetPendingMsgs( &connNames[0], &hids[0], ps.nGames, pushMsg,
+                               &ps );
+    }
+    /* finish the last game, and any empty ones before it */
+    advanceTo( &ps, ps.nGames + 1 );
+}
+
 static void
 handleMsgsMsg( const AddrInfo* addr, bool sendFull,
                const unsigned char* bufp, const unsigned char* end )
@@ -956,18 +1043,19 @@ handleMsgsMsg( const AddrInfo* addr, bool sendFull,
         vector<unsigned char> out(4); /* space for len and n_msgs */
         assert( out.size() == 4 );
         vector<int> msgIDs;
-        for ( ii = 0; ii < nameCount && bufp < end; ++ii ) {
-
-            // See NetUtils.java for reply format
-            // message-length: 2
-            // nameCount: 2
-            // name count reps of:
-            //    counts-this-name: 2
-            //    counts-this-name reps of
-            //       len: 2
-            //       msg: <len>
 
-            // pack msgs for one game
+        // See NetUtils.java for reply format
+        // message-length: 2
+        // nameCount: 2
+        // name count reps of:
+        //    counts-this-name: 2
+        //    counts-this-name reps of
+        //       len: 2
+        //       msg: <len>
+
+        vector<string> connNames;
+        vector<HostID> hids;
+        for ( ii = 0; ii < nameCount && bufp < end; ++ii ) {
             HostID hid;
             char connName[MAX_CONNNAME_LEN+1];
             if ( !parseRelayID( &bufp, end, connName, sizeof(connName),
@@ -976,13 +1064,24 @@ handleMsgsMsg( const AddrInfo* addr, bool sendFull,
             }
 
             dbmgr->RecordAddress( connName, hid, addr );
+            connNames.push_back( connName );
+            hids.push_back( hid );
+        }
+        vector<const char*> names;
+        for ( size_t jj = 0; jj < connNames.size(); ++jj ) {
+            names.push_back( connNames[jj].c_str() );
+        }
 
-            /* For each relayID, write the number of messages and then
-               each message (in the getmsg case) */
-            int msgCount = dbmgr->PendingMsgCount( connName, hid );
-            pushShort( out, msgCount );
-            if ( sendFull ) {
-                pushMsgs( out, dbmgr, connName, hid, msgCount, msgIDs );
+        /* For each relayID, write the number of messages and then each
+           message (in the getmsg case) */
+        if ( sendFull ) {
+            pushMsgs( out, dbmgr, names, hids, msgIDs );
+        } else if ( 0 < names.size() ) {
+            vector<int> counts( names.size() );
+            dbmgr->GetPendingMsgCounts( &names[0], &hids[0], names.size(), 
+                                        &counts[0] );
+            for ( size_t jj = 0; jj < names.size(); ++jj ) {
+                pushShort( out, counts[jj] );
             }
         }
 
@@ -992,9 +1091,9 @@ handleMsgsMsg( const AddrInfo* addr, bool sendFull,
         memcpy( &out[2], &tmp, sizeof(tmp) );
         ssize_t nwritten = write( addr->socket(), &out[0], out.size() );
         logf( XW_LOGVERBOSE0, "%s: wrote %d bytes", __func__, nwritten );
-        if ( sendFull && nwritten >= 0 && (size_t)nwritten == out.size() ) {
-            dbmgr->RecordSent( &msgIDs[0], msgIDs.size() );
-            dbmgr->RemoveStoredMessages( &msgIDs[0], msgIDs.size() );
+        if ( sendFull && nwritten >= 0 && (size_t)nwritten == out.size()
+             && 0 < msgIDs.size() ) {
+            dbmgr->RecordSentAndRemove( &msgIDs[0], msgIDs.size() );
         }
     }
 } // handleMsgsMsg
@@ -1221,8 +1320,9 @@ addRegID( unsigned char* ptr, DevIDRelay relayID )
 }
 
 static void 
-registerDevice( const DevID* devID, const AddrInfo::AddrUnion* saddr )
+registerDevice( const DevID* devID, const AddrInfo* addr )
 {
+    const AddrInfo::AddrUnion* saddr = addr->saddr();
     DevIDRelay relayID;
     DBMgr* dbMgr = DBMgr::Get();
     short indx = 0;
@@ -1238,8 +1338,8 @@ registerDevice( const DevID* devID, const AddrInfo::AddrUnion* saddr )
             }
         } else {
             indx += addRegID( &buf[indx], relayID );
-            send_via_udp( g_udpsock, &saddr->addr, XWPDEV_BADREG, buf, indx, 
-                          NULL );
+            send_via_udp( addr->socket(), &saddr->addr, XWPDEV_BADREG, buf,
+                          indx, NULL );
 
             relayID = DBMgr::DEVID_NONE;
         } 
@@ -1248,7 +1348,7 @@ registerDevice( const DevID* devID, const AddrInfo::AddrUnion* saddr )
         if ( DBMgr::DEVID_NONE != relayID ) {
             // send it back to the device
             indx += addRegID( &buf[indx], relayID );
-            send_via_udp( g_udpsock, &saddr->addr, XWPDEV_REGRSP, buf, 
+            send_via_udp( addr->socket(), &saddr->addr, XWPDEV_REGRSP, buf, 
                           indx, NULL );
         }
     }
@@ -1259,28 +1359,38 @@ registerDevice( const DevID* devID, const AddrInfo::AddrUnion* saddr )
     }
 }
 
+typedef struct _RetrieveState {
+    int socket;
+    const AddrInfo::AddrUnion* saddr;
+    vector<int> sentIDs;
+} RetrieveState;
+
+static bool
+sendStoredMsg( void* closure, int indx, int msgID, 
+               AddrInfo::ClientToken clientToken, const unsigned char* buf, 
+               size_t len )
+{
+    RetrieveState* rs = (RetrieveState*)closure;
+    AddrInfo addr( rs->socket, clientToken, rs->saddr );
+    bool sent = send_with_length_unsafe( &addr, buf, len );
+    if ( sent ) {
+        rs->sentIDs.push_back( msgID );
+    }
+    return sent;
+}
+
 static void
-retrieveMessages( DevID& devID, const AddrInfo::AddrUnion* saddr )
+retrieveMessages( DevID& devID, const AddrInfo* addr )
 {
     logf( XW_LOGINFO, "%s()", __func__ );
     DBMgr* dbMgr = DBMgr::Get();
-    vector<int> ids;
-    vector<int> sentIDs;
-    dbMgr->GetStoredMessageIDs( devID.asRelayID(), ids );
-    vector<int>::const_iterator iter;
-    for ( iter = ids.begin(); iter != ids.end(); ++iter ) {
-        unsigned char buf[MAX_MSG_LEN];
-        size_t buflen = sizeof(buf);
-        AddrInfo::ClientToken clientToken;
-        if ( dbMgr->GetStoredMessage( *iter, buf, &buflen, &clientToken ) ) {
-            AddrInfo addr( -1, clientToken, saddr );
-            if ( ! send_with_length_unsafe( &addr, buf, buflen ) ) {
-                break;
-            }
-            sentIDs.push_back( *iter );
-        }
+    RetrieveState rs;
+    rs.socket = addr->socket();
+    rs.saddr = addr->saddr();
+    dbMgr->GetDeviceMsgs( devID.asRelayID(), sendStoredMsg, &rs );
+    if ( 0 < rs.sentIDs.size() ) {
+        dbMgr->RecordSentAndRemove( &rs.sentIDs[0], rs.sentIDs.size() );
     }
-    dbMgr->RemoveStoredMessages( sentIDs );
 }
 
 static const char*
@@ -1337,7 +1447,7 @@ udp_thread_proc( UdpThreadClosure* utc )
             DevIDType typ = (DevIDType)*ptr++;
             DevID devID( typ );
             if ( getRelayDevID( &ptr, end, devID ) ) {
-                registerDevice( &devID, utc->saddr() );
+                registerDevice( &devID, utc->addr() );
             }
             break;
         }
@@ -1347,7 +1457,8 @@ udp_thread_proc( UdpThreadClosure* utc )
             ptr += sizeof(clientToken);
             clientToken = ntohl( clientToken );
             if ( 0 != clientToken ) {
-                AddrInfo addr( g_udpsock, clientToken, utc->saddr() );
+                AddrInfo addr( utc->addr()->socket(), clientToken,
+                               utc->saddr() );
                 (void)processMessage( ptr, end - ptr, &addr );
             } else {
                 logf( XW_LOGERROR, "%s: dropping packet with token of 0" );
@@ -1366,7 +1477,8 @@ udp_thread_proc( UdpThreadClosure* utc )
                 }
                 SafeCref scr( connName );
                 if ( scr.IsValid() ) {
-                    AddrInfo addr( g_udpsock, clientToken, utc->saddr() );
+                    AddrInfo addr( utc->addr()->socket(), clientToken,
+                                   utc->saddr() );
                     handlePutMessage( scr, hid, &addr, end - ptr, &ptr, end );
                     assert( ptr == end ); // DON'T CHECK THIS IN!!!
                 } else {
@@ -1391,7 +1503,7 @@ udp_thread_proc( UdpThreadClosure* utc )
             DevID devID( ID_TYPE_RELAY );
             devID.m_devIDString.append( (const char*)ptr, idLen );
             ptr += idLen;
-            retrieveMessages( devID, utc->saddr() );
+            retrieveMessages( devID, utc->addr() );
             break;
         }
         case XWPDEV_ACK: {
@@ -1426,21 +1538,91 @@ udp_thread_proc( UdpThreadClosure* utc )
     }
 }
 
+static void
+queue_udp_packet( int udpsock, const AddrInfo::AddrUnion* saddr,
+                  unsigned char* buf, int len )
+{
+    AddrInfo addr( udpsock, saddr, false );
+    UdpQueue::get()->handle( &addr, buf, len, udp_thread_proc );
+}
+
 static void
 handle_udp_packet( int udpsock )
 {
-    unsigned char buf[MAX_MSG_LEN];
-    AddrInfo::AddrUnion saddr;
-    memset( &saddr, 0, sizeof(saddr) );
-    socklen_t fromlen = sizeof(saddr.addr_in);
+    static UdpRecvRing s_ring;  /* only the main thread reads */
+    s_ring.receive( udpsock, queue_udp_packet );
+}
+
+/* When there are several UDP sockets each gets one of these */
+static void*
+udp_reader_main( void* arg )
+{
+    blockSignals();
+
+    int udpsock = (int)(intptr_t)arg;
+    logf( XW_LOGINFO, "%s: reading UDP socket %d", __func__, udpsock );
+    UdpRecvRing ring;
+    struct pollfd pfd;
+    pfd.fd = udpsock;
+    pfd.events = POLLIN;
+    for ( ; ; ) {
+        int nReady = poll( &pfd, 1, -1 );
+        if ( 0 > nReady ) {
+            if ( EINTR != errno ) {
+                logf( XW_LOGERROR, "%s: poll()=>%s", __func__,
+                      strerror(errno) );
+                break;
+            }
+        } else if ( 0 < nReady ) {
+            ring.receive( udpsock, queue_udp_packet );
+        }
+    }
+    return NULL;
+}
 
-    ssize_t nRead = recvfrom( udpsock, buf, sizeof(buf), 0 /*flags*/,
-                              &saddr.addr, &fromlen );
-    logf( XW_LOGINFO, "%s: recvfrom=>%d", __func__, nRead );
-    if ( 0 < nRead ) {
-        AddrInfo addr( udpsock, &saddr, false );
-        UdpQueue::get()->handle( &addr, buf, nRead, udp_thread_proc );
+/* Bind nSockets sockets to port, sharing it via SO_REUSEPORT if there's
+   more than one, so the kernel spreads devices across them */
+static void
+open_udp_sockets( int port, int nSockets )
+{
+#ifndef SO_REUSEPORT
+    if ( 1 < nSockets ) {
+        logf( XW_LOGERROR, "%s: no SO_REUSEPORT; using one socket",
+              __func__ );
+        nSockets = 1;
     }
+#endif
+    if ( MAX_UDP_SOCKETS < nSockets ) {
+        nSockets = MAX_UDP_SOCKETS;
+    }
+
+    for ( int ii = 0; ii < nSockets; ++ii ) {
+        int sock = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+#ifdef SO_REUSEPORT
+        if ( 1 < nSockets ) {
+            int on = 1;
+            if ( 0 != setsockopt( sock, SOL_SOCKET, SO_REUSEPORT, &on,
+                                  sizeof(on) ) ) {
+                logf( XW_LOGERROR, "setsockopt(SO_REUSEPORT)=>%s",
+                      strerror(errno) );
+            }
+        }
+#endif
+        struct sockaddr_in saddr;
+        saddr.sin_family = PF_INET;
+        saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+        saddr.sin_port = htons(port);
+        int err = bind( sock, (struct sockaddr*)&saddr, sizeof(saddr) );
+        if ( 0 == err ) {
+            err = fcntl( sock, F_SETFL, O_NONBLOCK );
+        } else {
+            logf( XW_LOGERROR, "bind()=>%s", strerror(errno) );
+            close( sock );
+            break;
+        }
+        g_udpsocks[g_nUdpSocks++] = sock;
+    }
+    g_udpsock = 0 < g_nUdpSocks ? g_udpsocks[0] : -1;
 }
 
 /* From stack overflow, toward a snprintf with an expanding buffer.
@@ -1676,6 +1858,7 @@ main( int argc, char** argv )
     if ( NULL != logFile ) {
         cfg->SetValueFor( "LOGFILE_PATH", logFile );
     }
+    xwlog_reloadConfigs();
 
     if ( ctrlport == 0 ) {
         (void)cfg->GetValueFor( "CTLPORT", &ctrlport );
@@ -1691,6 +1874,11 @@ main( int argc, char** argv )
     if ( nWorkerThreads == 0 ) {
         (void)cfg->GetValueFor( "NTHREADS", &nWorkerThreads );
     }
+    int nUdpSockets;
+    if ( !cfg->GetValueFor( "UDP_SOCKETS", &nUdpSockets )
+         || 1 > nUdpSockets ) {
+        nUdpSockets = 1;
+    }
     if ( g_maxsocks == -1 && !cfg->GetValueFor( "MAXSOCKS", &g_maxsocks ) ) {
         g_maxsocks = 100;
     }
@@ -1760,18 +1948,8 @@ main( int argc, char** argv )
 #endif
 
     if ( -1 != udpport ) {
-        struct sockaddr_in saddr;
-        g_udpsock = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
-        saddr.sin_family = PF_INET;
-        saddr.sin_addr.s_addr = htonl(INADDR_ANY);
-        saddr.sin_port = htons(udpport);
-        int err = bind( g_udpsock, (struct sockaddr*)&saddr, sizeof(saddr) );
-        if ( 0 == err ) {
-            err = fcntl( g_udpsock, F_SETFL, O_NONBLOCK );
-        } else {
-            logf( XW_LOGERROR, "bind()=>%s", strerror(errno) );
-            g_udpsock = -1;
-        }
+        /* maint_str_loop() only reads the one */
+        open_udp_sockets( udpport, !!maint_str ? 1 : nUdpSockets );
     }
 
     if ( !!maint_str ) {
@@ -1779,6 +1957,9 @@ main( int argc, char** argv )
         exit( 1 );              // should never exit
     }
 
+    /* Only now, in the child, is there a process to run the writer */
+    xwlog_start();
+
     /* Needs to be reset after a crash/respawn */
     PermID::SetStartTime( time(NULL) );
 
@@ -1867,13 +2048,23 @@ main( int argc, char** argv )
     XWThreadPool* tPool = XWThreadPool::GetTPool();
     tPool->Setup( nWorkerThreads, killSocket );
 
+    if ( 1 < g_nUdpSocks ) {
+        (void)UdpQueue::get();  /* workers up before the readers feed them */
+        for ( int ii = 0; ii < g_nUdpSocks; ++ii ) {
+            pthread_t thread;
+            pthread_create( &thread, NULL, udp_reader_main,
+                            (void*)(intptr_t)g_udpsocks[ii] );
+            pthread_detach( thread );
+        }
+    }
+
     /* set up select call */
     fd_set rfds;
     for ( ; ; ) {
         FD_ZERO(&rfds);
         g_listeners.AddToFDSet( &rfds );
         FD_SET( g_control, &rfds );
-        if ( -1 != g_udpsock ) {
+        if ( 1 == g_nUdpSocks ) {
             FD_SET( g_udpsock, &rfds );
         }
 #ifdef DO_HTTP
@@ -1885,7 +2076,7 @@ main( int argc, char** argv )
         if ( g_control > highest ) {
             highest = g_control;
         }
-        if ( g_udpsock > highest ) {
+        if ( 1 == g_nUdpSocks && g_udpsock > highest ) {
             highest = g_udpsock;
         }
 #ifdef DO_HTTP
@@ -1948,9 +2139,8 @@ main( int argc, char** argv )
                 // run_ctrl_thread( g_control );
                 --retval;
             }
-            if ( FD_ISSET( g_udpsock, &rfds ) ) {
-                // This will need to be done in a separate thread, or pushed
-                // to the existing thread pool
+            if ( 1 == g_nUdpSocks && FD_ISSET( g_udpsock, &rfds ) ) {
+                /* with more sockets, each has its own reader thread */
                 handle_udp_packet( g_udpsock );
                 --retval;
             }
@@ -46,9 +46,31 @@ void logf( XW_LogLevel level, const char* format, ... );
 void denyConnection( const AddrInfo* addr, XWREASON err );
 bool send_with_length_unsafe( const AddrInfo* addr, 
                               const unsigned char* buf, size_t bufLen );
+/* send_with_length_unsafe() for each, TCP ones with as few writev()s as
+   will hold them.  Returns how many got out, the rest having failed. */
+int send_msgs_unsafe( const AddrInfo* addr, const unsigned char* const* bufs,
+                      const size_t* lens, int nMsgs );
 void send_havemsgs( const AddrInfo* addr );
 
 time_t uptime(void);
+uint64_t now_ms( void );        /* CLOCK_MONOTONIC, for timing things */
+
+#define POW2HIST_BUCKETS 16
+
+/* Counts of values by power of two (0, 1, 2-3, 4-7...), logged with name
+   every interval values.  Safe to note() from any thread. */
+class Pow2Hist {
+ public:
+    Pow2Hist( const char* name, const char* units, unsigned int interval );
+    void note( int val );
+
+ private:
+    const char* m_name;
+    const char* m_units;
+    unsigned int m_interval;
+    volatile unsigned int m_nNoted;
+    volatile unsigned int m_counts[POW2HIST_BUCKETS];
+};
 
 void blockSignals( void );      /* call from all but main thread */
 